@@ -0,0 +1,36 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+// Written to by benchmarks so the compiler cannot drop the work whose result nobody reads.
+inline volatile std::size_t g_benchmarkSink = 0;
+
+// Runs `body` once untimed, then repeatedly until at least `min_time` has passed, and returns the mean time of one
+// run in microseconds.
+template <class Body>
+double measure(Body&& body, std::chrono::milliseconds min_time = std::chrono::milliseconds(500)) {
+    using Clock = std::chrono::steady_clock;
+    body();
+    std::size_t runs = 0;
+    const auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    do {
+        body();
+        ++runs;
+        elapsed = Clock::now() - start;
+    } while (elapsed < min_time);
+    return std::chrono::duration<double, std::micro>(elapsed).count() / static_cast<double>(runs);
+}
+
+inline void printComparison(const char* name, double before_us, double after_us) {
+    std::printf("%-40s %12.1f us %12.1f us %8.2fx\n", name, before_us, after_us, before_us / after_us);
+}
+
+inline void printComparisonHeader(const char* before, const char* after) {
+    std::printf("%-40s %15s %15s %9s\n", "", before, after, "speedup");
+}
+
+#endif
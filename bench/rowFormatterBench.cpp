@@ -0,0 +1,344 @@
+// Compares RowFormatter with the per-piece wxString formatting it replaced, on a page of the message view and on a
+// full rebuild of a large chat list. Both paths must produce the same text; the run fails if they do not.
+
+#include "benchmark.h"
+
+#include "rowFormatter.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <wx/datetime.h>
+#include <wx/init.h>
+#include <wx/string.h>
+
+namespace td_api = td::td_api;
+
+namespace {
+
+constexpr std::size_t kPageSize = 50;
+constexpr std::size_t kChatCount = 10000;
+constexpr std::int64_t kBaseTime = 1760000000;
+
+// ---- The formatting RowFormatter replaced, as the baseline, cut down to the content the test data has. ----
+
+wxString legacyTimestamp(std::int64_t unix_time) {
+    if (unix_time == 0) {
+        return "N/A";
+    }
+    wxDateTime dt(static_cast<time_t>(unix_time));
+    return dt.Format("%Y-%m-%d %H:%M");
+}
+
+wxString legacyContentPreview(const td_api::MessageContent* content) {
+    if (!content) {
+        return "No messages";
+    }
+    switch (content->get_id()) {
+        case td_api::messageText::ID:
+            return wxString::FromUTF8(static_cast<const td_api::messageText*>(content)->text_->text_);
+        case td_api::messageDocument::ID:
+            return "[File]";
+        case td_api::messagePhoto::ID:
+            return "[Photo]";
+        case td_api::messageVoiceNote::ID:
+            return "[Voice message]";
+        default:
+            return "[Unsupported message]";
+    }
+}
+
+wxString legacyContent(const td_api::MessageContent* content) {
+    if (!content) {
+        return "[Empty message]";
+    }
+    wxString formatted_content;
+    wxString type_str;
+    switch (content->get_id()) {
+        case td_api::messageText::ID:
+            return wxString::FromUTF8(static_cast<const td_api::messageText*>(content)->text_->text_);
+        case td_api::messageVoiceNote::ID: {
+            auto* voice = static_cast<const td_api::messageVoiceNote*>(content);
+            type_str = "Voice";
+            if (voice->voice_note_) {
+                formatted_content = wxString::Format("%d seconds", voice->voice_note_->duration_);
+            }
+            break;
+        }
+        case td_api::messageDocument::ID:
+            type_str = "File";
+            formatted_content =
+                wxString::FromUTF8(static_cast<const td_api::messageDocument*>(content)->document_->file_name_);
+            break;
+        case td_api::messagePhoto::ID: {
+            type_str = "Photo";
+            auto* photo = static_cast<const td_api::messagePhoto*>(content);
+            if (!photo->caption_->text_.empty()) {
+                formatted_content = wxString::FromUTF8(photo->caption_->text_);
+            }
+            break;
+        }
+        default:
+            type_str = "Other";
+            formatted_content = "Unsupported content";
+            break;
+    }
+    return type_str + (formatted_content.IsEmpty() ? "" : ", " + formatted_content);
+}
+
+wxString legacyMessageRow(const td_api::message& message, const td_api::user& sender) {
+    wxString sender_str = wxString::FromUTF8(sender.first_name_ + " " + sender.last_name_);
+    return wxString::Format("%s: %s, received at %s", sender_str, legacyContent(message.content_.get()),
+                            legacyTimestamp(message.date_));
+}
+
+wxString legacyChatRow(const td_api::chat& chat) {
+    wxString type_prefix;
+    if (chat.type_->get_id() == td_api::chatTypeSupergroup::ID) {
+        type_prefix = static_cast<const td_api::chatTypeSupergroup*>(chat.type_.get())->is_channel_ ? "Channel. "
+                                                                                                     : "Supergroup. ";
+    } else if (chat.type_->get_id() == td_api::chatTypeBasicGroup::ID) {
+        type_prefix = "Group. ";
+    }
+    wxString title = type_prefix + wxString::FromUTF8(chat.title_);
+    wxString unread;
+    if (chat.unread_count_ > 0) {
+        unread = wxString::Format(", %d unread messages", chat.unread_count_);
+    }
+    wxString last_message;
+    if (chat.last_message_) {
+        last_message = wxString::Format(", received at %s: %s", legacyTimestamp(chat.last_message_->date_),
+                                        legacyContentPreview(chat.last_message_->content_.get()));
+    }
+    return title + unread + last_message;
+}
+
+// ---- The same rows through RowFormatter, as CMainWindow builds them now. ----
+
+wxString formatMessageRow(RowFormatter& formatter, const td_api::message& message, const td_api::user& sender) {
+    return formatter.begin()
+        .append(sender.first_name_)
+        .append(" ")
+        .append(sender.last_name_)
+        .append(": ")
+        .appendContent(message.content_.get())
+        .append(", received at ")
+        .appendTimestamp(message.date_)
+        .finish();
+}
+
+// The segments of a chat row as CChatRow keeps them, UTF-8 until the row text is built.
+struct ChatRow {
+    std::string title;
+    std::string unread;
+    std::string last_message;
+    std::string utf8;
+    wxString text;
+};
+
+// Formats every segment, as after a rebuild, and converts the row only if its text changed.
+bool renderChatRow(RowFormatter& formatter, const td_api::chat& chat, ChatRow& row) {
+    formatter.begin();
+    if (chat.type_->get_id() == td_api::chatTypeSupergroup::ID) {
+        formatter.append(static_cast<const td_api::chatTypeSupergroup*>(chat.type_.get())->is_channel_
+                             ? "Channel. "
+                             : "Supergroup. ");
+    } else if (chat.type_->get_id() == td_api::chatTypeBasicGroup::ID) {
+        formatter.append("Group. ");
+    }
+    row.title.assign(formatter.append(chat.title_).view());
+    formatter.begin();
+    if (chat.unread_count_ > 0) {
+        formatter.append(", ").appendNumber(chat.unread_count_).append(" unread messages");
+    }
+    row.unread.assign(formatter.view());
+    formatter.begin();
+    if (chat.last_message_) {
+        formatter.append(", received at ")
+            .appendTimestamp(chat.last_message_->date_)
+            .append(": ")
+            .appendContentPreview(chat.last_message_->content_.get());
+    }
+    row.last_message.assign(formatter.view());
+
+    formatter.begin().append(row.title).append(row.unread).append(row.last_message);
+    if (formatter.view() == row.utf8) {
+        return false;
+    }
+    row.utf8.assign(formatter.view());
+    row.text = formatter.finish();
+    return true;
+}
+
+// ---- Test data: a mix of Latin, Cyrillic and emoji text with some media, as a busy chat has. ----
+
+const char* const kTexts[] = {
+    "ok",
+    "See you at the station at half past six, the train leaves from platform 4",
+    "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, \xD0\xBA\xD0\xB0\xD0\xBA \xD0\xB4\xD0\xB5\xD0\xBB\xD0\xB0?",
+    "Thanks! \xF0\x9F\x98\x80\xF0\x9F\x91\x8D",
+    "The build is green again after the fix to the coalescer; merging the rest of the series tonight unless "
+    "somebody objects before then.",
+    "\xD0\xA1\xD0\xBF\xD0\xB0\xD1\x81\xD0\xB8\xD0\xB1\xD0\xBE, \xD0\xB2\xD1\x81\xD1\x91 \xD0\xBF\xD0\xBE\xD0\xBB"
+    "\xD1\x83\xD1\x87\xD0\xB8\xD0\xBB\xD0\xBE\xD1\x81\xD1\x8C \xF0\x9F\x8E\x89",
+};
+
+td_api::object_ptr<td_api::formattedText> makeText(const std::string& text) {
+    auto formatted = td_api::make_object<td_api::formattedText>();
+    formatted->text_ = text;
+    return formatted;
+}
+
+td_api::object_ptr<td_api::MessageContent> makeContent(std::size_t i) {
+    switch (i % 10) {
+        case 7: {
+            auto photo = td_api::make_object<td_api::messagePhoto>();
+            photo->caption_ = makeText(i % 20 == 7 ? std::string() : kTexts[i % 6]);
+            return photo;
+        }
+        case 8: {
+            auto document = td_api::make_object<td_api::messageDocument>();
+            document->document_ = td_api::make_object<td_api::document>();
+            document->document_->file_name_ = "report-" + std::to_string(i) + ".pdf";
+            document->caption_ = makeText(std::string());
+            return document;
+        }
+        case 9: {
+            auto voice = td_api::make_object<td_api::messageVoiceNote>();
+            voice->voice_note_ = td_api::make_object<td_api::voiceNote>();
+            voice->voice_note_->duration_ = static_cast<std::int32_t>(i % 120);
+            voice->caption_ = makeText(std::string());
+            return voice;
+        }
+        default: {
+            auto text = td_api::make_object<td_api::messageText>();
+            text->text_ = makeText(kTexts[i % 6]);
+            return text;
+        }
+    }
+}
+
+td_api::object_ptr<td_api::message> makeMessage(std::size_t i, std::int64_t chat_id, std::int64_t date) {
+    auto message = td_api::make_object<td_api::message>();
+    message->id_ = static_cast<std::int64_t>(i + 1) << 20;
+    message->chat_id_ = chat_id;
+    message->date_ = static_cast<std::int32_t>(date);
+    message->sender_id_ = td_api::make_object<td_api::messageSenderUser>(static_cast<std::int64_t>(i % 4 + 1));
+    message->content_ = makeContent(i);
+    return message;
+}
+
+td_api::object_ptr<td_api::chat> makeChat(std::size_t i) {
+    auto chat = td_api::make_object<td_api::chat>();
+    chat->id_ = -static_cast<std::int64_t>(i + 1);
+    switch (i % 3) {
+        case 0:
+            chat->type_ = td_api::make_object<td_api::chatTypeBasicGroup>();
+            break;
+        case 1: {
+            auto supergroup = td_api::make_object<td_api::chatTypeSupergroup>();
+            supergroup->is_channel_ = i % 2 == 0;
+            chat->type_ = std::move(supergroup);
+            break;
+        }
+        default:
+            chat->type_ = td_api::make_object<td_api::chatTypeSupergroup>();
+            break;
+    }
+    chat->title_ = i % 2 == 0 ? "Project chat " + std::to_string(i)
+                              : "\xD0\xA7\xD0\xB0\xD1\x82 " + std::to_string(i) + " \xF0\x9F\x8C\x8D";
+    chat->unread_count_ = static_cast<std::int32_t>(i % 7 == 0 ? i % 300 : 0);
+    // Last messages spread over a few days, so the timestamp cache sees many distinct minutes.
+    chat->last_message_ = makeMessage(i, chat->id_, kBaseTime - static_cast<std::int64_t>(i) * 37);
+    return chat;
+}
+
+} // namespace
+
+int main() {
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        std::fprintf(stderr, "Cannot initialize wxWidgets\n");
+        return 1;
+    }
+
+    std::vector<td_api::object_ptr<td_api::user>> senders;
+    for (int i = 0; i < 4; ++i) {
+        auto user = td_api::make_object<td_api::user>();
+        user->first_name_ = i % 2 == 0 ? "Alice" : "\xD0\x98\xD0\xB2\xD0\xB0\xD0\xBD";
+        user->last_name_ = i < 2 ? "Smith" : "\xD0\x9F\xD0\xB5\xD1\x82\xD1\x80\xD0\xBE\xD0\xB2";
+        senders.push_back(std::move(user));
+    }
+    std::vector<td_api::object_ptr<td_api::message>> page;
+    for (std::size_t i = 0; i < kPageSize; ++i) {
+        page.push_back(makeMessage(i, 1, kBaseTime + static_cast<std::int64_t>(i) * 20));
+    }
+    std::vector<td_api::object_ptr<td_api::chat>> chats;
+    for (std::size_t i = 0; i < kChatCount; ++i) {
+        chats.push_back(makeChat(i));
+    }
+    auto senderOf = [&senders](const td_api::message& message) -> const td_api::user& {
+        const auto user_id = static_cast<const td_api::messageSenderUser*>(message.sender_id_.get())->user_id_;
+        return *senders[static_cast<std::size_t>(user_id - 1)];
+    };
+
+    RowFormatter formatter;
+    std::size_t mismatches = 0;
+    for (const auto& message : page) {
+        const td_api::user& sender = senderOf(*message);
+        if (legacyMessageRow(*message, sender) != formatMessageRow(formatter, *message, sender)) {
+            ++mismatches;
+        }
+    }
+    std::vector<ChatRow> rows(kChatCount);
+    for (std::size_t i = 0; i < kChatCount; ++i) {
+        renderChatRow(formatter, *chats[i], rows[i]);
+        if (legacyChatRow(*chats[i]) != rows[i].text) {
+            ++mismatches;
+        }
+    }
+    if (mismatches != 0) {
+        std::fprintf(stderr, "%zu rows differ between the legacy and the RowFormatter path\n", mismatches);
+        return 1;
+    }
+
+    printComparisonHeader("wxString", "RowFormatter");
+
+    const double legacy_page_us = measure([&]() {
+        for (const auto& message : page) {
+            g_benchmarkSink = g_benchmarkSink + legacyMessageRow(*message, senderOf(*message)).length();
+        }
+    });
+    const double formatter_page_us = measure([&]() {
+        for (const auto& message : page) {
+            g_benchmarkSink = g_benchmarkSink + formatMessageRow(formatter, *message, senderOf(*message)).length();
+        }
+    });
+    printComparison("message view, 50-message page", legacy_page_us, formatter_page_us);
+
+    // The old rows kept their wxString and compared the rebuilt text with it; keep that cost in the baseline.
+    std::vector<wxString> legacy_rows(kChatCount);
+    const double legacy_rebuild_us = measure([&]() {
+        for (std::size_t i = 0; i < kChatCount; ++i) {
+            wxString text = legacyChatRow(*chats[i]);
+            if (text != legacy_rows[i]) {
+                legacy_rows[i] = std::move(text);
+            }
+        }
+    });
+    const double changed_rebuild_us = measure([&]() {
+        for (std::size_t i = 0; i < kChatCount; ++i) {
+            rows[i].utf8.clear();
+            g_benchmarkSink = g_benchmarkSink + renderChatRow(formatter, *chats[i], rows[i]);
+        }
+    });
+    const double same_rebuild_us = measure([&]() {
+        for (std::size_t i = 0; i < kChatCount; ++i) {
+            g_benchmarkSink = g_benchmarkSink + renderChatRow(formatter, *chats[i], rows[i]);
+        }
+    });
+    printComparison("chat list rebuild, 10k rows, text changed", legacy_rebuild_us, changed_rebuild_us);
+    printComparison("chat list rebuild, 10k rows, text same", legacy_rebuild_us, same_rebuild_us);
+    return 0;
+}
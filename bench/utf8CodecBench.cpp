@@ -0,0 +1,161 @@
+// Compares utf8ToWxString with wxString::FromUTF8 on Latin, Cyrillic and emoji text of the lengths the lists show,
+// after checking that both give the same string, malformed input included.
+
+#include "benchmark.h"
+
+#include "utf8Codec.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <wx/init.h>
+#include <wx/string.h>
+
+namespace {
+
+const char* const kLatinWords[] = {"the", "train", "leaves", "from", "platform", "four", "at", "half", "past", "six"};
+// поезд, отправляется, с, платформы, в, шесть
+const char* const kCyrillicWords[] = {
+    "\xD0\xBF\xD0\xBE\xD0\xB5\xD0\xB7\xD0\xB4",
+    "\xD0\xBE\xD1\x82\xD0\xBF\xD1\x80\xD0\xB0\xD0\xB2\xD0\xBB\xD1\x8F\xD0\xB5\xD1\x82\xD1\x81\xD1\x8F",
+    "\xD1\x81",
+    "\xD0\xBF\xD0\xBB\xD0\xB0\xD1\x82\xD1\x84\xD0\xBE\xD1\x80\xD0\xBC\xD1\x8B",
+    "\xD0\xB2",
+    "\xD1\x88\xD0\xB5\xD1\x81\xD1\x82\xD1\x8C",
+};
+const char* const kEmoji[] = {"\xF0\x9F\x98\x80", "\xF0\x9F\x91\x8D", "\xF0\x9F\x8E\x89", "\xE2\x9D\xA4\xEF\xB8\x8F"};
+
+// Words drawn with the given percentages of Cyrillic words and emoji, the rest Latin, until `bytes` is reached.
+std::string makeText(std::size_t bytes, unsigned cyrillic_percent, unsigned emoji_percent, std::uint32_t seed) {
+    std::string text;
+    std::uint32_t state = seed;
+    while (text.size() < bytes) {
+        state = state * 1664525u + 1013904223u;
+        const unsigned roll = (state >> 8) % 100;
+        const unsigned pick = state >> 16;
+        if (roll < emoji_percent) {
+            text += kEmoji[pick % 4];
+        } else if (roll < emoji_percent + cyrillic_percent) {
+            text += kCyrillicWords[pick % 6];
+        } else {
+            text += kLatinWords[pick % 10];
+        }
+        text += ' ';
+    }
+    return text;
+}
+
+struct Corpus {
+    const char* name;
+    std::vector<std::string> texts;
+};
+
+Corpus makeCorpus(const char* name, std::size_t count, std::size_t bytes, unsigned cyrillic_percent,
+                  unsigned emoji_percent) {
+    Corpus corpus{name, {}};
+    for (std::size_t i = 0; i < count; ++i) {
+        corpus.texts.push_back(makeText(bytes, cyrillic_percent, emoji_percent, static_cast<std::uint32_t>(i + 1)));
+    }
+    return corpus;
+}
+
+// Byte sequences the decoder has to reject, placed in otherwise valid text.
+const char* const kMalformed[] = {
+    "\xC0\xAF",         // overlong '/'
+    "\xE0\x80\xAF",     // overlong, three bytes
+    "\xED\xA0\x80",     // UTF-16 surrogate
+    "\xF4\x90\x80\x80", // past U+10FFFF
+    "\xD0",             // lead byte without its continuation
+    "\xE2\x82",         // one continuation byte short
+    "\x80",             // lone continuation byte
+    "\xFF",
+};
+
+std::size_t countMismatches(const std::vector<Corpus>& corpora) {
+    std::size_t mismatches = 0;
+    std::vector<wchar_t> buffer;
+    for (const auto& corpus : corpora) {
+        for (const auto& text : corpus.texts) {
+            const wxString expected = wxString::FromUTF8(text.data(), text.size());
+            buffer.resize(text.size());
+            const std::size_t length = decodeUtf8(text, buffer.data());
+            if (length == kInvalidUtf8 || wxString(buffer.data(), length) != expected ||
+                utf8ToWxString(text) != expected) {
+                ++mismatches;
+            }
+        }
+    }
+    const std::string cyrillic = std::string(kCyrillicWords[1]) + kCyrillicWords[3];
+    for (const char* bad : kMalformed) {
+        // At the start, inside a block after a run of ASCII and after Cyrillic, and at the very end.
+        for (const std::string& text : {std::string(bad) + "abc", std::string(40, 'a') + bad + std::string(20, 'b'),
+                                        cyrillic + bad + std::string(20, 'b'), std::string(40, 'a') + bad}) {
+            buffer.resize(text.size());
+            if (decodeUtf8(text, buffer.data()) != kInvalidUtf8 ||
+                utf8ToWxString(text) != wxString::FromUTF8(text.data(), text.size())) {
+                ++mismatches;
+            }
+        }
+    }
+    return mismatches;
+}
+
+} // namespace
+
+int main() {
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        std::fprintf(stderr, "Cannot initialize wxWidgets\n");
+        return 1;
+    }
+
+    // Chat titles and previews, message rows, and long messages; the mixes go from mostly English to mostly Russian,
+    // and to every other word an emoji.
+    const std::vector<Corpus> corpora = {
+        makeCorpus("titles, Latin with emoji, 32 B", 1000, 32, 0, 10),
+        makeCorpus("titles, Cyrillic with emoji, 32 B", 1000, 32, 80, 10),
+        makeCorpus("rows, mixed, 160 B", 1000, 160, 40, 5),
+        makeCorpus("rows, Latin only, 160 B", 1000, 160, 0, 0),
+        makeCorpus("messages, mixed, 4 KiB", 50, 4096, 40, 5),
+        makeCorpus("messages, Cyrillic, 4 KiB", 50, 4096, 95, 2),
+        makeCorpus("messages, emoji-heavy, 4 KiB", 50, 4096, 20, 50),
+    };
+
+    const std::size_t mismatches = countMismatches(corpora);
+    if (mismatches != 0) {
+        std::fprintf(stderr, "%zu texts convert differently from wxString::FromUTF8\n", mismatches);
+        return 1;
+    }
+
+    printComparisonHeader("FromUTF8", "utf8ToWxString");
+    for (const auto& corpus : corpora) {
+        const double from_utf8_us = measure([&]() {
+            for (const auto& text : corpus.texts) {
+                g_benchmarkSink = g_benchmarkSink + wxString::FromUTF8(text.data(), text.size()).length();
+            }
+        });
+        const double codec_us = measure([&]() {
+            for (const auto& text : corpus.texts) {
+                g_benchmarkSink = g_benchmarkSink + utf8ToWxString(text).length();
+            }
+        });
+        printComparison(corpus.name, from_utf8_us, codec_us);
+    }
+
+    // The view asks for the same rows on every repaint; once converted they come from the cache.
+    const auto& rows = corpora[2].texts;
+    Utf8Cache cache;
+    const double uncached_us = measure([&]() {
+        for (const auto& text : rows) {
+            g_benchmarkSink = g_benchmarkSink + wxString::FromUTF8(text.data(), text.size()).length();
+        }
+    });
+    const double cached_us = measure([&]() {
+        for (const auto& text : rows) {
+            g_benchmarkSink = g_benchmarkSink + cache.convert(text).length();
+        }
+    });
+    printComparison("repaint of 1000 rows, Utf8Cache", uncached_us, cached_us);
+    return 0;
+}
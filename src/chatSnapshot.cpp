@@ -0,0 +1,401 @@
+#include "chatSnapshot.h"
+
+#include "tlCodec.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr char kMagic[4] = {'M', 'G', 'S', 'S'};
+constexpr char kVersion = 2;
+
+enum RecordKind : unsigned char {
+    VIEW = 1,
+    OBJECT = 2,
+    CHAT = 3,
+    USER = 4
+};
+
+// Read-only view of a whole file through the OS page cache.
+class MappedFile {
+  public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::filesystem::path& path);
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+  private:
+    void close();
+
+#ifdef _WIN32
+    HANDLE mapping_{nullptr};
+#endif
+    const char* data_{nullptr};
+    std::size_t size_{0};
+};
+
+#ifdef _WIN32
+bool MappedFile::open(const std::filesystem::path& path) {
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size{};
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    // The mapping keeps the file open on its own.
+    CloseHandle(file);
+    if (!mapping_) {
+        return false;
+    }
+    data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!data_) {
+        close();
+        return false;
+    }
+    size_ = static_cast<std::size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+    }
+    mapping_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+}
+#else
+bool MappedFile::open(const std::filesystem::path& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info {};
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping keeps the file open on its own.
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    data_ = static_cast<const char*>(data);
+    size_ = static_cast<std::size_t>(info.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+#endif
+
+void appendVarint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void appendString(std::string& out, std::string_view text) {
+    appendVarint(out, text.size());
+    out.append(text.data(), text.size());
+}
+
+std::uint64_t zigzag(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+std::int64_t unzigzag(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+// Bounds-checked cursor over the mapped bytes.
+class Cursor {
+  public:
+    Cursor(const char* data, std::size_t size) : data_(data), end_(data + size) {}
+
+    bool atEnd() const { return data_ == end_; }
+    std::size_t remaining() const { return static_cast<std::size_t>(end_ - data_); }
+
+    bool readByte(unsigned char& value) {
+        if (data_ == end_) {
+            return false;
+        }
+        value = static_cast<unsigned char>(*data_++);
+        return true;
+    }
+    bool readVarint(std::uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            unsigned char byte = 0;
+            if (!readByte(byte)) {
+                return false;
+            }
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    bool readSigned(std::int64_t& value) {
+        std::uint64_t raw = 0;
+        if (!readVarint(raw)) {
+            return false;
+        }
+        value = unzigzag(raw);
+        return true;
+    }
+    template <class T> bool readSmall(T& value) {
+        std::int64_t raw = 0;
+        if (!readSigned(raw)) {
+            return false;
+        }
+        value = static_cast<T>(raw);
+        return true;
+    }
+    bool readString(std::string_view& text) {
+        std::uint64_t size = 0;
+        const char* start = nullptr;
+        if (!readVarint(size) || !skip(static_cast<std::size_t>(size), start)) {
+            return false;
+        }
+        text = std::string_view(start, static_cast<std::size_t>(size));
+        return true;
+    }
+    bool skip(std::size_t size, const char*& start) {
+        if (size > remaining()) {
+            return false;
+        }
+        start = data_;
+        data_ += size;
+        return true;
+    }
+
+  private:
+    const char* data_;
+    const char* end_;
+};
+
+bool readView(const char* data, std::size_t size, ChatSnapshot::View& view) {
+    Cursor cursor(data, size);
+    return cursor.readSigned(view.shown_list) && cursor.readSigned(view.chat_list_top_row) &&
+           cursor.readSigned(view.open_chat_id) && cursor.readSigned(view.top_message_id);
+}
+
+bool readChat(const char* data, std::size_t size, StringPool& titles, ChatRecord& chat) {
+    Cursor cursor(data, size);
+    std::string_view title;
+    std::string_view preview;
+    std::uint64_t position_count = 0;
+    if (!cursor.readSigned(chat.id) || !cursor.readSigned(chat.user_id) || !cursor.readSigned(chat.last_message_id) ||
+        !cursor.readSmall(chat.last_message_date) || !cursor.readSmall(chat.unread_count) ||
+        !cursor.readSmall(chat.kind) || !cursor.readSmall(chat.default_disable_notification) ||
+        !cursor.readString(title) || !cursor.readString(preview) || !cursor.readVarint(position_count) ||
+        position_count > cursor.remaining()) {
+        return false;
+    }
+    chat.title = titles.intern(title);
+    chat.last_message_preview.assign(preview);
+    chat.positions.resize(static_cast<std::size_t>(position_count));
+    for (auto& position : chat.positions) {
+        if (!cursor.readSigned(position.list) || !cursor.readSigned(position.order) ||
+            !cursor.readSmall(position.is_pinned)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readUser(const char* data, std::size_t size, StringPool& names, std::int64_t& user_id, UserRecord& user) {
+    Cursor cursor(data, size);
+    std::string_view first_name;
+    std::string_view last_name;
+    if (!cursor.readSigned(user_id) || !cursor.readString(first_name) || !cursor.readString(last_name) ||
+        !cursor.readSmall(user.was_online) || !cursor.readSmall(user.status) || !cursor.readSmall(user.is_premium) ||
+        !cursor.readSmall(user.is_bot)) {
+        return false;
+    }
+    user.first_name = names.intern(first_name);
+    user.last_name = names.intern(last_name);
+    return true;
+}
+} // namespace
+
+bool ChatSnapshot::load(const std::string& path, ChatSnapshot& snapshot, ChatStore& chats, PeerCache& peers) {
+    snapshot = ChatSnapshot();
+    MappedFile file;
+    if (!file.open(std::filesystem::u8path(path)) || file.size() < sizeof(kMagic) + 1 ||
+        !std::equal(kMagic, kMagic + sizeof(kMagic), file.data()) || file.data()[sizeof(kMagic)] != kVersion) {
+        return false;
+    }
+
+    // Everything is decoded before anything is added, so a damaged file adds nothing. Strings are interned right
+    // away; the pools keep them either way.
+    std::vector<ChatRecord> restored_chats;
+    std::vector<std::pair<std::int64_t, UserRecord>> restored_users;
+    Cursor cursor(file.data() + sizeof(kMagic) + 1, file.size() - sizeof(kMagic) - 1);
+    while (!cursor.atEnd()) {
+        unsigned char kind = 0;
+        std::uint64_t size = 0;
+        const char* payload = nullptr;
+        if (!cursor.readByte(kind) || !cursor.readVarint(size) ||
+            !cursor.skip(static_cast<std::size_t>(size), payload)) {
+            snapshot = ChatSnapshot();
+            return false;
+        }
+        const auto length = static_cast<std::size_t>(size);
+        bool valid = true;
+        switch (kind) {
+            case VIEW:
+                valid = readView(payload, length, snapshot.view);
+                break;
+            case CHAT:
+                restored_chats.emplace_back();
+                valid = readChat(payload, length, chats.getTitles(), restored_chats.back());
+                break;
+            case USER:
+                restored_users.emplace_back();
+                valid = readUser(payload, length, peers.getNames(), restored_users.back().first,
+                                 restored_users.back().second);
+                break;
+            case OBJECT: {
+                auto object = TlCodec::decode(payload, length);
+                if (object && object->get_id() == td::td_api::chatFolderInfo::ID) {
+                    snapshot.folders.push_back(td::td_api::object_ptr<td::td_api::chatFolderInfo>(
+                        static_cast<td::td_api::chatFolderInfo*>(object.release())));
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        if (!valid) {
+            snapshot = ChatSnapshot();
+            return false;
+        }
+    }
+
+    for (const auto& [user_id, user] : restored_users) {
+        peers.setUser(user_id, user);
+    }
+    for (auto& chat : restored_chats) {
+        snapshot.chat_ids.push_back(chat.id);
+        chats.add(std::move(chat));
+    }
+    return true;
+}
+
+void ChatSnapshot::discard(const std::string& path) {
+    std::error_code error;
+    std::filesystem::remove(std::filesystem::u8path(path), error);
+}
+
+ChatSnapshotWriter::ChatSnapshotWriter(const ChatSnapshot::View& view) {
+    buffer_.assign(kMagic, sizeof(kMagic));
+    buffer_.push_back(kVersion);
+
+    payload_.clear();
+    appendVarint(payload_, zigzag(view.shown_list));
+    appendVarint(payload_, zigzag(view.chat_list_top_row));
+    appendVarint(payload_, zigzag(view.open_chat_id));
+    appendVarint(payload_, zigzag(view.top_message_id));
+    appendRecord(VIEW);
+}
+
+void ChatSnapshotWriter::addFolder(const td::td_api::chatFolderInfo& folder) {
+    payload_.clear();
+    if (TlCodec::encode(folder, payload_)) {
+        appendRecord(OBJECT);
+    }
+}
+
+void ChatSnapshotWriter::addChat(const ChatStore& chats, const ChatRecord& chat) {
+    payload_.clear();
+    appendVarint(payload_, zigzag(chat.id));
+    appendVarint(payload_, zigzag(chat.user_id));
+    appendVarint(payload_, zigzag(chat.last_message_id));
+    appendVarint(payload_, zigzag(chat.last_message_date));
+    appendVarint(payload_, zigzag(chat.unread_count));
+    appendVarint(payload_, zigzag(chat.kind));
+    appendVarint(payload_, zigzag(chat.default_disable_notification));
+    appendString(payload_, chats.title(chat));
+    appendString(payload_, chat.last_message_preview);
+    appendVarint(payload_, chat.positions.size());
+    for (const auto& position : chat.positions) {
+        appendVarint(payload_, zigzag(position.list));
+        appendVarint(payload_, zigzag(position.order));
+        appendVarint(payload_, zigzag(position.is_pinned));
+    }
+    appendRecord(CHAT);
+}
+
+void ChatSnapshotWriter::addUser(const PeerCache& peers, std::int64_t user_id, const UserRecord& user) {
+    payload_.clear();
+    appendVarint(payload_, zigzag(user_id));
+    appendString(payload_, peers.firstName(user));
+    appendString(payload_, peers.lastName(user));
+    appendVarint(payload_, zigzag(user.was_online));
+    appendVarint(payload_, zigzag(user.status));
+    appendVarint(payload_, zigzag(user.is_premium));
+    appendVarint(payload_, zigzag(user.is_bot));
+    appendRecord(USER);
+}
+
+void ChatSnapshotWriter::appendRecord(unsigned char kind) {
+    buffer_.push_back(static_cast<char>(kind));
+    appendVarint(buffer_, payload_.size());
+    buffer_.append(payload_);
+}
+
+bool ChatSnapshotWriter::save(const std::string& path) const {
+    const auto target = std::filesystem::u8path(path);
+    auto temporary = target;
+    temporary += ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    file.close();
+
+    std::error_code error;
+    if (file) {
+        std::filesystem::rename(temporary, target, error);
+    }
+    if (!file || error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef CHAT_SNAPSHOT_H
+#define CHAT_SNAPSHOT_H
+
+#include "chatStore.h"
+#include "peerCache.h"
+
+#include <cstdint>
+#include <string>
+#include <td/telegram/td_api.h>
+#include <vector>
+
+// The chat list state of one account as it was last seen, kept next to its TDLib database so that the next start
+// can paint the folders and the chat list before TDLib has announced a single chat. Everything in it is a cache that
+// live updates overwrite.
+// File layout: the magic "MGSS", a format version byte, then records of
+//   kind (1 byte) | payload length (varint) | payload
+// where the VIEW record holds the View fields, a CHAT record one ChatRecord and a USER record one UserRecord, all as
+// varints with strings prefixed by their length, and an OBJECT record holds a folder as a TlCodec object. Loading
+// maps the file and decodes straight from the mapping.
+struct ChatSnapshot {
+    // Where the reader was.
+    struct View {
+        ChatListId shown_list{kMainChatList};
+        std::int64_t chat_list_top_row{0};
+        std::int64_t open_chat_id{0};
+        // First message on screen in the open chat; 0 shows the newest ones.
+        std::int64_t top_message_id{0};
+    };
+
+    View view;
+    std::vector<td::td_api::object_ptr<td::td_api::chatFolderInfo>> folders;
+    // The chats load put into the store.
+    std::vector<std::int64_t> chat_ids;
+
+    // Adds the snapshot's chats to `chats` and its users to `peers`. False if there is no snapshot or it is damaged
+    // or from another format version; nothing is added then.
+    static bool load(const std::string& path, ChatSnapshot& snapshot, ChatStore& chats, PeerCache& peers);
+    // Removes the snapshot, for when the account it describes is logged out.
+    static void discard(const std::string& path);
+};
+
+// Encodes the objects of a snapshot as they are added, without copying them out of their owners.
+class ChatSnapshotWriter {
+  public:
+    explicit ChatSnapshotWriter(const ChatSnapshot::View& view);
+
+    void addFolder(const td::td_api::chatFolderInfo& folder);
+    void addChat(const ChatStore& chats, const ChatRecord& chat);
+    void addUser(const PeerCache& peers, std::int64_t user_id, const UserRecord& user);
+    // Writes beside `path` and renames over it, so a crash while saving leaves the previous snapshot intact.
+    bool save(const std::string& path) const;
+
+  private:
+    void appendRecord(unsigned char kind);
+
+    std::string buffer_;
+    std::string payload_;
+};
+
+#endif
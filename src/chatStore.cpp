@@ -0,0 +1,326 @@
+#include "chatStore.h"
+
+#include <utility>
+
+bool ChatOrderIndex::insert(const ChatOrderKey& key) {
+    if (rankOf(key) != npos) {
+        return false;
+    }
+    const std::uint32_t node = allocate(key);
+    std::uint32_t left = kNull;
+    std::uint32_t right = kNull;
+    split(root_, key, left, right);
+    root_ = merge(merge(left, node), right);
+    return true;
+}
+
+bool ChatOrderIndex::erase(const ChatOrderKey& key) {
+    bool erased = false;
+    root_ = erase(root_, key, erased);
+    return erased;
+}
+
+std::size_t ChatOrderIndex::rankOf(const ChatOrderKey& key) const {
+    std::size_t rank = 0;
+    std::uint32_t node = root_;
+    while (node != kNull) {
+        const Node& current = nodes_[node];
+        if (current.key == key) {
+            return rank + nodes_[current.left].size;
+        }
+        if (key < current.key) {
+            node = current.left;
+        } else {
+            rank += nodes_[current.left].size + 1;
+            node = current.right;
+        }
+    }
+    return npos;
+}
+
+const ChatOrderKey& ChatOrderIndex::at(std::size_t rank) const {
+    std::uint32_t node = root_;
+    for (;;) {
+        const Node& current = nodes_[node];
+        const std::size_t left_size = nodes_[current.left].size;
+        if (rank < left_size) {
+            node = current.left;
+        } else if (rank == left_size) {
+            return current.key;
+        } else {
+            rank -= left_size + 1;
+            node = current.right;
+        }
+    }
+}
+
+std::uint32_t ChatOrderIndex::allocate(const ChatOrderKey& key) {
+    const Node node{key, nextPriority(), 1, kNull, kNull};
+    if (!free_.empty()) {
+        const std::uint32_t index = free_.back();
+        free_.pop_back();
+        nodes_[index] = node;
+        return index;
+    }
+    nodes_.push_back(node);
+    return static_cast<std::uint32_t>(nodes_.size() - 1);
+}
+
+void ChatOrderIndex::update(std::uint32_t node) {
+    Node& current = nodes_[node];
+    current.size = 1 + nodes_[current.left].size + nodes_[current.right].size;
+}
+
+void ChatOrderIndex::split(std::uint32_t node, const ChatOrderKey& key, std::uint32_t& left, std::uint32_t& right) {
+    if (node == kNull) {
+        left = right = kNull;
+        return;
+    }
+    if (nodes_[node].key < key) {
+        split(nodes_[node].right, key, nodes_[node].right, right);
+        left = node;
+    } else {
+        split(nodes_[node].left, key, left, nodes_[node].left);
+        right = node;
+    }
+    update(node);
+}
+
+std::uint32_t ChatOrderIndex::merge(std::uint32_t left, std::uint32_t right) {
+    if (left == kNull) {
+        return right;
+    }
+    if (right == kNull) {
+        return left;
+    }
+    if (nodes_[left].priority > nodes_[right].priority) {
+        nodes_[left].right = merge(nodes_[left].right, right);
+        update(left);
+        return left;
+    }
+    nodes_[right].left = merge(left, nodes_[right].left);
+    update(right);
+    return right;
+}
+
+std::uint32_t ChatOrderIndex::erase(std::uint32_t node, const ChatOrderKey& key, bool& erased) {
+    if (node == kNull) {
+        return kNull;
+    }
+    if (nodes_[node].key == key) {
+        erased = true;
+        free_.push_back(node);
+        return merge(nodes_[node].left, nodes_[node].right);
+    }
+    if (key < nodes_[node].key) {
+        nodes_[node].left = erase(nodes_[node].left, key, erased);
+    } else {
+        nodes_[node].right = erase(nodes_[node].right, key, erased);
+    }
+    update(node);
+    return node;
+}
+
+std::uint32_t ChatOrderIndex::nextPriority() {
+    // xorshift32; the treap only needs priorities that are independent of the keys.
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+}
+
+ChatListId ChatStore::listIdOf(const td::td_api::ChatList& list) {
+    switch (list.get_id()) {
+        case td::td_api::chatListArchive::ID:
+            return kArchiveChatList;
+        case td::td_api::chatListFolder::ID:
+            return static_cast<const td::td_api::chatListFolder&>(list).chat_folder_id_;
+        default:
+            return kMainChatList;
+    }
+}
+
+td::td_api::object_ptr<td::td_api::ChatList> ChatStore::makeChatList(ChatListId list) {
+    switch (list) {
+        case kMainChatList:
+            return td::td_api::make_object<td::td_api::chatListMain>();
+        case kArchiveChatList:
+            return td::td_api::make_object<td::td_api::chatListArchive>();
+        default:
+            return td::td_api::make_object<td::td_api::chatListFolder>(static_cast<std::int32_t>(list));
+    }
+}
+
+namespace {
+ChatRecord::Kind kindOf(const td::td_api::ChatType* type, std::int64_t& user_id) {
+    user_id = 0;
+    if (!type) {
+        return ChatRecord::KIND_PRIVATE;
+    }
+    switch (type->get_id()) {
+        case td::td_api::chatTypeBasicGroup::ID:
+            return ChatRecord::KIND_BASIC_GROUP;
+        case td::td_api::chatTypeSupergroup::ID:
+            return static_cast<const td::td_api::chatTypeSupergroup*>(type)->is_channel_ ? ChatRecord::KIND_CHANNEL
+                                                                                          : ChatRecord::KIND_SUPERGROUP;
+        case td::td_api::chatTypeSecret::ID:
+            user_id = static_cast<const td::td_api::chatTypeSecret*>(type)->user_id_;
+            return ChatRecord::KIND_SECRET;
+        default:
+            user_id = static_cast<const td::td_api::chatTypePrivate*>(type)->user_id_;
+            return ChatRecord::KIND_PRIVATE;
+    }
+}
+} // namespace
+
+ChatRecord* ChatStore::find(std::int64_t chat_id) {
+    auto it = chats_.find(chat_id);
+    return it == chats_.end() ? nullptr : &it->second;
+}
+
+const ChatRecord* ChatStore::find(std::int64_t chat_id) const {
+    auto it = chats_.find(chat_id);
+    return it == chats_.end() ? nullptr : &it->second;
+}
+
+std::vector<ChatStore::Move> ChatStore::add(const td::td_api::chat& chat) {
+    ChatRecord record;
+    record.id = chat.id_;
+    record.kind = kindOf(chat.type_.get(), record.user_id);
+    record.title = titles_.intern(chat.title_);
+    record.unread_count = chat.unread_count_;
+    record.default_disable_notification = chat.default_disable_notification_;
+    for (const auto& position : chat.positions_) {
+        if (position && position->list_) {
+            record.positions.push_back(
+                ChatPosition{listIdOf(*position->list_), position->order_, position->is_pinned_});
+        }
+    }
+    return add(std::move(record));
+}
+
+std::vector<ChatStore::Move> ChatStore::add(ChatRecord record) {
+    std::vector<Move> moves;
+    const std::int64_t chat_id = record.id;
+    auto positions = std::move(record.positions);
+    record.positions.clear();
+
+    auto [it, inserted] = chats_.try_emplace(chat_id);
+    if (!inserted) {
+        // A chat is only announced once, but if it comes again its old positions must leave the indices first. The
+        // last message stays until setLastMessage replaces it.
+        for (const auto& position : it->second.positions) {
+            const ChatOrderKey key{position.is_pinned, position.order, chat_id};
+            ChatOrderIndex& index = lists_[position.list];
+            moves.push_back(Move{position.list, chat_id, index.rankOf(key), npos});
+            index.erase(key);
+        }
+        if (record.last_message_id == 0) {
+            record.last_message_id = it->second.last_message_id;
+            record.last_message_date = it->second.last_message_date;
+            record.last_message_preview = std::move(it->second.last_message_preview);
+        }
+    }
+    it->second = std::move(record);
+    for (const auto& position : positions) {
+        moves.push_back(setPosition(chat_id, position));
+    }
+    return moves;
+}
+
+ChatStore::Move ChatStore::setPosition(std::int64_t chat_id, const td::td_api::chatPosition& position) {
+    if (!position.list_) {
+        return Move{0, chat_id, npos, npos};
+    }
+    return setPosition(chat_id, ChatPosition{listIdOf(*position.list_), position.order_, position.is_pinned_});
+}
+
+ChatStore::Move ChatStore::setPosition(std::int64_t chat_id, const ChatPosition& position) {
+    Move move{position.list, chat_id, npos, npos};
+    ChatRecord* chat = find(chat_id);
+    if (!chat) {
+        return move;
+    }
+    ChatOrderIndex& index = lists_[position.list];
+
+    auto& positions = chat->positions;
+    for (auto it = positions.begin(); it != positions.end(); ++it) {
+        if (it->list == position.list) {
+            const ChatOrderKey old_key{it->is_pinned, it->order, chat_id};
+            move.from = index.rankOf(old_key);
+            index.erase(old_key);
+            positions.erase(it);
+            break;
+        }
+    }
+
+    if (position.order != 0) {
+        const ChatOrderKey new_key{position.is_pinned, position.order, chat_id};
+        index.insert(new_key);
+        move.to = index.rankOf(new_key);
+        positions.push_back(position);
+    }
+    return move;
+}
+
+void ChatStore::setTitle(std::int64_t chat_id, std::string_view title) {
+    if (ChatRecord* chat = find(chat_id)) {
+        chat->title = titles_.intern(title);
+    }
+}
+
+void ChatStore::setLastMessage(std::int64_t chat_id, std::int64_t message_id, std::int32_t date,
+                               std::string_view preview) {
+    ChatRecord* chat = find(chat_id);
+    if (!chat) {
+        return;
+    }
+    chat->last_message_id = message_id;
+    chat->last_message_date = message_id != 0 ? date : 0;
+    // assign() reuses the capacity the previous preview left behind.
+    chat->last_message_preview.assign(message_id != 0 ? preview : std::string_view());
+}
+
+bool ChatStore::collect(std::int64_t chat_id) {
+    auto it = chats_.find(chat_id);
+    if (it == chats_.end() || !it->second.positions.empty()) {
+        return false;
+    }
+    chats_.erase(it);
+    return true;
+}
+
+std::size_t ChatStore::size(ChatListId list) const {
+    auto it = lists_.find(list);
+    return it == lists_.end() ? 0 : it->second.size();
+}
+
+std::size_t ChatStore::rankOf(ChatListId list, std::int64_t chat_id) const {
+    auto it = lists_.find(list);
+    const ChatRecord* chat = find(chat_id);
+    if (it == lists_.end() || !chat) {
+        return npos;
+    }
+    const ChatPosition* position = positionIn(*chat, list);
+    if (!position) {
+        return npos;
+    }
+    return it->second.rankOf(ChatOrderKey{position->is_pinned, position->order, chat_id});
+}
+
+std::int64_t ChatStore::chatAt(ChatListId list, std::size_t rank) const {
+    auto it = lists_.find(list);
+    if (it == lists_.end() || rank >= it->second.size()) {
+        return 0;
+    }
+    return it->second.at(rank).chat_id;
+}
+
+const ChatPosition* ChatStore::positionIn(const ChatRecord& chat, ChatListId list) {
+    for (const auto& position : chat.positions) {
+        if (position.list == list) {
+            return &position;
+        }
+    }
+    return nullptr;
+}
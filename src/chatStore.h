@@ -0,0 +1,171 @@
+#ifndef CHAT_STORE_H
+#define CHAT_STORE_H
+
+#include "stringPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <td/telegram/td_api.h>
+#include <unordered_map>
+#include <vector>
+
+// Identifies a chat list: the main list, the archive or one folder (by its folder id).
+using ChatListId = std::int64_t;
+inline constexpr ChatListId kMainChatList = -1;
+inline constexpr ChatListId kArchiveChatList = -2;
+
+// Where a chat stands in one list, as TDLib reports it.
+struct ChatPosition {
+    ChatListId list;
+    std::int64_t order;
+    bool is_pinned;
+};
+
+// The parts of a chat the lists show. The title is interned and the last message is kept only as the id, date and
+// preview text of its row, instead of the chat's whole td_api object graph.
+struct ChatRecord {
+    enum Kind : unsigned char {
+        KIND_PRIVATE,
+        KIND_BASIC_GROUP,
+        KIND_SUPERGROUP,
+        KIND_CHANNEL,
+        KIND_SECRET
+    };
+
+    std::int64_t id{0};
+    // The other user of a private or secret chat.
+    std::int64_t user_id{0};
+    // 0 when the chat has no last message.
+    std::int64_t last_message_id{0};
+    std::int32_t last_message_date{0};
+    std::int32_t unread_count{0};
+    StringPool::Id title{StringPool::kEmpty};
+    Kind kind{KIND_PRIVATE};
+    bool default_disable_notification{false};
+    std::string last_message_preview;
+    std::vector<ChatPosition> positions;
+};
+
+// Position of a chat inside one list. Pinned chats come first, then higher order; the chat id breaks ties so that
+// every key is unique.
+struct ChatOrderKey {
+    bool is_pinned;
+    std::int64_t order;
+    std::int64_t chat_id;
+
+    bool operator<(const ChatOrderKey& other) const {
+        if (is_pinned != other.is_pinned) {
+            return is_pinned;
+        }
+        if (order != other.order) {
+            return order > other.order;
+        }
+        return chat_id > other.chat_id;
+    }
+    bool operator==(const ChatOrderKey& other) const {
+        return is_pinned == other.is_pinned && order == other.order && chat_id == other.chat_id;
+    }
+};
+
+// Ordered set of chat keys with rank queries: a treap whose nodes also count their subtree, so insert, erase,
+// "how many chats come before this one" and "which chat is at row n" are all O(log n). Nodes live in one vector
+// and refer to each other by index, so the index costs a few words per chat and no allocation per update.
+class ChatOrderIndex {
+  public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    // Both return false if the key was already there (insert) or missing (erase).
+    bool insert(const ChatOrderKey& key);
+    bool erase(const ChatOrderKey& key);
+
+    // Number of keys ordered before `key`, or npos if it is not in the index.
+    std::size_t rankOf(const ChatOrderKey& key) const;
+    const ChatOrderKey& at(std::size_t rank) const;
+    std::size_t size() const { return root_ == kNull ? 0 : nodes_[root_].size; }
+
+  private:
+    static constexpr std::uint32_t kNull = 0;
+
+    struct Node {
+        ChatOrderKey key;
+        std::uint32_t priority;
+        std::uint32_t size;
+        std::uint32_t left;
+        std::uint32_t right;
+    };
+
+    std::uint32_t allocate(const ChatOrderKey& key);
+    void update(std::uint32_t node);
+    // Splits `node` into keys ordered before `key` (left) and the rest (right).
+    void split(std::uint32_t node, const ChatOrderKey& key, std::uint32_t& left, std::uint32_t& right);
+    std::uint32_t merge(std::uint32_t left, std::uint32_t right);
+    std::uint32_t erase(std::uint32_t node, const ChatOrderKey& key, bool& erased);
+    std::uint32_t nextPriority();
+
+    // Slot 0 is the null node, so an index of zero never refers to a chat.
+    std::vector<Node> nodes_{Node{}};
+    std::vector<std::uint32_t> free_;
+    std::uint32_t root_{kNull};
+    std::uint32_t seed_{0x2545F491u};
+};
+
+// Every chat of an account by id, plus one ChatOrderIndex per chat list the chat appears in. The record's positions
+// stay the source of truth; the indices are kept in step with them by setPosition.
+class ChatStore {
+  public:
+    static constexpr std::size_t npos = ChatOrderIndex::npos;
+
+    // Where a chat was and now is within one list; npos on either side means it was not or is no longer there.
+    struct Move {
+        ChatListId list;
+        std::int64_t chat_id;
+        std::size_t from;
+        std::size_t to;
+    };
+
+    static ChatListId listIdOf(const td::td_api::ChatList& list);
+    static td::td_api::object_ptr<td::td_api::ChatList> makeChatList(ChatListId list);
+
+    ChatRecord* find(std::int64_t chat_id);
+    const ChatRecord* find(std::int64_t chat_id) const;
+    std::string_view title(const ChatRecord& chat) const { return titles_.view(chat.title); }
+    StringPool& getTitles() { return titles_; }
+
+    // Takes a chat from updateNewChat or getChat and indexes the positions it carries. The last message is left to
+    // setLastMessage, which needs its preview.
+    std::vector<Move> add(const td::td_api::chat& chat);
+    // Same for a record restored from elsewhere, with its positions and title already in place.
+    std::vector<Move> add(ChatRecord record);
+    // Replaces the chat's position in position.list. An order of zero removes the chat from that list.
+    Move setPosition(std::int64_t chat_id, const ChatPosition& position);
+    Move setPosition(std::int64_t chat_id, const td::td_api::chatPosition& position);
+    void setTitle(std::int64_t chat_id, std::string_view title);
+    // A message id of 0 clears the last message.
+    void setLastMessage(std::int64_t chat_id, std::int64_t message_id, std::int32_t date, std::string_view preview);
+    // Forgets a chat that is in no list any more; returns false and keeps it if it is still listed.
+    bool collect(std::int64_t chat_id);
+
+    // Calls visit(chat) for every chat, in no particular order.
+    template <class Visitor> void forEach(Visitor&& visit) const {
+        for (const auto& entry : chats_) {
+            visit(entry.second);
+        }
+    }
+
+    std::size_t size(ChatListId list) const;
+    std::size_t rankOf(ChatListId list, std::int64_t chat_id) const;
+    std::int64_t chatAt(ChatListId list, std::size_t rank) const;
+    std::size_t getChatCount() const { return chats_.size(); }
+    // The chat's position in the list, or null if it is not in it.
+    static const ChatPosition* positionIn(const ChatRecord& chat, ChatListId list);
+
+  private:
+
+    StringPool titles_;
+    std::unordered_map<std::int64_t, ChatRecord> chats_;
+    std::unordered_map<ChatListId, ChatOrderIndex> lists_;
+};
+
+#endif
@@ -18,26 +18,4 @@ class CFolderClientData final : public wxClientData {
     int32_t m_folderId;
 };
 
-class CChatClientData final : public wxClientData {
-  public:
-    explicit CChatClientData(long long chatId, long long sortKey) : m_chatId(chatId), m_sortKey(sortKey) {}
-    long long GetChatId() const { return m_chatId; }
-    long long GetSortKey() const { return m_sortKey; }
-
-  private:
-    long long m_chatId;
-    long long m_sortKey;
-};
-
-class CMessageClientData final : public wxClientData {
-  public:
-    explicit CMessageClientData(long long messageId, long long chatId) : m_messageId(messageId), m_chatId(chatId) {}
-    long long GetMessageId() const { return m_messageId; }
-    long long GetChatId() const { return m_chatId; }
-
-  private:
-    long long m_messageId;
-    long long m_chatId;
-};
-
 #endif
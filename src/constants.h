@@ -1,6 +1,8 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
 
+#include <chrono>
+#include <cstddef>
 #include <obfuscate.h>
 #include <string>
 #include <wx/wx.h>
@@ -9,4 +11,36 @@ inline constexpr unsigned long long API_ID = TDAPI_ID;
 inline auto& API_HASH = AY_OBFUSCATE(TDAPI_HASH);
 inline const wxString IPC_SERVICE_PORT = "5381";
 
+// Updates drained from TDLib are posted to the UI thread in batches of at most this size or age.
+inline constexpr std::size_t UPDATE_BATCH_MAX_SIZE = 512;
+inline constexpr std::chrono::microseconds UPDATE_BATCH_MAX_LATENCY{16000};
+// Past the soft limit transient updates are dropped; at the hard limit the TDLib thread waits for the UI.
+inline constexpr std::size_t UPDATE_QUEUE_SOFT_LIMIT = 4096;
+inline constexpr std::size_t UPDATE_QUEUE_HARD_LIMIT = 16384;
+// Requests TDLib may be working on at once per priority lane; interactive requests are never held back.
+inline constexpr std::size_t REQUEST_NORMAL_MAX_IN_FLIGHT = 32;
+inline constexpr std::size_t REQUEST_BACKGROUND_MAX_IN_FLIGHT = 4;
+// History is requested this many messages at a time. The open chat keeps at most MESSAGE_WINDOW_MAX_MESSAGES in
+// memory, and the next page is requested once the view comes within MESSAGE_PREFETCH_ROWS of either end, but no
+// sooner than MESSAGE_PAGE_MIN_INTERVAL after the previous page in that direction.
+inline constexpr int MESSAGE_PAGE_SIZE = 50;
+inline constexpr std::size_t MESSAGE_WINDOW_MAX_MESSAGES = 500;
+inline constexpr long MESSAGE_PREFETCH_ROWS = 20;
+inline constexpr std::chrono::milliseconds MESSAGE_PAGE_MIN_INTERVAL{300};
+// Messages seen are reported to TDLib at most once per chat in this interval, all together.
+inline constexpr std::chrono::milliseconds READ_RECEIPT_DELAY{1000};
+// Chats left most recently keep their loaded messages, and stay open in TDLib so that they keep receiving updates.
+inline constexpr std::size_t MESSAGE_CACHE_MAX_CHATS = 8;
+// Once the reader has paused for CHAT_PREFETCH_DELAY, the first page of history of up to CHAT_PREFETCH_MAX_CHATS
+// likely next chats is loaded in the background, at most CHAT_PREFETCH_MAX_IN_FLIGHT at a time: the
+// CHAT_PREFETCH_NEIGHBOURS rows on either side of the focused one, then pinned and unread chats from the top.
+inline constexpr std::chrono::milliseconds CHAT_PREFETCH_DELAY{750};
+inline constexpr std::size_t CHAT_PREFETCH_MAX_CHATS = 8;
+inline constexpr std::size_t CHAT_PREFETCH_MAX_IN_FLIGHT = 2;
+inline constexpr long CHAT_PREFETCH_NEIGHBOURS = 2;
+// The chat list snapshot painted at the next start is saved this often and when the window closes.
+inline constexpr std::chrono::milliseconds CHAT_SNAPSHOT_SAVE_INTERVAL{5 * 60 * 1000};
+// Chats keep their last message only as a preview of at most this many bytes of UTF-8.
+inline constexpr std::size_t CHAT_PREVIEW_MAX_BYTES = 160;
+
 #endif
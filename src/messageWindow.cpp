@@ -0,0 +1,193 @@
+#include "messageWindow.h"
+
+#include <algorithm>
+#include <utility>
+
+void MessageWindow::reset(std::int64_t chat_id) {
+    chat_id_ = chat_id;
+    messages_.clear();
+    slots_.clear();
+    front_slot_ = 0;
+    reached_oldest_ = false;
+    reached_newest_ = true;
+}
+
+std::size_t MessageWindow::addOlder(std::vector<Message> page) {
+    std::sort(page.begin(), page.end(), [](const Message& a, const Message& b) { return a->id_ > b->id_; });
+    std::size_t added = 0;
+    for (auto& message : page) {
+        if (message && message->chat_id_ == chat_id_ && (messages_.empty() || message->id_ < getOldestId())) {
+            messages_.push_front(std::move(message));
+            --front_slot_;
+            index(0);
+            ++added;
+        }
+    }
+    if (added == 0) {
+        reached_oldest_ = true;
+    }
+    return added;
+}
+
+std::size_t MessageWindow::addNewer(std::vector<Message> page) {
+    std::sort(page.begin(), page.end(), [](const Message& a, const Message& b) { return a->id_ < b->id_; });
+    std::size_t added = 0;
+    for (auto& message : page) {
+        if (message && message->chat_id_ == chat_id_ && (messages_.empty() || message->id_ > getNewestId())) {
+            messages_.push_back(std::move(message));
+            index(messages_.size() - 1);
+            ++added;
+        }
+    }
+    if (added == 0) {
+        reached_newest_ = true;
+    }
+    return added;
+}
+
+bool MessageWindow::addLatest(Message message) {
+    // An empty window that has not reached the start of the chat has no page yet. The first page is asked for
+    // from the newest message and brings this one along; taking it now would make that page look like a gap.
+    if (!message || message->chat_id_ != chat_id_ || !reached_newest_ || (messages_.empty() && !reached_oldest_) ||
+        (!messages_.empty() && message->id_ <= getNewestId())) {
+        return false;
+    }
+    messages_.push_back(std::move(message));
+    index(messages_.size() - 1);
+    return true;
+}
+
+std::size_t MessageWindow::evictOlder(std::size_t count) {
+    count = std::min(count, messages_.size());
+    for (std::size_t i = 0; i < count; ++i) {
+        slots_.erase(messages_[i]->id_);
+    }
+    messages_.erase(messages_.begin(), messages_.begin() + static_cast<std::ptrdiff_t>(count));
+    front_slot_ += static_cast<std::int64_t>(count);
+    if (count != 0) {
+        reached_oldest_ = false;
+    }
+    return count;
+}
+
+std::size_t MessageWindow::evictNewer(std::size_t count) {
+    count = std::min(count, messages_.size());
+    for (std::size_t i = messages_.size() - count; i < messages_.size(); ++i) {
+        slots_.erase(messages_[i]->id_);
+    }
+    messages_.erase(messages_.end() - static_cast<std::ptrdiff_t>(count), messages_.end());
+    if (count != 0) {
+        reached_newest_ = false;
+    }
+    return count;
+}
+
+td::td_api::message* MessageWindow::find(std::int64_t message_id) const {
+    const std::size_t index = indexOf(message_id);
+    return index == npos ? nullptr : messages_[index].get();
+}
+
+std::size_t MessageWindow::indexOf(std::int64_t message_id) const {
+    auto it = slots_.find(message_id);
+    if (it == slots_.end()) {
+        return npos;
+    }
+    return static_cast<std::size_t>(it->second - front_slot_);
+}
+
+std::size_t MessageWindow::remove(std::int64_t message_id) {
+    const std::size_t row = indexOf(message_id);
+    if (row == npos) {
+        return npos;
+    }
+    slots_.erase(message_id);
+    messages_.erase(messages_.begin() + static_cast<std::ptrdiff_t>(row));
+    // Close the gap from whichever side has fewer messages to renumber.
+    if (row < messages_.size() - row) {
+        for (std::size_t i = 0; i < row; ++i) {
+            ++slots_[messages_[i]->id_];
+        }
+        ++front_slot_;
+    } else {
+        for (std::size_t i = row; i < messages_.size(); ++i) {
+            --slots_[messages_[i]->id_];
+        }
+    }
+    return row;
+}
+
+std::size_t MessageWindow::replace(std::int64_t old_id, Message message) {
+    const std::size_t row = indexOf(old_id);
+    if (row == npos || !message || message->chat_id_ != chat_id_) {
+        return npos;
+    }
+    const std::int64_t new_id = message->id_;
+    const bool fits = (row == 0 || messages_[row - 1]->id_ < new_id) &&
+                      (row + 1 == messages_.size() || messages_[row + 1]->id_ > new_id);
+    slots_.erase(old_id);
+    if (fits) {
+        messages_[row] = std::move(message);
+        index(row);
+        return row;
+    }
+    // Several messages sent at once can be confirmed out of order; the window stays sorted by id.
+    messages_.erase(messages_.begin() + static_cast<std::ptrdiff_t>(row));
+    auto it = std::lower_bound(messages_.begin(), messages_.end(), new_id,
+                               [](const Message& existing, std::int64_t id) { return existing->id_ < id; });
+    const auto new_row = static_cast<std::size_t>(it - messages_.begin());
+    messages_.insert(it, std::move(message));
+    reindex();
+    return new_row;
+}
+
+void MessageWindow::index(std::size_t row) {
+    slots_[messages_[row]->id_] = front_slot_ + static_cast<std::int64_t>(row);
+}
+
+void MessageWindow::reindex() {
+    slots_.clear();
+    for (std::size_t row = 0; row < messages_.size(); ++row) {
+        index(row);
+    }
+}
+
+std::int64_t MessageWindowCache::park(Entry entry) {
+    erase(entry.window.getChatId());
+    std::int64_t evicted = 0;
+    if (entries_.size() >= capacity_ && !entries_.empty()) {
+        evicted = entries_.front().window.getChatId();
+        entries_.erase(entries_.begin());
+    }
+    entries_.push_back(std::move(entry));
+    return evicted;
+}
+
+bool MessageWindowCache::take(std::int64_t chat_id, Entry& entry) {
+    auto it = std::find_if(entries_.begin(), entries_.end(),
+                           [chat_id](const Entry& parked) { return parked.window.getChatId() == chat_id; });
+    if (it == entries_.end()) {
+        return false;
+    }
+    entry = std::move(*it);
+    entries_.erase(it);
+    return true;
+}
+
+MessageWindow* MessageWindowCache::find(std::int64_t chat_id) {
+    for (Entry& entry : entries_) {
+        if (entry.window.getChatId() == chat_id) {
+            return &entry.window;
+        }
+    }
+    return nullptr;
+}
+
+bool MessageWindowCache::erase(std::int64_t chat_id) {
+    auto it = std::find_if(entries_.begin(), entries_.end(),
+                           [chat_id](const Entry& parked) { return parked.window.getChatId() == chat_id; });
+    if (it == entries_.end()) {
+        return false;
+    }
+    entries_.erase(it);
+    return true;
+}
@@ -0,0 +1,107 @@
+#ifndef MESSAGE_WINDOW_H
+#define MESSAGE_WINDOW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <td/telegram/td_api.h>
+#include <unordered_map>
+#include <vector>
+
+// The loaded part of one chat's history: a contiguous run of messages, oldest first. Pages are added at either end
+// as the reader scrolls and the far end is evicted past a budget, so memory does not depend on how far back the
+// reader goes. Row i of the message view is message i of the window.
+class MessageWindow {
+  public:
+    using Message = td::td_api::object_ptr<td::td_api::message>;
+
+    // Starts over for another chat (or the same one from its newest message).
+    void reset(std::int64_t chat_id);
+
+    // Adds a page from getChatHistory (newest first, as TDLib returns it). Messages already in the window or not
+    // adjacent to the requested end are skipped. Returns how many were added.
+    std::size_t addOlder(std::vector<Message> page);
+    std::size_t addNewer(std::vector<Message> page);
+    // Appends a message that just arrived. Ignored unless the window reaches the newest end of the chat, and while
+    // its first page is still to come.
+    bool addLatest(Message message);
+
+    // Drop up to `count` messages from the given end. Dropping newer messages means the window no longer reaches
+    // the newest end; dropping older ones means it no longer reaches the start of the chat.
+    std::size_t evictOlder(std::size_t count);
+    std::size_t evictNewer(std::size_t count);
+
+    // Removes a deleted message and returns the row it had, or npos. Rows after it move up by one.
+    std::size_t remove(std::int64_t message_id);
+    // Puts `message` in the place of the message with `old_id`, for a sent message that got its server id. Returns
+    // its row, or npos if `old_id` is not in the window. The row stays unless the new id sorts elsewhere.
+    std::size_t replace(std::int64_t old_id, Message message);
+
+    td::td_api::message* find(std::int64_t message_id) const;
+    // Row of the message, or npos. Constant time, through the id index.
+    std::size_t indexOf(std::int64_t message_id) const;
+    const td::td_api::message* at(std::size_t index) const { return messages_[index].get(); }
+    std::size_t size() const { return messages_.size(); }
+    bool empty() const { return messages_.empty(); }
+
+    std::int64_t getChatId() const { return chat_id_; }
+    std::int64_t getOldestId() const { return messages_.empty() ? 0 : messages_.front()->id_; }
+    std::int64_t getNewestId() const { return messages_.empty() ? 0 : messages_.back()->id_; }
+    // Whether there is nothing older to load, and whether the newest message of the chat is in the window.
+    bool reachedOldest() const { return reached_oldest_; }
+    bool reachedNewest() const { return reached_newest_; }
+    void setReachedOldest() { reached_oldest_ = true; }
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+  private:
+    void index(std::size_t row);
+    void reindex();
+
+    std::int64_t chat_id_{0};
+    // Message ids grow with time within a chat, so the window is sorted by id.
+    std::deque<Message> messages_;
+    // Message id to slot, where a message's row is its slot minus the front slot. Adding or evicting at either end
+    // moves the front slot instead of renumbering every message; only a removal from the middle renumbers, and then
+    // only the shorter side.
+    std::unordered_map<std::int64_t, std::int64_t> slots_;
+    std::int64_t front_slot_{0};
+    bool reached_oldest_{false};
+    bool reached_newest_{true};
+};
+
+// Windows of the chats the reader left most recently, parked with where the reader was, so that going back to one
+// shows it again without asking TDLib for its history. Parked windows keep receiving new messages and edits, and the
+// one parked longest ago goes first once the capacity is reached.
+class MessageWindowCache {
+  public:
+    struct Entry {
+        MessageWindow window;
+        // First message on screen and the selected one; 0 for none.
+        std::int64_t top_message_id{0};
+        std::int64_t selected_message_id{0};
+    };
+
+    explicit MessageWindowCache(std::size_t capacity) : capacity_(capacity) {}
+
+    // Parks the entry for its chat and returns the chat evicted to make room, or 0.
+    std::int64_t park(Entry entry);
+    // Moves the chat's entry out of the cache; false if it is not parked.
+    bool take(std::int64_t chat_id, Entry& entry);
+    MessageWindow* find(std::int64_t chat_id);
+    bool erase(std::int64_t chat_id);
+    template <class Visit> void forEachChat(Visit visit) const {
+        for (const Entry& entry : entries_) {
+            visit(entry.window.getChatId());
+        }
+    }
+
+  private:
+    std::size_t capacity_;
+    // Most recently parked last. Only a handful of chats, so a scan is as fast as any index; a list, because a
+    // window cannot be copied when a vector grows.
+    std::list<Entry> entries_;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "peerCache.h"
+
+namespace {
+UserRecord::Status statusOf(const td::td_api::UserStatus* status, std::int32_t& was_online) {
+    was_online = 0;
+    if (!status) {
+        return UserRecord::STATUS_EMPTY;
+    }
+    switch (status->get_id()) {
+        case td::td_api::userStatusOnline::ID:
+            return UserRecord::STATUS_ONLINE;
+        case td::td_api::userStatusOffline::ID:
+            was_online = static_cast<const td::td_api::userStatusOffline*>(status)->was_online_;
+            return UserRecord::STATUS_OFFLINE;
+        case td::td_api::userStatusRecently::ID:
+            return UserRecord::STATUS_RECENTLY;
+        case td::td_api::userStatusLastWeek::ID:
+            return UserRecord::STATUS_LAST_WEEK;
+        case td::td_api::userStatusLastMonth::ID:
+            return UserRecord::STATUS_LAST_MONTH;
+        default:
+            return UserRecord::STATUS_EMPTY;
+    }
+}
+
+template <class Map> auto findIn(const Map& map, typename Map::key_type id) -> const typename Map::mapped_type* {
+    auto it = map.find(id);
+    return it == map.end() ? nullptr : &it->second;
+}
+} // namespace
+
+const UserRecord& PeerCache::setUser(const td::td_api::user& user) {
+    UserRecord& record = users_[user.id_];
+    record.first_name = names_.intern(user.first_name_);
+    record.last_name = names_.intern(user.last_name_);
+    record.status = statusOf(user.status_.get(), record.was_online);
+    record.is_premium = user.is_premium_;
+    record.is_bot = user.type_ && user.type_->get_id() == td::td_api::userTypeBot::ID;
+    return record;
+}
+
+const UserRecord* PeerCache::findUser(std::int64_t user_id) const {
+    return findIn(users_, user_id);
+}
+
+void PeerCache::setBasicGroup(const td::td_api::basicGroup& group) {
+    basic_groups_[group.id_].member_count = group.member_count_;
+}
+
+void PeerCache::setSupergroup(const td::td_api::supergroup& group) {
+    SupergroupRecord& record = supergroups_[group.id_];
+    record.member_count = group.member_count_;
+    record.is_channel = group.is_channel_;
+}
+
+void PeerCache::setSecretChat(const td::td_api::secretChat& chat) {
+    secret_chats_[chat.id_].user_id = chat.user_id_;
+}
+
+const BasicGroupRecord* PeerCache::findBasicGroup(std::int64_t id) const {
+    return findIn(basic_groups_, id);
+}
+
+const SupergroupRecord* PeerCache::findSupergroup(std::int64_t id) const {
+    return findIn(supergroups_, id);
+}
+
+const SecretChatRecord* PeerCache::findSecretChat(std::int32_t id) const {
+    return findIn(secret_chats_, id);
+}
@@ -0,0 +1,72 @@
+#ifndef PEER_CACHE_H
+#define PEER_CACHE_H
+
+#include "stringPool.h"
+
+#include <cstdint>
+#include <string_view>
+#include <td/telegram/td_api.h>
+#include <unordered_map>
+
+// The parts of a user the lists show. Names are interned; the rest fits in a few bytes, against the photos,
+// usernames and emoji statuses a td_api::user carries.
+struct UserRecord {
+    enum Status : unsigned char {
+        STATUS_EMPTY,
+        STATUS_ONLINE,
+        STATUS_OFFLINE,
+        STATUS_RECENTLY,
+        STATUS_LAST_WEEK,
+        STATUS_LAST_MONTH
+    };
+
+    StringPool::Id first_name{StringPool::kEmpty};
+    StringPool::Id last_name{StringPool::kEmpty};
+    // Unix time, for STATUS_OFFLINE.
+    std::int32_t was_online{0};
+    Status status{STATUS_EMPTY};
+    bool is_premium{false};
+    bool is_bot{false};
+};
+
+struct BasicGroupRecord {
+    std::int32_t member_count{0};
+};
+
+struct SupergroupRecord {
+    std::int32_t member_count{0};
+    bool is_channel{false};
+};
+
+struct SecretChatRecord {
+    std::int64_t user_id{0};
+};
+
+// Users, basic groups, supergroups and secret chats of one account, reduced to records as their updates arrive.
+class PeerCache {
+  public:
+    const UserRecord& setUser(const td::td_api::user& user);
+    void setUser(std::int64_t user_id, const UserRecord& record) { users_[user_id] = record; }
+    const UserRecord* findUser(std::int64_t user_id) const;
+    std::string_view firstName(const UserRecord& user) const { return names_.view(user.first_name); }
+    std::string_view lastName(const UserRecord& user) const { return names_.view(user.last_name); }
+    StringPool& getNames() { return names_; }
+
+    void setBasicGroup(const td::td_api::basicGroup& group);
+    void setSupergroup(const td::td_api::supergroup& group);
+    void setSecretChat(const td::td_api::secretChat& chat);
+    const BasicGroupRecord* findBasicGroup(std::int64_t id) const;
+    const SupergroupRecord* findSupergroup(std::int64_t id) const;
+    const SecretChatRecord* findSecretChat(std::int32_t id) const;
+
+    std::size_t getUserCount() const { return users_.size(); }
+
+  private:
+    StringPool names_;
+    std::unordered_map<std::int64_t, UserRecord> users_;
+    std::unordered_map<std::int64_t, BasicGroupRecord> basic_groups_;
+    std::unordered_map<std::int64_t, SupergroupRecord> supergroups_;
+    std::unordered_map<std::int32_t, SecretChatRecord> secret_chats_;
+};
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef PENDING_REQUEST_TABLE_H
+#define PENDING_REQUEST_TABLE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Preallocated, slot-indexed table of requests waiting for a TDLib response.
+// The query id handed to TDLib encodes the slot index and the slot generation, so a lookup is a single array
+// access and a late response for a slot that has since been reused is recognised and dropped. Slots move through
+// FREE -> PENDING -> BUSY -> FREE with compare-and-swap on a (generation, state) word; free slots live on a
+// tagged lock-free stack. Neither sending nor receiving takes a lock.
+template <class Payload> class PendingRequestTable {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Counters {
+        std::uint64_t in_flight;
+        std::uint64_t issued;
+        std::uint64_t completed;
+        std::uint64_t cancelled;
+        std::uint64_t timed_out;
+        std::uint64_t rejected;
+        std::uint64_t stale;
+    };
+
+    static constexpr unsigned kSlotBits = 24;
+    static constexpr std::uint32_t kMaxCapacity = 1u << kSlotBits;
+    // Query ids with this bit set were sent without a slot (the table was full) and have nobody waiting for them.
+    static constexpr std::uint64_t kUntrackedBit = 1ull << 63;
+
+    explicit PendingRequestTable(std::uint32_t capacity = 16384)
+        : capacity_(capacity == 0 ? 1 : (capacity > kMaxCapacity ? kMaxCapacity : capacity)),
+          slots_(new Slot[capacity_]), next_(new std::atomic<std::uint32_t>[capacity_]) {
+        for (std::uint32_t i = 0; i < capacity_; ++i) {
+            slots_[i].word.store(makeWord(1, FREE), std::memory_order_relaxed);
+            next_[i].store(i + 2 <= capacity_ ? i + 2 : 0, std::memory_order_relaxed);
+        }
+        free_head_.store(1, std::memory_order_release);
+    }
+
+    PendingRequestTable(const PendingRequestTable&) = delete;
+    PendingRequestTable& operator=(const PendingRequestTable&) = delete;
+
+    // Takes the payload and returns the query id to send, or 0 (leaving the payload untouched) if every slot is
+    // taken. A zero deadline means the request never times out.
+    std::uint64_t acquire(Payload&& payload, Clock::time_point deadline = Clock::time_point()) {
+        std::uint32_t index = popFree();
+        if (index == kNone) {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        Slot& slot = slots_[index];
+        const std::uint32_t generation = generationOf(slot.word.load(std::memory_order_acquire));
+        slot.payload = std::move(payload);
+        slot.deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+        if (deadline != Clock::time_point()) {
+            with_deadline_.fetch_add(1, std::memory_order_relaxed);
+        }
+        slot.word.store(makeWord(generation, PENDING), std::memory_order_release);
+
+        std::uint32_t high = high_water_.load(std::memory_order_relaxed);
+        while (index + 1 > high && !high_water_.compare_exchange_weak(high, index + 1, std::memory_order_relaxed)) {
+        }
+        in_flight_.fetch_add(1, std::memory_order_relaxed);
+        issued_.fetch_add(1, std::memory_order_relaxed);
+        return (static_cast<std::uint64_t>(generation) << kSlotBits) | index;
+    }
+
+    // Claims the payload for an arrived response. Returns false for unknown, cancelled or expired query ids.
+    bool complete(std::uint64_t query_id, Payload& out) {
+        if (!claim(query_id, out)) {
+            if (isTracked(query_id)) {
+                stale_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return false;
+        }
+        completed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Drops the payload of a request that is still pending. The response, if it ever arrives, is ignored.
+    bool cancel(std::uint64_t query_id) {
+        Payload dropped;
+        if (!claim(query_id, dropped)) {
+            return false;
+        }
+        cancelled_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // True while the request is waiting for its response, i.e. it has not completed, expired or been cancelled.
+    bool isPending(std::uint64_t query_id) const {
+        if (!isTracked(query_id)) {
+            return false;
+        }
+        const std::uint32_t index = static_cast<std::uint32_t>(query_id & (kMaxCapacity - 1));
+        const std::uint32_t generation = static_cast<std::uint32_t>(query_id >> kSlotBits);
+        return index < capacity_ &&
+               slots_[index].word.load(std::memory_order_acquire) == makeWord(generation, PENDING);
+    }
+
+    // Moves the payloads of every request whose deadline has passed into `expired` and frees their slots.
+    void collectExpired(Clock::time_point now, std::vector<Payload>& expired) {
+        const auto now_ticks = now.time_since_epoch().count();
+        const std::uint32_t high = high_water_.load(std::memory_order_relaxed);
+        for (std::uint32_t index = 0; index < high; ++index) {
+            Slot& slot = slots_[index];
+            std::uint64_t word = slot.word.load(std::memory_order_acquire);
+            if (stateOf(word) != PENDING) {
+                continue;
+            }
+            const auto deadline = slot.deadline.load(std::memory_order_relaxed);
+            if (deadline == 0 || deadline > now_ticks) {
+                continue;
+            }
+            if (!slot.word.compare_exchange_strong(word, makeWord(generationOf(word), BUSY),
+                                                   std::memory_order_acq_rel)) {
+                continue;
+            }
+            expired.push_back(std::move(slot.payload));
+            release(index, generationOf(word));
+            timed_out_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Counters counters() const {
+        return {in_flight_.load(std::memory_order_relaxed), issued_.load(std::memory_order_relaxed),
+                completed_.load(std::memory_order_relaxed), cancelled_.load(std::memory_order_relaxed),
+                timed_out_.load(std::memory_order_relaxed), rejected_.load(std::memory_order_relaxed),
+                stale_.load(std::memory_order_relaxed)};
+    }
+
+    // Number of pending requests that carry a deadline; the owner only needs to poll collectExpired while non-zero.
+    std::uint64_t pendingWithDeadline() const { return with_deadline_.load(std::memory_order_relaxed); }
+
+    std::uint32_t capacity() const { return capacity_; }
+
+    static bool isTracked(std::uint64_t query_id) { return query_id != 0 && (query_id & kUntrackedBit) == 0; }
+
+  private:
+    enum State : std::uint64_t {
+        FREE = 0,
+        PENDING = 1,
+        BUSY = 2
+    };
+
+    struct Slot {
+        std::atomic<std::uint64_t> word{0};
+        std::atomic<Clock::rep> deadline{0};
+        Payload payload{};
+    };
+
+    static constexpr std::uint32_t kNone = 0xFFFFFFFFu;
+
+    static std::uint64_t makeWord(std::uint32_t generation, State state) {
+        return (static_cast<std::uint64_t>(generation) << 2) | state;
+    }
+    static std::uint32_t generationOf(std::uint64_t word) { return static_cast<std::uint32_t>(word >> 2); }
+    static State stateOf(std::uint64_t word) { return static_cast<State>(word & 3); }
+
+    bool claim(std::uint64_t query_id, Payload& out) {
+        if (!isTracked(query_id)) {
+            return false;
+        }
+        const std::uint32_t index = static_cast<std::uint32_t>(query_id & (kMaxCapacity - 1));
+        const std::uint32_t generation = static_cast<std::uint32_t>(query_id >> kSlotBits);
+        if (index >= capacity_) {
+            return false;
+        }
+        Slot& slot = slots_[index];
+        std::uint64_t expected = makeWord(generation, PENDING);
+        if (!slot.word.compare_exchange_strong(expected, makeWord(generation, BUSY), std::memory_order_acq_rel)) {
+            return false;
+        }
+        out = std::move(slot.payload);
+        release(index, generation);
+        return true;
+    }
+
+    void release(std::uint32_t index, std::uint32_t generation) {
+        Slot& slot = slots_[index];
+        slot.payload = Payload{};
+        if (slot.deadline.exchange(0, std::memory_order_relaxed) != 0) {
+            with_deadline_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        std::uint32_t next_generation = generation + 1;
+        if (next_generation == 0) {
+            next_generation = 1;
+        }
+        slot.word.store(makeWord(next_generation, FREE), std::memory_order_release);
+        in_flight_.fetch_sub(1, std::memory_order_relaxed);
+        pushFree(index);
+    }
+
+    // The free stack head packs an ABA tag in the upper half and (index + 1) in the lower half; 0 means empty.
+    std::uint32_t popFree() {
+        std::uint64_t head = free_head_.load(std::memory_order_acquire);
+        for (;;) {
+            const std::uint32_t top = static_cast<std::uint32_t>(head);
+            if (top == 0) {
+                return kNone;
+            }
+            const std::uint64_t tag = (head >> 32) + 1;
+            const std::uint32_t next = next_[top - 1].load(std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, (tag << 32) | next, std::memory_order_acq_rel)) {
+                return top - 1;
+            }
+        }
+    }
+
+    void pushFree(std::uint32_t index) {
+        std::uint64_t head = free_head_.load(std::memory_order_relaxed);
+        for (;;) {
+            next_[index].store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+            const std::uint64_t tag = (head >> 32) + 1;
+            if (free_head_.compare_exchange_weak(head, (tag << 32) | (index + 1), std::memory_order_acq_rel)) {
+                return;
+            }
+        }
+    }
+
+    const std::uint32_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> next_;
+    std::atomic<std::uint64_t> free_head_{0};
+    std::atomic<std::uint32_t> high_water_{0};
+
+    std::atomic<std::uint64_t> in_flight_{0};
+    std::atomic<std::uint64_t> issued_{0};
+    std::atomic<std::uint64_t> completed_{0};
+    std::atomic<std::uint64_t> cancelled_{0};
+    std::atomic<std::uint64_t> timed_out_{0};
+    std::atomic<std::uint64_t> rejected_{0};
+    std::atomic<std::uint64_t> stale_{0};
+    std::atomic<std::uint64_t> with_deadline_{0};
+};
+
+#endif
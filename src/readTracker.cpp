@@ -0,0 +1,70 @@
+#include "readTracker.h"
+
+#include <algorithm>
+#include <iterator>
+
+void ReadTracker::markViewed(std::int64_t chat_id, const std::vector<std::int64_t>& message_ids, bool force_read) {
+    ChatState& chat = chats_[chat_id];
+    const std::size_t before = chat.pending.size();
+    for (auto message_id : message_ids) {
+        if (message_id > chat.reported_up_to) {
+            chat.pending.push_back(message_id);
+        }
+    }
+    if (chat.pending.size() == before) {
+        return;
+    }
+    // The rows on screen overlap with what was already pending from the last look; merge them into one set.
+    const auto added = chat.pending.begin() + static_cast<std::ptrdiff_t>(before);
+    std::sort(added, chat.pending.end());
+    std::inplace_merge(chat.pending.begin(), added, chat.pending.end());
+    chat.pending.erase(std::unique(chat.pending.begin(), chat.pending.end()), chat.pending.end());
+    chat.force_read = chat.force_read || force_read;
+    if (before == 0) {
+        ++pending_chats_;
+    }
+}
+
+void ReadTracker::setReadUpTo(std::int64_t chat_id, std::int64_t message_id) {
+    auto it = chats_.find(chat_id);
+    if (it == chats_.end() || message_id <= it->second.reported_up_to) {
+        return;
+    }
+    ChatState& chat = it->second;
+    chat.reported_up_to = message_id;
+    if (chat.pending.empty()) {
+        return;
+    }
+    chat.pending.erase(chat.pending.begin(), std::upper_bound(chat.pending.begin(), chat.pending.end(), message_id));
+    if (chat.pending.empty()) {
+        chat.force_read = false;
+        --pending_chats_;
+    }
+}
+
+std::vector<ReadTracker::Batch> ReadTracker::takePending() {
+    std::vector<Batch> batches;
+    batches.reserve(pending_chats_);
+    for (auto& [chat_id, chat] : chats_) {
+        if (chat.pending.empty()) {
+            continue;
+        }
+        chat.reported_up_to = std::max(chat.reported_up_to, chat.pending.back());
+        batches.push_back(Batch{chat_id, std::move(chat.pending), chat.force_read});
+        chat.pending.clear();
+        chat.force_read = false;
+    }
+    pending_chats_ = 0;
+    return batches;
+}
+
+void ReadTracker::forget(std::int64_t chat_id) {
+    auto it = chats_.find(chat_id);
+    if (it == chats_.end()) {
+        return;
+    }
+    if (!it->second.pending.empty()) {
+        --pending_chats_;
+    }
+    chats_.erase(it);
+}
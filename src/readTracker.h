@@ -0,0 +1,42 @@
+#ifndef READ_TRACKER_H
+#define READ_TRACKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Collects the messages the reader has seen, per chat, until they are reported with viewMessages. Messages at or
+// below the highest id a chat has already reported (or TDLib says is read) are dropped on arrival, and repeated
+// sightings of the same rows merge into one pending set, so the requests sent depend on how much was read rather
+// than on how often the view moved.
+// Used from one thread.
+class ReadTracker {
+  public:
+    struct Batch {
+        std::int64_t chat_id;
+        // Ascending, without duplicates.
+        std::vector<std::int64_t> message_ids;
+        bool force_read;
+    };
+
+    void markViewed(std::int64_t chat_id, const std::vector<std::int64_t>& message_ids, bool force_read);
+    // Everything up to `message_id` is read already, from this or another device.
+    void setReadUpTo(std::int64_t chat_id, std::int64_t message_id);
+    bool hasPending() const { return pending_chats_ != 0; }
+    // Hands over one batch per chat with anything pending, and counts those messages as reported.
+    std::vector<Batch> takePending();
+    void forget(std::int64_t chat_id);
+
+  private:
+    struct ChatState {
+        std::int64_t reported_up_to{0};
+        std::vector<std::int64_t> pending;
+        bool force_read{false};
+    };
+
+    std::unordered_map<std::int64_t, ChatState> chats_;
+    std::size_t pending_chats_{0};
+};
+
+#endif
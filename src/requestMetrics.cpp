@@ -0,0 +1,214 @@
+#include "requestMetrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <td/telegram/td_api.h>
+#include <utility>
+
+namespace {
+std::size_t hashId(std::int32_t id) {
+    return static_cast<std::size_t>((static_cast<std::uint32_t>(id) * 0x9E3779B1u) >> 8);
+}
+
+unsigned highestBit(std::uint64_t value) {
+    unsigned bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+}
+} // namespace
+
+void LatencyHistogram::record(std::uint64_t micros) {
+    buckets_[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(micros, std::memory_order_relaxed);
+    std::uint64_t current = max_.load(std::memory_order_relaxed);
+    while (micros > current && !max_.compare_exchange_weak(current, micros, std::memory_order_relaxed)) {
+    }
+}
+
+std::uint64_t LatencyHistogram::percentile(double q) const {
+    const std::uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5));
+    std::uint64_t seen = 0;
+    for (std::size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+        seen += buckets_[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucketUpperBound(bucket), max());
+        }
+    }
+    return max();
+}
+
+std::size_t LatencyHistogram::bucketOf(std::uint64_t micros) {
+    if (micros < 2 * kSubBuckets) {
+        return static_cast<std::size_t>(micros);
+    }
+    const unsigned shift = highestBit(micros) - kSubBucketBits;
+    const std::size_t bucket = (shift + 1) * kSubBuckets + ((micros >> shift) - kSubBuckets);
+    return std::min(bucket, kBucketCount - 1);
+}
+
+std::uint64_t LatencyHistogram::bucketUpperBound(std::size_t bucket) {
+    if (bucket < 2 * kSubBuckets) {
+        return bucket;
+    }
+    const unsigned shift = static_cast<unsigned>(bucket / kSubBuckets) - 1;
+    const std::uint64_t sub = bucket % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+RequestMetrics::~RequestMetrics() {
+    for (auto& slot : functions_) {
+        delete slot.entry.load(std::memory_order_acquire);
+    }
+}
+
+void RequestMetrics::recordResponse(std::int32_t function_id, Clock::duration latency, bool is_error) {
+    auto* entry = findFunction(function_id);
+    if (!entry) {
+        return;
+    }
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    entry->latency.record(micros < 0 ? 0 : static_cast<std::uint64_t>(micros));
+    if (is_error) {
+        entry->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void RequestMetrics::recordTimeout(std::int32_t function_id) {
+    if (auto* entry = findFunction(function_id)) {
+        entry->timeouts.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void RequestMetrics::recordUpdate(std::int32_t constructor_id) {
+    total_updates_.fetch_add(1, std::memory_order_relaxed);
+    if (auto* slot = findUpdate(constructor_id)) {
+        slot->count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::vector<RequestMetrics::FunctionStats> RequestMetrics::getFunctionStats() const {
+    std::vector<FunctionStats> stats;
+    for (const auto& slot : functions_) {
+        const auto* entry = slot.entry.load(std::memory_order_acquire);
+        if (!entry) {
+            continue;
+        }
+        const auto& latency = entry->latency;
+        const auto count = latency.count();
+        stats.push_back({slot.id.load(std::memory_order_relaxed), count,
+                         entry->errors.load(std::memory_order_relaxed),
+                         entry->timeouts.load(std::memory_order_relaxed), count ? latency.sum() / count : 0,
+                         latency.percentile(0.5), latency.percentile(0.9), latency.percentile(0.99), latency.max()});
+    }
+    std::sort(stats.begin(), stats.end(),
+              [](const FunctionStats& a, const FunctionStats& b) { return a.count > b.count; });
+    return stats;
+}
+
+std::vector<RequestMetrics::UpdateStats> RequestMetrics::getUpdateStats() const {
+    std::vector<UpdateStats> stats;
+    for (const auto& slot : updates_) {
+        const auto id = slot.id.load(std::memory_order_acquire);
+        if (id != 0) {
+            stats.push_back({id, slot.count.load(std::memory_order_relaxed)});
+        }
+    }
+    std::sort(stats.begin(), stats.end(), [](const UpdateStats& a, const UpdateStats& b) { return a.count > b.count; });
+    return stats;
+}
+
+RequestMetrics::FunctionEntry* RequestMetrics::findFunction(std::int32_t function_id) {
+    if (function_id == 0) {
+        return nullptr;
+    }
+    for (std::size_t probe = 0, i = hashId(function_id); probe < kFunctionSlots; ++probe, ++i) {
+        auto& slot = functions_[i % kFunctionSlots];
+        std::int32_t id = slot.id.load(std::memory_order_acquire);
+        if (id == 0 && slot.id.compare_exchange_strong(id, function_id, std::memory_order_acq_rel)) {
+            auto* entry = new FunctionEntry();
+            slot.entry.store(entry, std::memory_order_release);
+            return entry;
+        }
+        if (id == function_id) {
+            // Null only while another thread is still publishing the entry; that one sample is skipped.
+            return slot.entry.load(std::memory_order_acquire);
+        }
+    }
+    return nullptr;
+}
+
+RequestMetrics::UpdateSlot* RequestMetrics::findUpdate(std::int32_t constructor_id) {
+    if (constructor_id == 0) {
+        return nullptr;
+    }
+    for (std::size_t probe = 0, i = hashId(constructor_id); probe < kUpdateSlots; ++probe, ++i) {
+        auto& slot = updates_[i % kUpdateSlots];
+        std::int32_t id = slot.id.load(std::memory_order_acquire);
+        if (id == constructor_id ||
+            (id == 0 && (slot.id.compare_exchange_strong(id, constructor_id, std::memory_order_acq_rel) ||
+                         id == constructor_id))) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+std::string tlTypeName(std::int32_t constructor_id) {
+#define TL_NAME(type) {td::td_api::type::ID, #type}
+    static const std::pair<std::int32_t, const char*> kNames[] = {
+        TL_NAME(close),
+        TL_NAME(closeChat),
+        TL_NAME(checkAuthenticationCode),
+        TL_NAME(checkAuthenticationPassword),
+        TL_NAME(getChatHistory),
+        TL_NAME(getMe),
+        TL_NAME(getUser),
+        TL_NAME(loadChats),
+        TL_NAME(logOut),
+        TL_NAME(openChat),
+        TL_NAME(sendMessage),
+        TL_NAME(setAuthenticationPhoneNumber),
+        TL_NAME(setTdlibParameters),
+        TL_NAME(viewMessages),
+        TL_NAME(updateAuthorizationState),
+        TL_NAME(updateBasicGroup),
+        TL_NAME(updateChatAction),
+        TL_NAME(updateChatAddedToList),
+        TL_NAME(updateChatFolders),
+        TL_NAME(updateChatLastMessage),
+        TL_NAME(updateChatOnlineMemberCount),
+        TL_NAME(updateChatPosition),
+        TL_NAME(updateChatReadInbox),
+        TL_NAME(updateChatReadOutbox),
+        TL_NAME(updateChatRemovedFromList),
+        TL_NAME(updateChatTitle),
+        TL_NAME(updateDeleteMessages),
+        TL_NAME(updateMessageContent),
+        TL_NAME(updateMessageEdited),
+        TL_NAME(updateMessageSendFailed),
+        TL_NAME(updateMessageSendSucceeded),
+        TL_NAME(updateNewChat),
+        TL_NAME(updateNewMessage),
+        TL_NAME(updateOption),
+        TL_NAME(updateSecretChat),
+        TL_NAME(updateSupergroup),
+        TL_NAME(updateUser),
+        TL_NAME(updateUserStatus),
+    };
+#undef TL_NAME
+    for (const auto& [id, name] : kNames) {
+        if (id == constructor_id) {
+            return name;
+        }
+    }
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "0x%08x", static_cast<unsigned>(constructor_id));
+    return buffer;
+}
@@ -0,0 +1,107 @@
+#ifndef REQUEST_METRICS_H
+#define REQUEST_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Log-linear latency histogram in microseconds, in the style of HdrHistogram: values below 32 get exact buckets,
+// above that every power of two is split into 16 sub-buckets, so a reported percentile is within 1/16 of the
+// recorded value. Recording is a couple of bit operations and a relaxed increment.
+class LatencyHistogram {
+  public:
+    static constexpr unsigned kSubBucketBits = 4;
+    static constexpr std::uint64_t kSubBuckets = 1ull << kSubBucketBits;
+    static constexpr std::size_t kBucketCount = 38 * kSubBuckets;
+
+    void record(std::uint64_t micros);
+
+    std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the q-th quantile (0 < q <= 1); 0 when nothing was recorded.
+    std::uint64_t percentile(double q) const;
+
+  private:
+    static std::size_t bucketOf(std::uint64_t micros);
+    static std::uint64_t bucketUpperBound(std::size_t bucket);
+
+    std::array<std::atomic<std::uint64_t>, kBucketCount> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+// Request latency per td_api function and arrival counts per update type. Everything is recorded on the TDLib
+// thread and read from the UI thread; slots are claimed once per TL constructor id and never freed, so readers
+// only ever see fully initialised entries.
+class RequestMetrics {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct FunctionStats {
+        std::int32_t function_id;
+        std::uint64_t count;
+        std::uint64_t errors;
+        std::uint64_t timeouts;
+        std::uint64_t mean_us;
+        std::uint64_t p50_us;
+        std::uint64_t p90_us;
+        std::uint64_t p99_us;
+        std::uint64_t max_us;
+    };
+
+    struct UpdateStats {
+        std::int32_t constructor_id;
+        std::uint64_t count;
+    };
+
+    RequestMetrics() = default;
+    RequestMetrics(const RequestMetrics&) = delete;
+    RequestMetrics& operator=(const RequestMetrics&) = delete;
+    ~RequestMetrics();
+
+    void recordResponse(std::int32_t function_id, Clock::duration latency, bool is_error);
+    void recordTimeout(std::int32_t function_id);
+    void recordUpdate(std::int32_t constructor_id);
+
+    std::vector<FunctionStats> getFunctionStats() const;
+    std::vector<UpdateStats> getUpdateStats() const;
+    std::uint64_t getTotalUpdates() const { return total_updates_.load(std::memory_order_relaxed); }
+
+  private:
+    struct FunctionEntry {
+        LatencyHistogram latency;
+        std::atomic<std::uint64_t> errors{0};
+        std::atomic<std::uint64_t> timeouts{0};
+    };
+
+    struct FunctionSlot {
+        std::atomic<std::int32_t> id{0};
+        std::atomic<FunctionEntry*> entry{nullptr};
+    };
+
+    struct UpdateSlot {
+        std::atomic<std::int32_t> id{0};
+        std::atomic<std::uint64_t> count{0};
+    };
+
+    // TDLib has a few hundred functions and update types; ids beyond the table size are not recorded.
+    static constexpr std::size_t kFunctionSlots = 512;
+    static constexpr std::size_t kUpdateSlots = 512;
+
+    FunctionEntry* findFunction(std::int32_t function_id);
+    UpdateSlot* findUpdate(std::int32_t constructor_id);
+
+    std::array<FunctionSlot, kFunctionSlots> functions_{};
+    std::array<UpdateSlot, kUpdateSlots> updates_{};
+    std::atomic<std::uint64_t> total_updates_{0};
+};
+
+// Readable name of a td_api constructor the client uses, or its id in hex for everything else.
+std::string tlTypeName(std::int32_t constructor_id);
+
+#endif
@@ -0,0 +1,50 @@
+#include "requestScope.h"
+
+#include <algorithm>
+
+RequestScope::RequestScope(TdClient& client) : client_(client), state_(std::make_shared<State>()) {}
+
+RequestScope::~RequestScope() {
+    reset();
+}
+
+TdManager::RequestHandle RequestScope::send(td::td_api::object_ptr<td::td_api::Function> function,
+                                            TdManager::UpdateCallback callback, TdManager::Priority priority,
+                                            std::chrono::milliseconds timeout) {
+    if (callback) {
+        // Checked where the callback finally runs, which for the UI executor is after the hop, not on arrival.
+        callback = [state = state_, generation = getGeneration(), callback = std::move(callback)](
+                       TdManager::Object object) {
+            if (state->generation.load(std::memory_order_acquire) != generation) {
+                return;
+            }
+            callback(std::move(object));
+        };
+    }
+
+    auto handle = client_.send(std::move(function), std::move(callback), priority, timeout);
+    if (handle) {
+        if (handles_.size() >= prune_at_) {
+            forgetFinished();
+        }
+        handles_.push_back(handle);
+    }
+    return handle;
+}
+
+void RequestScope::reset() {
+    state_->generation.fetch_add(1, std::memory_order_acq_rel);
+    for (auto handle : handles_) {
+        client_.cancel(handle);
+    }
+    handles_.clear();
+}
+
+void RequestScope::forgetFinished() {
+    auto& manager = client_.getManager();
+    handles_.erase(std::remove_if(handles_.begin(), handles_.end(),
+                                  [&manager](TdManager::RequestHandle handle) { return !manager.isPending(handle); }),
+                   handles_.end());
+    // Grow the threshold with the live set, so a scope with many requests in flight is not rescanned on every send.
+    prune_at_ = std::max<std::size_t>(64, handles_.size() * 2);
+}
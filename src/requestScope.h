@@ -0,0 +1,59 @@
+#ifndef REQUEST_SCOPE_H
+#define REQUEST_SCOPE_H
+
+#include "tdManager.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Requests issued on behalf of one piece of UI state, such as the open chat or the selected folder. reset() cancels
+// whatever is still pending and starts a new generation; a response that was already on its way when reset() ran
+// still reaches the executor, but its callback sees the old generation and is dropped before doing any work.
+// Destroying the scope resets it, so callbacks never run against an owner that is gone.
+// The scope itself is used from one thread (the UI thread); only the generation is read from the executor.
+class RequestScope {
+  public:
+    explicit RequestScope(TdClient& client);
+    ~RequestScope();
+
+    RequestScope(const RequestScope&) = delete;
+    RequestScope& operator=(const RequestScope&) = delete;
+
+    TdManager::RequestHandle send(td::td_api::object_ptr<td::td_api::Function> function,
+                                  TdManager::UpdateCallback callback = nullptr,
+                                  TdManager::Priority priority = TdManager::Priority::Normal,
+                                  std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+
+    // Like TdClient::request, except that a reset leaves the future unfulfilled, so its continuations never run.
+    template <class Function>
+    TdFuture<TdResultOf<Function>> request(td::td_api::object_ptr<Function> function,
+                                           TdManager::Priority priority = TdManager::Priority::Normal,
+                                           std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+        TdPromise<TdResultOf<Function>> promise;
+        auto future = promise.getFuture();
+        send(std::move(function), TdClient::fulfil<Function>(std::move(promise)), priority, timeout);
+        return future;
+    }
+
+    void reset();
+
+    std::uint64_t getGeneration() const { return state_->generation.load(std::memory_order_relaxed); }
+
+  private:
+    // Shared with the callbacks in flight, which may outlive the scope.
+    struct State {
+        std::atomic<std::uint64_t> generation{0};
+    };
+
+    void forgetFinished();
+
+    TdClient& client_;
+    std::shared_ptr<State> state_;
+    std::vector<TdManager::RequestHandle> handles_;
+    std::size_t prune_at_{64};
+};
+
+#endif
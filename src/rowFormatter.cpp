@@ -0,0 +1,177 @@
+#include "rowFormatter.h"
+
+#include <charconv>
+#include <cstdio>
+#include <ctime>
+
+namespace {
+
+struct ContentLabel {
+    std::int32_t id;
+    std::string_view text;
+};
+
+// Chat list previews of content that is not shown as text.
+constexpr ContentLabel kPreviewLabels[] = {
+    {td::td_api::messageAnimation::ID, "[Animation]"},
+    {td::td_api::messageAudio::ID, "[Audio]"},
+    {td::td_api::messageDocument::ID, "[File]"},
+    {td::td_api::messagePhoto::ID, "[Photo]"},
+    {td::td_api::messageSticker::ID, "[Sticker]"},
+    {td::td_api::messageVideo::ID, "[Video]"},
+    {td::td_api::messageVoiceNote::ID, "[Voice message]"},
+    {td::td_api::messageCall::ID, "[Call]"},
+    {td::td_api::messageContact::ID, "[Contact]"},
+    {td::td_api::messageLocation::ID, "[Location]"},
+    {td::td_api::messagePoll::ID, "[Poll]"},
+    {td::td_api::messageVideoNote::ID, "[Video message]"},
+    {td::td_api::messageChatAddMembers::ID, "[Service: New members]"},
+    {td::td_api::messagePinMessage::ID, "[Service: Pinned a message]"},
+};
+
+// Content type names in the message view; details follow after a comma where the content has any.
+constexpr ContentLabel kContentTypeLabels[] = {
+    {td::td_api::messageVoiceNote::ID, "Voice"},
+    {td::td_api::messageDocument::ID, "File"},
+    {td::td_api::messagePhoto::ID, "Photo"},
+    {td::td_api::messageVideo::ID, "Video"},
+    {td::td_api::messageChatAddMembers::ID, "Service, Members added"},
+    {td::td_api::messageChatChangeTitle::ID, "Service"},
+};
+
+constexpr std::string_view findLabel(const ContentLabel* begin, const ContentLabel* end, std::int32_t id) {
+    for (auto* label = begin; label != end; ++label) {
+        if (label->id == id) {
+            return label->text;
+        }
+    }
+    return {};
+}
+
+template <std::size_t N> constexpr std::string_view findLabel(const ContentLabel (&labels)[N], std::int32_t id) {
+    return findLabel(labels, labels + N, id);
+}
+
+static_assert(findLabel(kPreviewLabels, td::td_api::messagePhoto::ID) == "[Photo]");
+
+bool toLocalTime(std::time_t time, std::tm& out) {
+#ifdef _WIN32
+    return localtime_s(&out, &time) == 0;
+#else
+    return localtime_r(&time, &out) != nullptr;
+#endif
+}
+
+const std::string* captionOf(const td::td_api::object_ptr<td::td_api::formattedText>& caption) {
+    return caption && !caption->text_.empty() ? &caption->text_ : nullptr;
+}
+
+} // namespace
+
+RowFormatter& RowFormatter::appendNumber(std::int64_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer_.append(digits, static_cast<std::size_t>(result.ptr - digits));
+    return *this;
+}
+
+RowFormatter& RowFormatter::appendTimestamp(std::int64_t unix_time) {
+    if (unix_time == 0) {
+        return append("N/A");
+    }
+    // Floor division, so times before the epoch still land in their own minute.
+    const std::int64_t minute = unix_time >= 0 ? unix_time / 60 : (unix_time - 59) / 60;
+    CachedMinute& cached = minutes_[static_cast<std::size_t>(minute) % minutes_.size()];
+    if (cached.minute != minute) {
+        std::tm local{};
+        if (!toLocalTime(static_cast<std::time_t>(minute * 60), local)) {
+            return append("N/A");
+        }
+        const int length = std::snprintf(cached.text, sizeof(cached.text), "%04d-%02d-%02d %02d:%02d",
+                                         local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour,
+                                         local.tm_min);
+        cached.length = length > 0 ? static_cast<std::size_t>(length) : 0;
+        cached.minute = minute;
+    }
+    buffer_.append(cached.text, cached.length);
+    return *this;
+}
+
+RowFormatter& RowFormatter::truncate(std::size_t max_bytes) {
+    static constexpr std::string_view kEllipsis = "\xE2\x80\xA6";
+    if (buffer_.size() <= max_bytes) {
+        return *this;
+    }
+    std::size_t length = max_bytes > kEllipsis.size() ? max_bytes - kEllipsis.size() : 0;
+    // Step back over UTF-8 continuation bytes so no character is split.
+    while (length > 0 && (static_cast<unsigned char>(buffer_[length]) & 0xC0) == 0x80) {
+        --length;
+    }
+    buffer_.resize(length);
+    return append(kEllipsis);
+}
+
+RowFormatter& RowFormatter::appendContentPreview(const td::td_api::MessageContent* content) {
+    if (!content) {
+        return append("No messages");
+    }
+    switch (content->get_id()) {
+        case td::td_api::messageText::ID:
+            return append(static_cast<const td::td_api::messageText*>(content)->text_->text_);
+        case td::td_api::messageChatChangeTitle::ID:
+            return append("Title changed to ")
+                .append(static_cast<const td::td_api::messageChatChangeTitle*>(content)->title_);
+        default: {
+            const auto label = findLabel(kPreviewLabels, content->get_id());
+            return append(label.empty() ? std::string_view("[Unsupported message]") : label);
+        }
+    }
+}
+
+RowFormatter& RowFormatter::appendContent(const td::td_api::MessageContent* content) {
+    if (!content) {
+        return append("[Empty message]");
+    }
+    if (content->get_id() == td::td_api::messageText::ID) {
+        return append(static_cast<const td::td_api::messageText*>(content)->text_->text_);
+    }
+
+    const auto type = findLabel(kContentTypeLabels, content->get_id());
+    if (type.empty()) {
+        return append("Other, Unsupported content");
+    }
+    append(type);
+
+    const std::string* detail = nullptr;
+    switch (content->get_id()) {
+        case td::td_api::messageVoiceNote::ID: {
+            auto* voice = static_cast<const td::td_api::messageVoiceNote*>(content);
+            if (voice->voice_note_) {
+                return append(", ").appendNumber(voice->voice_note_->duration_).append(" seconds");
+            }
+            break;
+        }
+        case td::td_api::messageDocument::ID: {
+            auto* doc = static_cast<const td::td_api::messageDocument*>(content);
+            if (doc->document_ && !doc->document_->file_name_.empty()) {
+                detail = &doc->document_->file_name_;
+            }
+            break;
+        }
+        case td::td_api::messagePhoto::ID:
+            detail = captionOf(static_cast<const td::td_api::messagePhoto*>(content)->caption_);
+            break;
+        case td::td_api::messageVideo::ID:
+            detail = captionOf(static_cast<const td::td_api::messageVideo*>(content)->caption_);
+            break;
+        case td::td_api::messageChatChangeTitle::ID:
+            return append(", Title changed to ")
+                .append(static_cast<const td::td_api::messageChatChangeTitle*>(content)->title_);
+        default:
+            break;
+    }
+    if (detail) {
+        append(", ").append(*detail);
+    }
+    return *this;
+}
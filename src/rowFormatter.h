@@ -0,0 +1,53 @@
+#ifndef ROW_FORMATTER_H
+#define ROW_FORMATTER_H
+
+#include "utf8Codec.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <td/telegram/td_api.h>
+
+// Builds the text of one list row in a reusable UTF-8 buffer and converts it to wxString once, at the end, instead
+// of going through a temporary wxString per piece. Timestamps come from a per-minute cache and content labels from
+// a constant table, so formatting a row normally allocates nothing but the final wxString.
+// One instance per thread; the UI thread owns the one that formats the lists.
+class RowFormatter {
+  public:
+    RowFormatter& begin() {
+        buffer_.clear();
+        return *this;
+    }
+    RowFormatter& append(std::string_view text) {
+        buffer_.append(text.data(), text.size());
+        return *this;
+    }
+    RowFormatter& appendNumber(std::int64_t value);
+    // "YYYY-MM-DD HH:MM" in local time, or "N/A" for a zero time.
+    RowFormatter& appendTimestamp(std::int64_t unix_time);
+    // Short form for the chat list: the text itself or a bracketed label.
+    RowFormatter& appendContentPreview(const td::td_api::MessageContent* content);
+    // Long form for the message view: the content type followed by its details.
+    RowFormatter& appendContent(const td::td_api::MessageContent* content);
+
+    // Cuts the text to at most max_bytes at a character boundary, ending it with an ellipsis if anything was cut.
+    RowFormatter& truncate(std::size_t max_bytes);
+
+    std::string_view view() const { return buffer_; }
+    wxString finish() const { return utf8ToWxString(buffer_); }
+
+  private:
+    struct CachedMinute {
+        std::int64_t minute{-1};
+        char text[24];
+        std::size_t length{0};
+    };
+
+    // Direct-mapped by minute; a page of messages or a chat list touches only a few distinct minutes per slot.
+    std::array<CachedMinute, 256> minutes_{};
+    std::string buffer_;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include "stringPool.h"
+
+#include <cstring>
+
+StringPool::StringPool() {
+    entries_.emplace_back();
+}
+
+StringPool::Id StringPool::intern(std::string_view text) {
+    if (text.empty()) {
+        return kEmpty;
+    }
+    auto it = ids_.find(text);
+    if (it != ids_.end()) {
+        return it->second;
+    }
+    const std::string_view stored = store(text);
+    const Id id = static_cast<Id>(entries_.size());
+    entries_.push_back(stored);
+    ids_.emplace(stored, id);
+    return id;
+}
+
+std::string_view StringPool::store(std::string_view text) {
+    char* destination = nullptr;
+    if (text.size() > kChunkSize / 4) {
+        // Long strings get a chunk of their own, so they do not waste the rest of the shared one.
+        chunks_.push_back(std::make_unique<char[]>(text.size()));
+        destination = chunks_.back().get();
+    } else {
+        if (!chunk_ || chunk_used_ + text.size() > kChunkSize) {
+            chunks_.push_back(std::make_unique<char[]>(kChunkSize));
+            chunk_ = chunks_.back().get();
+            chunk_used_ = 0;
+        }
+        destination = chunk_ + chunk_used_;
+        chunk_used_ += text.size();
+    }
+    std::memcpy(destination, text.data(), text.size());
+    bytes_ += text.size();
+    return std::string_view(destination, text.size());
+}
@@ -0,0 +1,47 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Interned strings for names and titles. Each distinct string is stored once in large chunks and referred to by a
+// 32-bit id, so a hundred thousand users named "Alex" cost one copy of the name and four bytes each.
+// Strings are never released: names change rarely, and a renamed user's old name costs only its bytes.
+// Used from one thread.
+class StringPool {
+  public:
+    using Id = std::uint32_t;
+    // The empty string, which every pool has without interning it.
+    static constexpr Id kEmpty = 0;
+
+    StringPool();
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    Id intern(std::string_view text);
+    std::string_view view(Id id) const { return entries_[id]; }
+
+    // Bytes held for the strings themselves, for diagnostics.
+    std::size_t getBytes() const { return bytes_; }
+    std::size_t size() const { return entries_.size(); }
+
+  private:
+    static constexpr std::size_t kChunkSize = 64 * 1024;
+
+    std::string_view store(std::string_view text);
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    // The chunk short strings are appended to.
+    char* chunk_{nullptr};
+    std::size_t chunk_used_{0};
+    std::size_t bytes_{0};
+    std::vector<std::string_view> entries_;
+    // Keys point into the chunks, which never move.
+    std::unordered_map<std::string_view, Id> ids_;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "taskPool.h"
+
+TaskPool::TaskPool(std::size_t threads) {
+    threads_.reserve(threads == 0 ? 1 : threads);
+    for (std::size_t i = 0; i < (threads == 0 ? 1 : threads); ++i) {
+        threads_.emplace_back(&TaskPool::run, this);
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        tasks_.clear();
+    }
+    wakeup_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void TaskPool::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        tasks_.push_back(std::move(task));
+    }
+    wakeup_.notify_one();
+}
+
+void TaskPool::run() {
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeup_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running posted tasks in FIFO order. Tasks still queued at destruction are dropped.
+class TaskPool {
+  public:
+    using Task = std::function<void()>;
+
+    explicit TaskPool(std::size_t threads);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    void post(Task task);
+
+  private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::deque<Task> tasks_;
+    bool stopping_{false};
+    std::vector<std::thread> threads_;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef TD_FUTURE_H
+#define TD_FUTURE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <td/telegram/td_api.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Outcome of a typed request: either the concrete td_api result or the error TDLib returned instead.
+template <class T> struct TdResult {
+    td::td_api::object_ptr<T> value;
+    td::td_api::object_ptr<td::td_api::error> error;
+
+    bool isOk() const { return static_cast<bool>(value); }
+    T* operator->() const { return value.get(); }
+};
+
+template <class V> class TdFuture;
+template <class V> class TdPromise;
+
+namespace TdFutureDetail {
+
+template <class V> class State {
+  public:
+    void set(V value) {
+        std::unique_ptr<Continuation> continuation;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!continuation_) {
+                value_.emplace(std::move(value));
+                return;
+            }
+            continuation = std::move(continuation_);
+        }
+        continuation->run(std::move(value));
+    }
+
+    template <class F> void subscribe(F&& f) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!value_) {
+                continuation_ = std::make_unique<ContinuationImpl<std::decay_t<F>>>(std::forward<F>(f));
+                return;
+            }
+        }
+        V value = std::move(*value_);
+        value_.reset();
+        f(std::move(value));
+    }
+
+  private:
+    // Type-erased like std::function, but continuations may own move-only state such as td_api objects.
+    struct Continuation {
+        virtual ~Continuation() = default;
+        virtual void run(V value) = 0;
+    };
+
+    template <class F> struct ContinuationImpl final : Continuation {
+        explicit ContinuationImpl(F&& fn) : f(std::move(fn)) {}
+        explicit ContinuationImpl(const F& fn) : f(fn) {}
+        void run(V value) override { f(std::move(value)); }
+        F f;
+    };
+
+    std::mutex mutex_;
+    std::optional<V> value_;
+    std::unique_ptr<Continuation> continuation_;
+};
+
+template <class T> struct IsFuture : std::false_type {};
+template <class V> struct IsFuture<TdFuture<V>> : std::true_type {};
+
+template <class P> struct Pointee;
+template <class T> struct Pointee<td::td_api::object_ptr<T>> {
+    using type = T;
+};
+
+} // namespace TdFutureDetail
+
+// Result type of a td_api::Function, whose ReturnType is object_ptr<Result>.
+template <class Function> using TdReturnTypeOf = typename TdFutureDetail::Pointee<typename Function::ReturnType>::type;
+template <class Function> using TdResultOf = TdResult<TdReturnTypeOf<Function>>;
+
+// Single-shot, single-consumer future. The continuation runs on whichever thread fulfils the promise, or
+// immediately if the value is already there.
+template <class V> class TdFuture {
+  public:
+    using ValueType = V;
+
+    // f(V) may return void (end of chain), a plain value (wrapped in a new future) or another TdFuture
+    // (flattened), so dependent requests read as a flat sequence of then() calls.
+    template <class F> auto then(F&& f) {
+        using R = std::invoke_result_t<std::decay_t<F>&, V>;
+        if constexpr (std::is_void_v<R>) {
+            state_->subscribe(std::forward<F>(f));
+        } else if constexpr (TdFutureDetail::IsFuture<R>::value) {
+            using U = typename R::ValueType;
+            TdPromise<U> promise;
+            auto future = promise.getFuture();
+            state_->subscribe([fn = std::forward<F>(f), promise = std::move(promise)](V value) mutable {
+                fn(std::move(value)).then([promise = std::move(promise)](U inner) mutable {
+                    promise.setValue(std::move(inner));
+                });
+            });
+            return future;
+        } else {
+            TdPromise<R> promise;
+            auto future = promise.getFuture();
+            state_->subscribe([fn = std::forward<F>(f), promise = std::move(promise)](V value) mutable {
+                promise.setValue(fn(std::move(value)));
+            });
+            return future;
+        }
+    }
+
+  private:
+    friend class TdPromise<V>;
+    explicit TdFuture(std::shared_ptr<TdFutureDetail::State<V>> state) : state_(std::move(state)) {}
+
+    std::shared_ptr<TdFutureDetail::State<V>> state_;
+};
+
+template <class V> class TdPromise {
+  public:
+    TdPromise() : state_(std::make_shared<TdFutureDetail::State<V>>()) {}
+
+    TdFuture<V> getFuture() const { return TdFuture<V>(state_); }
+    void setValue(V value) { state_->set(std::move(value)); }
+
+  private:
+    std::shared_ptr<TdFutureDetail::State<V>> state_;
+};
+
+template <class V> TdFuture<V> makeReadyFuture(V value) {
+    TdPromise<V> promise;
+    promise.setValue(std::move(value));
+    return promise.getFuture();
+}
+
+// Resolves once every future has; results keep the order of the inputs. All requests are already in flight when
+// this is called, so they are serviced together rather than one after another.
+template <class V> TdFuture<std::vector<V>> whenAll(std::vector<TdFuture<V>> futures) {
+    struct Shared {
+        std::vector<std::optional<V>> results;
+        std::atomic<size_t> remaining;
+        TdPromise<std::vector<V>> promise;
+    };
+
+    if (futures.empty()) {
+        return makeReadyFuture(std::vector<V>());
+    }
+
+    auto shared = std::make_shared<Shared>();
+    shared->results.resize(futures.size());
+    shared->remaining = futures.size();
+    auto result = shared->promise.getFuture();
+
+    for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].then([shared, i](V value) {
+            shared->results[i].emplace(std::move(value));
+            if (shared->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::vector<V> values;
+                values.reserve(shared->results.size());
+                for (auto& slot : shared->results) {
+                    values.push_back(std::move(*slot));
+                }
+                shared->promise.setValue(std::move(values));
+            }
+        });
+    }
+    return result;
+}
+
+namespace TdFutureDetail {
+
+template <size_t... Is, class... Vs>
+TdFuture<std::tuple<Vs...>> whenAllTuple(std::index_sequence<Is...>, TdFuture<Vs>... futures) {
+    struct Shared {
+        std::tuple<std::optional<Vs>...> results;
+        std::atomic<size_t> remaining{sizeof...(Vs)};
+        TdPromise<std::tuple<Vs...>> promise;
+
+        void finishOne() {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                promise.setValue(std::tuple<Vs...>(std::move(*std::get<Is>(results))...));
+            }
+        }
+    };
+
+    auto shared = std::make_shared<Shared>();
+    auto result = shared->promise.getFuture();
+    (futures.then([shared](Vs value) {
+        std::get<Is>(shared->results).emplace(std::move(value));
+        shared->finishOne();
+    }),
+     ...);
+    return result;
+}
+
+} // namespace TdFutureDetail
+
+// Heterogeneous variant: whenAll(request(getUser), request(getChat)) yields a tuple of both results.
+template <class... Vs> TdFuture<std::tuple<Vs...>> whenAll(TdFuture<Vs>... futures) {
+    return TdFutureDetail::whenAllTuple(std::index_sequence_for<Vs...>(), std::move(futures)...);
+}
+
+#endif
@@ -1,79 +1,460 @@
 #include "tdManager.h"
 
+#include <algorithm>
 #include <atomic>
 
-TdManager::TdManager() : client_manager_(std::make_unique<td::ClientManager>()), running_(true) {
-    client_id_ = client_manager_->create_client_id();
-    worker_thread_ = std::thread(&TdManager::run, this);
+namespace {
+std::uint64_t replayKey(std::int32_t client_id, std::int32_t function_id) {
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(client_id)) << 32) |
+           static_cast<std::uint32_t>(function_id);
 }
 
+// While requests with a deadline are pending the receive loop, or the replay thread, wakes at least this often to
+// expire them.
+constexpr double kExpiryCheckInterval = 0.25;
+constexpr auto kExpiryCheckPeriod =
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::duration<double>(kExpiryCheckInterval));
+constexpr double kIdleReceiveTimeout = 10.0;
+} // namespace
+
+TdManager::TdManager() : client_manager_(std::make_unique<td::ClientManager>()), running_(true) {}
+
 TdManager::~TdManager() {
-    running_ = false;
-    send(td::td_api::make_object<td::td_api::close>());
+    shutdown();
+}
+
+void TdManager::shutdown() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    std::vector<std::int32_t> client_ids;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        client_ids = client_ids_;
+    }
+    for (auto client_id : client_ids) {
+        send(client_id, td::td_api::make_object<td::td_api::close>(), nullptr, Priority::Interactive);
+    }
+    {
+        std::lock_guard<std::mutex> lock(replay_mutex_);
+        replay_wakeup_ = true;
+    }
+    replay_cv_.notify_all();
+    if (replay_thread_.joinable()) {
+        replay_thread_.join();
+    }
     if (worker_thread_.joinable()) {
         worker_thread_.join();
     }
 }
 
-void TdManager::send(td::td_api::object_ptr<td::td_api::Function> function, UpdateCallback callback) {
-    auto query_id = nextQueryId();
-    if (callback) {
-        std::lock_guard<std::mutex> lock(handlers_mutex_);
-        handlers_.emplace(query_id, std::move(callback));
+std::int32_t TdManager::createClient() {
+    auto client_id = replay_reader_ ? replay_next_client_id_++ : client_manager_->create_client_id();
+    // The receive loop starts with the first TDLib client. A replay has none: the replay thread feeds the batches,
+    // and a loop waiting in receive() for a client that never answers would hold up shutdown by its idle timeout.
+    if (!replay_reader_ && !worker_thread_.joinable()) {
+        worker_thread_ = std::thread(&TdManager::run, this);
     }
-    if (client_manager_) {
-        client_manager_->send(client_id_, query_id, std::move(function));
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    client_ids_.push_back(client_id);
+    return client_id;
+}
+
+void TdManager::destroyClient(std::int32_t client_id) {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    client_ids_.erase(std::remove(client_ids_.begin(), client_ids_.end(), client_id), client_ids_.end());
+}
+
+TdManager::RequestHandle TdManager::send(std::int32_t client_id,
+                                         td::td_api::object_ptr<td::td_api::Function> function,
+                                         UpdateCallback callback, Priority priority,
+                                         std::chrono::milliseconds timeout, Executor executor) {
+    PendingTable::Clock::time_point deadline;
+    if (timeout > std::chrono::milliseconds::zero()) {
+        deadline = PendingTable::Clock::now() + timeout;
     }
+
+    if (callback && executor == Executor::Pool) {
+        // The hop happens here so call sites never have to marshal results back themselves. Ui callbacks make theirs
+        // when the response arrives, in deliver().
+        auto target = std::make_shared<UpdateCallback>(std::move(callback));
+        callback = [this, target](Object object) {
+            auto result = std::make_shared<Object>(std::move(object));
+            post(Executor::Pool, [target, result]() { (*target)(std::move(*result)); });
+        };
+    }
+
+    // Requests without a callback take a slot too, so every function's latency is measured. Only when the table is
+    // full does a fire-and-forget request go out untracked.
+    const bool has_callback = static_cast<bool>(callback);
+    PendingRequest request{std::move(callback), function ? function->get_id() : 0, PendingTable::Clock::now(),
+                           client_id, executor};
+    std::uint64_t query_id = pending_.acquire(std::move(request), deadline);
+    if (query_id == 0) {
+        if (has_callback) {
+            // The table only runs out when thousands of requests are stuck; fail this one instead of growing.
+            auto target = std::make_shared<UpdateCallback>(std::move(request.callback));
+            post(executor == Executor::Ui ? Executor::Ui : Executor::Inline, [target]() {
+                (*target)(td::td_api::make_object<td::td_api::error>(429, "Too many pending requests"));
+            });
+            return {};
+        }
+        query_id = nextUntrackedQueryId();
+    }
+    const RequestHandle handle{PendingTable::isTracked(query_id) ? query_id : 0};
+
+    // Untracked requests bypass the lanes: nothing would release their lane slot, since their response has no owner.
+    if (priority == Priority::Interactive || !handle) {
+        transmit(client_id, query_id, std::move(function));
+        return handle;
+    }
+
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    const auto lane = laneOf(priority);
+    QueuedRequest queued_request{client_id, query_id, std::move(function)};
+    if (queued_[lane].empty() && in_flight_[lane] < max_in_flight_[lane]) {
+        sendInLane(lane, std::move(queued_request));
+    } else {
+        queued_[lane].push_back(std::move(queued_request));
+    }
+    return handle;
+}
+
+bool TdManager::cancel(RequestHandle handle) {
+    return handle && pending_.cancel(handle.query_id);
+}
+
+bool TdManager::isPending(RequestHandle handle) const {
+    return handle && pending_.isPending(handle.query_id);
 }
 
-void TdManager::setUpdateCallback(UpdateCallback callback) {
+void TdManager::setUpdateBatchCallback(UpdateBatchCallback callback) {
     std::lock_guard<std::mutex> lock(update_mutex_);
-    update_callback_ = std::move(callback);
+    update_batch_callback_ = std::move(callback);
+}
+
+void TdManager::setBatchLimits(std::size_t max_updates, std::chrono::microseconds max_latency) {
+    batch_max_updates_ = max_updates == 0 ? 1 : max_updates;
+    batch_max_latency_us_ = max_latency.count();
+}
+
+bool TdManager::startRecording(const std::string& path) {
+    auto recorder = std::make_unique<UpdateTraceWriter>();
+    if (!recorder->open(path)) {
+        return false;
+    }
+    recording_start_ = PendingTable::Clock::now();
+    recorder_ = std::move(recorder);
+    return true;
+}
+
+bool TdManager::openReplay(const std::string& path) {
+    auto reader = std::make_unique<UpdateTraceReader>();
+    if (!reader->open(path)) {
+        return false;
+    }
+    replay_reader_ = std::move(reader);
+    return true;
+}
+
+void TdManager::startReplay(double speed) {
+    if (replay_reader_ && !replay_thread_.joinable()) {
+        replay_thread_ = std::thread(&TdManager::replay, this, speed);
+    }
+}
+
+void TdManager::setUiExecutor(UiExecutor executor) {
+    std::lock_guard<std::mutex> lock(executor_mutex_);
+    ui_executor_ = std::move(executor);
+}
+
+void TdManager::setPriorityLimits(std::size_t normal_in_flight, std::size_t background_in_flight) {
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    max_in_flight_[laneOf(Priority::Normal)] = normal_in_flight == 0 ? 1 : normal_in_flight;
+    max_in_flight_[laneOf(Priority::Background)] = background_in_flight == 0 ? 1 : background_in_flight;
+    for (std::size_t lane = 0; lane < kThrottledLanes; ++lane) {
+        dispatchQueued(lane);
+    }
+}
+
+TdManager::LaneStats TdManager::getLaneStats(Priority priority) {
+    if (priority == Priority::Interactive) {
+        return {0, 0};
+    }
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    const auto lane = laneOf(priority);
+    return {in_flight_[lane], queued_[lane].size()};
 }
 
 void TdManager::run() {
+    UpdateBatch batch;
     while (running_) {
-        auto response = client_manager_->receive(10.0);
+        double timeout = pending_.pendingWithDeadline() > 0 ? kExpiryCheckInterval : kIdleReceiveTimeout;
+        auto response = client_manager_->receive(timeout);
         if (response.object) {
-            processResponse(std::move(response));
+            const auto max_updates = batch_max_updates_.load(std::memory_order_relaxed);
+            const auto batch_deadline =
+                std::chrono::steady_clock::now() +
+                std::chrono::microseconds(batch_max_latency_us_.load(std::memory_order_relaxed));
+
+            processResponse(std::move(response), batch);
+            while (batch.size() < max_updates && std::chrono::steady_clock::now() < batch_deadline) {
+                response = client_manager_->receive(0);
+                if (!response.object) {
+                    break;
+                }
+                processResponse(std::move(response), batch);
+            }
+            flushUpdates(batch);
         }
+        expireRequests();
     }
 }
 
-void TdManager::processResponse(td::ClientManager::Response response) {
+void TdManager::processResponse(td::ClientManager::Response response, UpdateBatch& batch) {
     if (response.request_id == 0) {
-        processUpdate(std::move(response.object));
+        processUpdate(response.client_id, std::move(response.object), batch);
     } else {
-        UpdateCallback handler;
-        {
-            std::lock_guard<std::mutex> lock(handlers_mutex_);
-            auto it = handlers_.find(response.request_id);
-            if (it != handlers_.end()) {
-                handler = std::move(it->second);
-                handlers_.erase(it);
-            }
+        releaseLane(response.request_id);
+        PendingRequest request;
+        if (!pending_.complete(response.request_id, request)) {
+            return;
         }
-        if (handler) {
-            handler(std::move(response.object));
+        const bool is_error = response.object && response.object->get_id() == td::td_api::error::ID;
+        if (recorder_ && response.object) {
+            recorder_->write(UpdateTraceRecord::RESPONSE, recordingTime(), response.client_id, request.function_id,
+                             *response.object);
         }
+        metrics_.recordResponse(request.function_id, PendingTable::Clock::now() - request.sent_at, is_error);
+        deliver(request, std::move(response.object), batch);
     }
 }
 
-void TdManager::processUpdate(Object update) {
-    if (update->get_id() == td::td_api::updateAuthorizationState::ID) {
-        auto* auth_update = static_cast<td::td_api::updateAuthorizationState*>(update.get());
-        if (auth_update->authorization_state_->get_id() == td::td_api::authorizationStateClosed::ID) {
-            running_ = false;
+void TdManager::processUpdate(std::int32_t client_id, Object update, UpdateBatch& batch) {
+    if (update) {
+        metrics_.recordUpdate(update->get_id());
+        if (recorder_) {
+            recorder_->write(UpdateTraceRecord::UPDATE, recordingTime(), client_id, 0, *update);
         }
     }
+    batch.push_back({client_id, std::move(update)});
+}
 
+void TdManager::flushUpdates(UpdateBatch& batch) {
+    if (batch.empty()) {
+        return;
+    }
     std::lock_guard<std::mutex> lock(update_mutex_);
-    if (update_callback_) {
-        update_callback_(std::move(update));
+    if (update_batch_callback_) {
+        update_batch_callback_(std::move(batch));
+    }
+    batch.clear();
+}
+
+void TdManager::expireRequests() {
+    if (pending_.pendingWithDeadline() == 0) {
+        return;
+    }
+    auto now = PendingTable::Clock::now();
+    if (now < next_expiry_check_) {
+        return;
+    }
+    next_expiry_check_ = now + std::chrono::duration_cast<PendingTable::Clock::duration>(
+                                   std::chrono::duration<double>(kExpiryCheckInterval));
+
+    std::vector<PendingRequest> expired;
+    pending_.collectExpired(now, expired);
+    UpdateBatch batch;
+    for (auto& request : expired) {
+        metrics_.recordTimeout(request.function_id);
+        deliver(request, td::td_api::make_object<td::td_api::error>(kTimeoutErrorCode, "Request timed out"), batch);
+    }
+    flushUpdates(batch);
+}
+
+void TdManager::deliver(PendingRequest& request, Object object, UpdateBatch& batch) {
+    if (!request.callback) {
+        return;
+    }
+    if (request.executor == Executor::Ui) {
+        auto target = std::make_shared<UpdateCallback>(std::move(request.callback));
+        auto result = std::make_shared<Object>(std::move(object));
+        batch.push_back({request.client_id, nullptr, [target, result]() { (*target)(std::move(*result)); }});
+        return;
+    }
+    // Updates received before this response are handed over first, so the callback never runs ahead of them.
+    flushUpdates(batch);
+    request.callback(std::move(object));
+}
+
+void TdManager::post(Executor executor, std::function<void()> task) {
+    if (executor == Executor::Pool) {
+        pool_.post(std::move(task));
+        return;
+    }
+    if (executor == Executor::Inline) {
+        task();
+        return;
+    }
+    UiExecutor ui_executor;
+    {
+        std::lock_guard<std::mutex> lock(executor_mutex_);
+        ui_executor = ui_executor_;
+    }
+    // Without an executor the UI is gone or going, and running the task here would touch its state from the TDLib
+    // thread.
+    if (ui_executor) {
+        ui_executor(std::move(task));
+    }
+}
+
+void TdManager::releaseLane(std::uint64_t query_id) {
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    auto it = lane_of_query_.find(query_id);
+    if (it == lane_of_query_.end()) {
+        return;
+    }
+    const auto lane = it->second;
+    lane_of_query_.erase(it);
+    --in_flight_[lane];
+    dispatchQueued(lane);
+}
+
+void TdManager::sendInLane(std::size_t lane, QueuedRequest request) {
+    ++in_flight_[lane];
+    lane_of_query_.emplace(request.query_id, lane);
+    transmit(request.client_id, request.query_id, std::move(request.function));
+}
+
+void TdManager::dispatchQueued(std::size_t lane) {
+    auto& queue = queued_[lane];
+    while (!queue.empty() && in_flight_[lane] < max_in_flight_[lane]) {
+        QueuedRequest request = std::move(queue.front());
+        queue.pop_front();
+        // Cancelled or timed out while it was waiting; TDLib never needs to see it.
+        if (pending_.isPending(request.query_id)) {
+            sendInLane(lane, std::move(request));
+        }
+    }
+}
+
+void TdManager::transmit(std::int32_t client_id, std::uint64_t query_id,
+                         td::td_api::object_ptr<td::td_api::Function> function) {
+    if (!replay_reader_) {
+        if (client_manager_) {
+            client_manager_->send(client_id, query_id, std::move(function));
+        }
+        return;
+    }
+    // Replaying: the request is answered from the trace. Untracked requests have nobody waiting for an answer.
+    if (function && PendingTable::isTracked(query_id)) {
+        std::lock_guard<std::mutex> lock(replay_mutex_);
+        replay_waiting_[replayKey(client_id, function->get_id())].push_back(query_id);
+        replay_wakeup_ = true;
+    }
+    replay_cv_.notify_all();
+}
+
+std::chrono::microseconds TdManager::recordingTime() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(PendingTable::Clock::now() - recording_start_);
+}
+
+void TdManager::replay(double speed) {
+    std::vector<std::int32_t> clients;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients = client_ids_;
+    }
+    // Recorded client ids are assigned to our clients in order of first appearance.
+    std::unordered_map<std::int32_t, std::int32_t> client_map;
+    std::unordered_map<std::uint64_t, std::deque<Object>> responses;
+    UpdateBatch batch;
+    UpdateTraceRecord record;
+    bool has_record = replay_reader_->next(record);
+    const auto start = PendingTable::Clock::now();
+
+    while (running_) {
+        // There is no receive loop while replaying, so request deadlines are checked here.
+        expireRequests();
+        answerReplayRequests(responses, !has_record, batch);
+        if (!has_record) {
+            flushUpdates(batch);
+            std::unique_lock<std::mutex> lock(replay_mutex_);
+            if (pending_.pendingWithDeadline() == 0) {
+                replay_cv_.wait(lock, [this]() { return replay_wakeup_; });
+            } else {
+                replay_cv_.wait_until(lock, nextReplayWakeup(PendingTable::Clock::now() + kExpiryCheckPeriod),
+                                      [this]() { return replay_wakeup_; });
+            }
+            replay_wakeup_ = false;
+            continue;
+        }
+        if (speed > 0) {
+            const auto due = start + std::chrono::duration_cast<PendingTable::Clock::duration>(
+                                         std::chrono::duration<double, std::micro>(record.time.count() / speed));
+            if (PendingTable::Clock::now() < due) {
+                flushUpdates(batch);
+                std::unique_lock<std::mutex> lock(replay_mutex_);
+                replay_cv_.wait_until(lock, nextReplayWakeup(due), [this]() { return replay_wakeup_; });
+                replay_wakeup_ = false;
+                continue;
+            }
+        }
+
+        auto mapped = client_map.find(record.client_id);
+        if (mapped == client_map.end() && client_map.size() < clients.size()) {
+            mapped = client_map.emplace(record.client_id, clients[client_map.size()]).first;
+        }
+        if (mapped != client_map.end()) {
+            if (record.kind == UpdateTraceRecord::UPDATE) {
+                processUpdate(mapped->second, std::move(record.object), batch);
+            } else {
+                responses[replayKey(mapped->second, record.function_id)].push_back(std::move(record.object));
+            }
+        }
+        if (batch.size() >= batch_max_updates_.load(std::memory_order_relaxed)) {
+            flushUpdates(batch);
+        }
+        has_record = replay_reader_->next(record);
+    }
+    flushUpdates(batch);
+}
+
+TdManager::PendingTable::Clock::time_point TdManager::nextReplayWakeup(PendingTable::Clock::time_point due) const {
+    if (pending_.pendingWithDeadline() == 0) {
+        return due;
+    }
+    return std::min(due, PendingTable::Clock::now() + kExpiryCheckPeriod);
+}
+
+void TdManager::answerReplayRequests(std::unordered_map<std::uint64_t, std::deque<Object>>& responses,
+                                     bool trace_ended, UpdateBatch& batch) {
+    std::vector<td::ClientManager::Response> answers;
+    {
+        std::lock_guard<std::mutex> lock(replay_mutex_);
+        for (auto it = replay_waiting_.begin(); it != replay_waiting_.end();) {
+            auto& waiting = it->second;
+            auto& recorded = responses[it->first];
+            while (!waiting.empty() && (!recorded.empty() || trace_ended)) {
+                const auto client_id = static_cast<std::int32_t>(it->first >> 32);
+                Object object = recorded.empty()
+                                    ? td::td_api::make_object<td::td_api::error>(404, "Response not in the trace")
+                                    : std::move(recorded.front());
+                if (!recorded.empty()) {
+                    recorded.pop_front();
+                }
+                answers.push_back({client_id, waiting.front(), std::move(object)});
+                waiting.pop_front();
+            }
+            it = waiting.empty() ? replay_waiting_.erase(it) : std::next(it);
+        }
+    }
+    for (auto& answer : answers) {
+        processResponse(std::move(answer), batch);
     }
 }
 
-std::uint64_t TdManager::nextQueryId() {
+std::uint64_t TdManager::nextUntrackedQueryId() {
     static std::atomic<std::uint64_t> current_query_id_{0};
-    return ++current_query_id_;
+    return PendingTable::kUntrackedBit | ++current_query_id_;
 }
@@ -1,44 +1,253 @@
 #ifndef TD_MANAGER_H
 #define TD_MANAGER_H
 
+#include "pendingRequestTable.h"
+#include "requestMetrics.h"
+#include "taskPool.h"
+#include "tdFuture.h"
+#include "updateTrace.h"
+
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
-#include <map>
 #include <memory>
 #include <mutex>
 #include <td/telegram/Client.h>
 #include <td/telegram/td_api.h>
 #include <td/telegram/td_api.hpp>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 class TdManager {
   public:
     using Object = td::td_api::object_ptr<td::td_api::Object>;
+    // Where a response callback runs. Inline runs it on the TDLib thread as soon as the response arrives, Ui queues
+    // it behind the updates received before it and runs it where the update batch is drained, and Pool runs it on a
+    // small worker pool. Timeouts and rejections reach the callback through the same executor.
+    enum class Executor : unsigned char {
+        Inline,
+        Ui,
+        Pool
+    };
+    using UiExecutor = std::function<void(std::function<void()>)>;
     using UpdateCallback = std::function<void(Object)>;
+    // An update together with the TDLib client (account) it belongs to. Responses for Ui callbacks travel in the
+    // same stream as `task` with no object, so the UI sees them after every update TDLib sent before them.
+    struct Update {
+        std::int32_t client_id;
+        Object object;
+        std::function<void()> task;
+    };
+    using UpdateBatch = std::vector<Update>;
+    using UpdateBatchCallback = std::function<void(UpdateBatch)>;
+    // What the pending table keeps per query id: the callback plus what is needed to time the request.
+    struct PendingRequest {
+        UpdateCallback callback;
+        std::int32_t function_id{0};
+        std::chrono::steady_clock::time_point sent_at;
+        std::int32_t client_id{0};
+        Executor executor{Executor::Inline};
+    };
+    using RequestStats = PendingRequestTable<PendingRequest>::Counters;
+
+    // Identifies a sent request so it can be cancelled before its response arrives.
+    struct RequestHandle {
+        std::uint64_t query_id{0};
+        explicit operator bool() const { return query_id != 0; }
+    };
+
+    // Interactive requests go out immediately. Normal and background requests wait in their lane once the lane has
+    // as many requests in flight as its limit allows, so a burst of background lookups cannot delay user actions.
+    enum class Priority : unsigned char {
+        Interactive,
+        Normal,
+        Background
+    };
+
+
+    struct LaneStats {
+        std::size_t in_flight;
+        std::size_t queued;
+    };
+
+    // Error code passed to callbacks whose request outlived its timeout.
+    static constexpr std::int32_t kTimeoutErrorCode = 408;
 
     TdManager();
     ~TdManager();
 
-    void send(td::td_api::object_ptr<td::td_api::Function> function, UpdateCallback callback = nullptr);
-    void setUpdateCallback(UpdateCallback callback);
+    // Sends close to every client and stops the receive and replay threads, so nothing is delivered afterwards.
+    // The destructor does the same; owners call it earlier when state the callbacks reach goes away first.
+    void shutdown();
+
+    // Creates another TDLib instance served by the same receive loop. Each account owns one client id.
+    std::int32_t createClient();
+    // Forgets a client once it has reported authorizationStateClosed.
+    void destroyClient(std::int32_t client_id);
+
+    // A zero timeout waits for the response forever. When the timeout elapses first, the callback receives a
+    // td_api::error with kTimeoutErrorCode and the late response is dropped. Time spent queued in a lane counts.
+    RequestHandle send(std::int32_t client_id, td::td_api::object_ptr<td::td_api::Function> function,
+                       UpdateCallback callback = nullptr, Priority priority = Priority::Normal,
+                       std::chrono::milliseconds timeout = std::chrono::milliseconds::zero(),
+                       Executor executor = Executor::Inline);
+    // Returns false if the request has already completed, timed out or been cancelled.
+    bool cancel(RequestHandle handle);
+    // True until the request's response has been handed to its callback, or it timed out or was cancelled.
+    bool isPending(RequestHandle handle) const;
+    // Updates are collected while the receive queue is drained and handed over together, one call per batch.
+    void setUpdateBatchCallback(UpdateBatchCallback callback);
+    // A batch is closed when it holds max_updates updates or when max_latency has passed since its first response.
+    void setBatchLimits(std::size_t max_updates, std::chrono::microseconds max_latency);
+    // Runs a task on the UI thread, for Ui callbacks rejected before their request was sent; responses and timeouts
+    // go through the update batch instead. Tasks posted while none is installed are dropped.
+    void setUiExecutor(UiExecutor executor);
+    // How many normal and background requests TDLib may be working on at once.
+    void setPriorityLimits(std::size_t normal_in_flight, std::size_t background_in_flight);
+
+    // Writes every update and response from now on to a trace file (see updateTrace.h). Call before the first
+    // createClient().
+    bool startRecording(const std::string& path);
+    // Serves a recorded trace instead of TDLib. No TDLib clients are created; updates are fed through the normal
+    // batching path and each request is answered with the next recorded response to the same function. Call before
+    // the first createClient(), then startReplay() once the clients exist, so recorded client ids map onto them in
+    // order. A speed of 1 keeps the recorded pace, 0 replays as fast as the UI drains.
+    bool openReplay(const std::string& path);
+    void startReplay(double speed);
+
+    RequestStats getRequestStats() const { return pending_.counters(); }
+    const RequestMetrics& getMetrics() const { return metrics_; }
+    // Interactive requests are never held back, so only Normal and Background have lane stats.
+    LaneStats getLaneStats(Priority priority);
 
   private:
+    using PendingTable = PendingRequestTable<PendingRequest>;
+
+    struct QueuedRequest {
+        std::int32_t client_id;
+        std::uint64_t query_id;
+        td::td_api::object_ptr<td::td_api::Function> function;
+    };
+    static constexpr std::size_t kThrottledLanes = 2;
+    static std::size_t laneOf(Priority priority) { return static_cast<std::size_t>(priority) - 1; }
+
     void run();
-    void processResponse(td::ClientManager::Response response);
-    void processUpdate(Object update);
+    void processResponse(td::ClientManager::Response response, UpdateBatch& batch);
+    void processUpdate(std::int32_t client_id, Object update, UpdateBatch& batch);
+    void flushUpdates(UpdateBatch& batch);
+    void expireRequests();
+    // Runs or queues a completed request's callback. Ui callbacks join `batch`; any other callback runs only after
+    // the updates already in `batch` have been handed over.
+    void deliver(PendingRequest& request, Object object, UpdateBatch& batch);
+    void post(Executor executor, std::function<void()> task);
+    void releaseLane(std::uint64_t query_id);
+    void transmit(std::int32_t client_id, std::uint64_t query_id,
+                  td::td_api::object_ptr<td::td_api::Function> function);
+    std::chrono::microseconds recordingTime() const;
+    void replay(double speed);
+    // When the replay thread has to look at request deadlines again, at the latest `due`.
+    PendingTable::Clock::time_point nextReplayWakeup(PendingTable::Clock::time_point due) const;
+    void answerReplayRequests(std::unordered_map<std::uint64_t, std::deque<Object>>& responses, bool trace_ended,
+                              UpdateBatch& batch);
+    // Both expect scheduler_mutex_ to be held.
+    void sendInLane(std::size_t lane, QueuedRequest request);
+    void dispatchQueued(std::size_t lane);
 
-    std::uint64_t nextQueryId();
+    std::uint64_t nextUntrackedQueryId();
 
     std::unique_ptr<td::ClientManager> client_manager_;
-    std::int32_t client_id_;
+    std::vector<std::int32_t> client_ids_;
+    std::mutex clients_mutex_;
     std::atomic<bool> running_;
     std::thread worker_thread_;
 
-    UpdateCallback update_callback_;
-    std::map<std::uint64_t, UpdateCallback> handlers_;
-    std::mutex handlers_mutex_;
+    UpdateBatchCallback update_batch_callback_;
+    std::atomic<std::size_t> batch_max_updates_{256};
+    std::atomic<std::int64_t> batch_max_latency_us_{8000};
+    PendingTable pending_;
+    RequestMetrics metrics_;
+
+    std::mutex scheduler_mutex_;
+    std::array<std::deque<QueuedRequest>, kThrottledLanes> queued_;
+    std::array<std::size_t, kThrottledLanes> in_flight_{};
+    std::array<std::size_t, kThrottledLanes> max_in_flight_{32, 4};
+    // Lane of every throttled request TDLib has been given and not yet answered, cancelled ones included.
+    std::unordered_map<std::uint64_t, std::size_t> lane_of_query_;
+
+    std::unique_ptr<UpdateTraceWriter> recorder_;
+    PendingTable::Clock::time_point recording_start_;
+    std::unique_ptr<UpdateTraceReader> replay_reader_;
+    std::thread replay_thread_;
+    std::int32_t replay_next_client_id_{1};
+    std::mutex replay_mutex_;
+    std::condition_variable replay_cv_;
+    // Set when a request is waiting for an answer or the manager shuts down.
+    bool replay_wakeup_{false};
+    // Requests waiting for a recorded response, keyed by client and function (see replayKey).
+    std::unordered_map<std::uint64_t, std::deque<std::uint64_t>> replay_waiting_;
+    PendingTable::Clock::time_point next_expiry_check_;
     std::mutex update_mutex_;
+    UiExecutor ui_executor_;
+    std::mutex executor_mutex_;
+
+    // Declared last so it is destroyed first, before anything its queued callbacks could reach.
+    TaskPool pool_{2};
+};
+
+// One account's view of the shared TdManager: every request goes to that account's client id, and every callback
+// runs on the client's executor.
+class TdClient {
+  public:
+    TdClient(TdManager& manager, std::int32_t client_id,
+             TdManager::Executor executor = TdManager::Executor::Inline)
+        : manager_(manager), client_id_(client_id), executor_(executor) {}
+
+    TdManager::RequestHandle send(td::td_api::object_ptr<td::td_api::Function> function,
+                                  TdManager::UpdateCallback callback = nullptr,
+                                  TdManager::Priority priority = TdManager::Priority::Normal,
+                                  std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+        return manager_.send(client_id_, std::move(function), std::move(callback), priority, timeout, executor_);
+    }
+    bool cancel(TdManager::RequestHandle handle) { return manager_.cancel(handle); }
+
+    // Typed variant of send: the future yields the function's concrete result type or the error. The future is
+    // fulfilled on the client's executor, so continuations attached before the response arrives run there too.
+    // Independent requests can be issued back to back and joined with whenAll().
+    template <class Function>
+    TdFuture<TdResultOf<Function>> request(td::td_api::object_ptr<Function> function,
+                                           TdManager::Priority priority = TdManager::Priority::Normal,
+                                           std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+        TdPromise<TdResultOf<Function>> promise;
+        auto future = promise.getFuture();
+        send(std::move(function), fulfil<Function>(std::move(promise)), priority, timeout);
+        return future;
+    }
+
+    // Response callback that converts the raw object into Function's typed result and fulfils the promise with it.
+    template <class Function> static TdManager::UpdateCallback fulfil(TdPromise<TdResultOf<Function>> promise) {
+        return [promise = std::move(promise)](TdManager::Object object) mutable {
+            TdResultOf<Function> result;
+            if (object && object->get_id() == td::td_api::error::ID) {
+                result.error = td::td_api::move_object_as<td::td_api::error>(object);
+            } else if (object) {
+                result.value = td::td_api::move_object_as<TdReturnTypeOf<Function>>(object);
+            }
+            promise.setValue(std::move(result));
+        };
+    }
+
+    std::int32_t getClientId() const { return client_id_; }
+    TdManager& getManager() { return manager_; }
+
+  private:
+    TdManager& manager_;
+    std::int32_t client_id_;
+    TdManager::Executor executor_;
 };
 
 #endif
@@ -0,0 +1,543 @@
+#include "tlCodec.h"
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+namespace api = td::td_api;
+
+// Every type the codec knows. Abstract field types are checked against this list when decoding.
+#define TL_CODEC_TYPES(X)                                                                                             \
+    X(error)                                                                                                          \
+    X(ok)                                                                                                             \
+    X(user)                                                                                                           \
+    X(message)                                                                                                        \
+    X(messages)                                                                                                       \
+    X(chat)                                                                                                           \
+    X(chats)                                                                                                          \
+    X(authorizationStateWaitTdlibParameters)                                                                          \
+    X(authorizationStateWaitPhoneNumber)                                                                              \
+    X(authorizationStateWaitCode)                                                                                     \
+    X(authorizationStateWaitPassword)                                                                                 \
+    X(authorizationStateReady)                                                                                        \
+    X(authorizationStateLoggingOut)                                                                                   \
+    X(authorizationStateClosing)                                                                                      \
+    X(authorizationStateClosed)                                                                                       \
+    X(updateAuthorizationState)                                                                                       \
+    X(updateNewChat)                                                                                                  \
+    X(updateChatTitle)                                                                                                \
+    X(updateChatLastMessage)                                                                                          \
+    X(updateChatPosition)                                                                                             \
+    X(updateChatAddedToList)                                                                                          \
+    X(updateChatRemovedFromList)                                                                                      \
+    X(updateChatReadInbox)                                                                                            \
+    X(updateChatReadOutbox)                                                                                           \
+    X(updateChatAction)                                                                                               \
+    X(updateChatOnlineMemberCount)                                                                                    \
+    X(updateChatFolders)                                                                                              \
+    X(updateNewMessage)                                                                                               \
+    X(updateMessageContent)                                                                                           \
+    X(updateMessageEdited)                                                                                            \
+    X(updateMessageSendSucceeded)                                                                                     \
+    X(updateMessageSendFailed)                                                                                        \
+    X(updateDeleteMessages)                                                                                           \
+    X(updateUser)                                                                                                     \
+    X(updateUserStatus)                                                                                               \
+    X(updateBasicGroup)                                                                                               \
+    X(updateSupergroup)                                                                                               \
+    X(updateSecretChat)                                                                                               \
+    X(chatListMain)                                                                                                   \
+    X(chatListArchive)                                                                                                \
+    X(chatListFolder)                                                                                                 \
+    X(chatPosition)                                                                                                   \
+    X(chatTypePrivate)                                                                                                \
+    X(chatTypeBasicGroup)                                                                                             \
+    X(chatTypeSupergroup)                                                                                             \
+    X(chatTypeSecret)                                                                                                 \
+    X(chatFolderInfo)                                                                                                 \
+    X(chatFolderName)                                                                                                 \
+    X(chatActionTyping)                                                                                               \
+    X(chatActionCancel)                                                                                               \
+    X(messageSenderUser)                                                                                              \
+    X(messageSenderChat)                                                                                              \
+    X(formattedText)                                                                                                  \
+    X(messageText)                                                                                                    \
+    X(messagePhoto)                                                                                                   \
+    X(messageVideo)                                                                                                   \
+    X(messageDocument)                                                                                                \
+    X(messageVoiceNote)                                                                                               \
+    X(messageAnimation)                                                                                               \
+    X(messageAudio)                                                                                                   \
+    X(messageSticker)                                                                                                 \
+    X(messageCall)                                                                                                    \
+    X(messageContact)                                                                                                 \
+    X(messageLocation)                                                                                                \
+    X(messagePoll)                                                                                                    \
+    X(messageVideoNote)                                                                                               \
+    X(messageChatAddMembers)                                                                                          \
+    X(messageChatChangeTitle)                                                                                         \
+    X(messagePinMessage)                                                                                              \
+    X(messageUnsupported)                                                                                             \
+    X(document)                                                                                                       \
+    X(voiceNote)                                                                                                      \
+    X(userTypeRegular)                                                                                                \
+    X(userTypeBot)                                                                                                    \
+    X(userTypeDeleted)                                                                                                \
+    X(userTypeUnknown)                                                                                                \
+    X(userStatusEmpty)                                                                                                \
+    X(userStatusOnline)                                                                                               \
+    X(userStatusOffline)                                                                                              \
+    X(userStatusRecently)                                                                                             \
+    X(userStatusLastWeek)                                                                                             \
+    X(userStatusLastMonth)                                                                                            \
+    X(basicGroup)                                                                                                     \
+    X(supergroup)                                                                                                     \
+    X(secretChat)
+
+// Constructor written in place of an unsupported value of an abstract type; 0 means the object cannot be stored.
+template <class T> struct Fallback {
+    static constexpr std::int32_t ID = 0;
+};
+template <> struct Fallback<api::MessageContent> {
+    static constexpr std::int32_t ID = api::messageUnsupported::ID;
+};
+template <> struct Fallback<api::UserType> {
+    static constexpr std::int32_t ID = api::userTypeUnknown::ID;
+};
+template <> struct Fallback<api::UserStatus> {
+    static constexpr std::int32_t ID = api::userStatusEmpty::ID;
+};
+template <> struct Fallback<api::ChatAction> {
+    static constexpr std::int32_t ID = api::chatActionCancel::ID;
+};
+
+bool isKnown(std::int32_t id) {
+    switch (id) {
+#define TL_CODEC_CASE(type) case api::type::ID:
+        TL_CODEC_TYPES(TL_CODEC_CASE)
+#undef TL_CODEC_CASE
+        return true;
+        default:
+            return false;
+    }
+}
+
+// Stored fields per type, shared by the writer and the reader. Types without an overload have no stored fields.
+template <class Io, class T> void fields(Io&, T&) {}
+template <class Io> void fields(Io& io, api::error& o) {
+    io(o.code_);
+    io(o.message_);
+}
+template <class Io> void fields(Io& io, api::user& o) {
+    io(o.id_);
+    io(o.first_name_);
+    io(o.last_name_);
+    io(o.status_);
+    io(o.is_premium_);
+    io(o.type_);
+}
+template <class Io> void fields(Io& io, api::message& o) {
+    io(o.id_);
+    io(o.sender_id_);
+    io(o.chat_id_);
+    io(o.is_outgoing_);
+    io(o.date_);
+    io(o.edit_date_);
+    io(o.author_signature_);
+    io(o.content_);
+}
+template <class Io> void fields(Io& io, api::messages& o) {
+    io(o.total_count_);
+    io(o.messages_);
+}
+template <class Io> void fields(Io& io, api::chat& o) {
+    io(o.id_);
+    io(o.type_);
+    io(o.title_);
+    io(o.last_message_);
+    io(o.positions_);
+    io(o.default_disable_notification_);
+    io(o.unread_count_);
+    io(o.last_read_inbox_message_id_);
+    io(o.last_read_outbox_message_id_);
+}
+template <class Io> void fields(Io& io, api::chats& o) {
+    io(o.total_count_);
+    io(o.chat_ids_);
+}
+template <class Io> void fields(Io& io, api::updateAuthorizationState& o) {
+    io(o.authorization_state_);
+}
+template <class Io> void fields(Io& io, api::updateNewChat& o) {
+    io(o.chat_);
+}
+template <class Io> void fields(Io& io, api::updateChatTitle& o) {
+    io(o.chat_id_);
+    io(o.title_);
+}
+template <class Io> void fields(Io& io, api::updateChatLastMessage& o) {
+    io(o.chat_id_);
+    io(o.last_message_);
+    io(o.positions_);
+}
+template <class Io> void fields(Io& io, api::updateChatPosition& o) {
+    io(o.chat_id_);
+    io(o.position_);
+}
+template <class Io> void fields(Io& io, api::updateChatAddedToList& o) {
+    io(o.chat_id_);
+    io(o.chat_list_);
+}
+template <class Io> void fields(Io& io, api::updateChatRemovedFromList& o) {
+    io(o.chat_id_);
+    io(o.chat_list_);
+}
+template <class Io> void fields(Io& io, api::updateChatReadInbox& o) {
+    io(o.chat_id_);
+    io(o.last_read_inbox_message_id_);
+    io(o.unread_count_);
+}
+template <class Io> void fields(Io& io, api::updateChatReadOutbox& o) {
+    io(o.chat_id_);
+    io(o.last_read_outbox_message_id_);
+}
+template <class Io> void fields(Io& io, api::updateChatAction& o) {
+    io(o.chat_id_);
+    io(o.sender_id_);
+    io(o.action_);
+}
+template <class Io> void fields(Io& io, api::updateChatOnlineMemberCount& o) {
+    io(o.chat_id_);
+    io(o.online_member_count_);
+}
+template <class Io> void fields(Io& io, api::updateChatFolders& o) {
+    io(o.chat_folders_);
+    io(o.main_chat_list_position_);
+}
+template <class Io> void fields(Io& io, api::updateNewMessage& o) {
+    io(o.message_);
+}
+template <class Io> void fields(Io& io, api::updateMessageContent& o) {
+    io(o.chat_id_);
+    io(o.message_id_);
+    io(o.new_content_);
+}
+template <class Io> void fields(Io& io, api::updateMessageEdited& o) {
+    io(o.chat_id_);
+    io(o.message_id_);
+    io(o.edit_date_);
+}
+template <class Io> void fields(Io& io, api::updateMessageSendSucceeded& o) {
+    io(o.message_);
+    io(o.old_message_id_);
+}
+template <class Io> void fields(Io& io, api::updateMessageSendFailed& o) {
+    io(o.message_);
+    io(o.old_message_id_);
+    io(o.error_);
+}
+template <class Io> void fields(Io& io, api::updateDeleteMessages& o) {
+    io(o.chat_id_);
+    io(o.message_ids_);
+    io(o.is_permanent_);
+    io(o.from_cache_);
+}
+template <class Io> void fields(Io& io, api::updateUser& o) {
+    io(o.user_);
+}
+template <class Io> void fields(Io& io, api::updateUserStatus& o) {
+    io(o.user_id_);
+    io(o.status_);
+}
+template <class Io> void fields(Io& io, api::updateBasicGroup& o) {
+    io(o.basic_group_);
+}
+template <class Io> void fields(Io& io, api::updateSupergroup& o) {
+    io(o.supergroup_);
+}
+template <class Io> void fields(Io& io, api::updateSecretChat& o) {
+    io(o.secret_chat_);
+}
+template <class Io> void fields(Io& io, api::chatListFolder& o) {
+    io(o.chat_folder_id_);
+}
+template <class Io> void fields(Io& io, api::chatPosition& o) {
+    io(o.list_);
+    io(o.order_);
+    io(o.is_pinned_);
+}
+template <class Io> void fields(Io& io, api::chatTypePrivate& o) {
+    io(o.user_id_);
+}
+template <class Io> void fields(Io& io, api::chatTypeBasicGroup& o) {
+    io(o.basic_group_id_);
+}
+template <class Io> void fields(Io& io, api::chatTypeSupergroup& o) {
+    io(o.supergroup_id_);
+    io(o.is_channel_);
+}
+template <class Io> void fields(Io& io, api::chatTypeSecret& o) {
+    io(o.secret_chat_id_);
+    io(o.user_id_);
+}
+template <class Io> void fields(Io& io, api::chatFolderInfo& o) {
+    io(o.id_);
+    io(o.name_);
+}
+template <class Io> void fields(Io& io, api::chatFolderName& o) {
+    io(o.text_);
+}
+template <class Io> void fields(Io& io, api::messageSenderUser& o) {
+    io(o.user_id_);
+}
+template <class Io> void fields(Io& io, api::messageSenderChat& o) {
+    io(o.chat_id_);
+}
+template <class Io> void fields(Io& io, api::formattedText& o) {
+    io(o.text_);
+}
+template <class Io> void fields(Io& io, api::messageText& o) {
+    io(o.text_);
+}
+template <class Io> void fields(Io& io, api::messagePhoto& o) {
+    io(o.caption_);
+}
+template <class Io> void fields(Io& io, api::messageVideo& o) {
+    io(o.caption_);
+}
+template <class Io> void fields(Io& io, api::messageDocument& o) {
+    io(o.document_);
+    io(o.caption_);
+}
+template <class Io> void fields(Io& io, api::messageVoiceNote& o) {
+    io(o.voice_note_);
+    io(o.caption_);
+}
+template <class Io> void fields(Io& io, api::messageAnimation& o) {
+    io(o.caption_);
+}
+template <class Io> void fields(Io& io, api::messageAudio& o) {
+    io(o.caption_);
+}
+template <class Io> void fields(Io& io, api::messageChatAddMembers& o) {
+    io(o.member_user_ids_);
+}
+template <class Io> void fields(Io& io, api::messageChatChangeTitle& o) {
+    io(o.title_);
+}
+template <class Io> void fields(Io& io, api::document& o) {
+    io(o.file_name_);
+}
+template <class Io> void fields(Io& io, api::voiceNote& o) {
+    io(o.duration_);
+}
+template <class Io> void fields(Io& io, api::userStatusOnline& o) {
+    io(o.expires_);
+}
+template <class Io> void fields(Io& io, api::userStatusOffline& o) {
+    io(o.was_online_);
+}
+template <class Io> void fields(Io& io, api::basicGroup& o) {
+    io(o.id_);
+    io(o.member_count_);
+}
+template <class Io> void fields(Io& io, api::supergroup& o) {
+    io(o.id_);
+    io(o.member_count_);
+    io(o.is_channel_);
+}
+template <class Io> void fields(Io& io, api::secretChat& o) {
+    io(o.id_);
+    io(o.user_id_);
+}
+
+class Writer {
+  public:
+    explicit Writer(std::string& out) : out_(out) {}
+
+    bool failed() const { return failed_; }
+
+    void operator()(std::int32_t value) { writeVarint(zigzag(value)); }
+    void operator()(std::int64_t value) { writeVarint(zigzag(value)); }
+    void operator()(bool value) { out_.push_back(value ? 1 : 0); }
+    void operator()(const std::string& value) {
+        writeVarint(value.size());
+        out_.append(value);
+    }
+    template <class T> void operator()(const std::vector<T>& values) {
+        writeVarint(values.size());
+        for (const auto& value : values) {
+            (*this)(value);
+        }
+    }
+    template <class T> void operator()(const api::object_ptr<T>& value) {
+        if (!value) {
+            (*this)(std::int32_t{0});
+        } else if (isKnown(value->get_id())) {
+            writeObject(*value);
+        } else if (Fallback<T>::ID != 0) {
+            (*this)(Fallback<T>::ID);
+        } else {
+            failed_ = true;
+        }
+    }
+
+    void writeObject(const api::Object& object) {
+        (*this)(object.get_id());
+        switch (object.get_id()) {
+#define TL_CODEC_WRITE(type)                                                                                          \
+    case api::type::ID:                                                                                               \
+        fields(*this, const_cast<api::type&>(static_cast<const api::type&>(object)));                                 \
+        break;
+            TL_CODEC_TYPES(TL_CODEC_WRITE)
+#undef TL_CODEC_WRITE
+            default:
+                failed_ = true;
+                break;
+        }
+    }
+
+  private:
+    static std::uint64_t zigzag(std::int64_t value) {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    void writeVarint(std::uint64_t value) {
+        while (value >= 0x80) {
+            out_.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out_.push_back(static_cast<char>(value));
+    }
+
+    std::string& out_;
+    bool failed_{false};
+};
+
+class Reader {
+  public:
+    Reader(const char* data, std::size_t size) : pos_(data), end_(data + size) {}
+
+    bool failed() const { return failed_; }
+    bool atEnd() const { return pos_ == end_; }
+
+    void operator()(std::int32_t& value) { value = static_cast<std::int32_t>(unzigzag(readVarint())); }
+    void operator()(std::int64_t& value) { value = unzigzag(readVarint()); }
+    void operator()(bool& value) {
+        if (pos_ == end_) {
+            failed_ = true;
+            return;
+        }
+        value = *pos_++ != 0;
+    }
+    void operator()(std::string& value) {
+        const std::uint64_t size = readVarint();
+        if (size > static_cast<std::uint64_t>(end_ - pos_)) {
+            failed_ = true;
+            return;
+        }
+        value.assign(pos_, static_cast<std::size_t>(size));
+        pos_ += size;
+    }
+    template <class T> void operator()(std::vector<T>& values) {
+        const std::uint64_t size = readVarint();
+        // Every element takes at least one byte, which bounds the allocation for corrupt input.
+        if (size > static_cast<std::uint64_t>(end_ - pos_)) {
+            failed_ = true;
+            return;
+        }
+        values.resize(static_cast<std::size_t>(size));
+        for (auto& value : values) {
+            (*this)(value);
+        }
+    }
+    template <class T> void operator()(api::object_ptr<T>& value) {
+        auto object = readObject();
+        if (!object) {
+            value = nullptr;
+            return;
+        }
+        auto* typed = dynamic_cast<T*>(object.get());
+        if (!typed) {
+            failed_ = true;
+            return;
+        }
+        object.release();
+        value.reset(typed);
+    }
+
+    api::object_ptr<api::Object> readObject() {
+        std::int32_t id = 0;
+        (*this)(id);
+        if (failed_ || id == 0) {
+            return nullptr;
+        }
+        switch (id) {
+#define TL_CODEC_READ(type)                                                                                           \
+    case api::type::ID: {                                                                                             \
+        auto object = api::make_object<api::type>();                                                                  \
+        fields(*this, *object);                                                                                       \
+        return object;                                                                                                \
+    }
+            TL_CODEC_TYPES(TL_CODEC_READ)
+#undef TL_CODEC_READ
+            default:
+                failed_ = true;
+                return nullptr;
+        }
+    }
+
+  private:
+    static std::int64_t unzigzag(std::uint64_t value) {
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    std::uint64_t readVarint() {
+        std::uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (pos_ == end_) {
+                break;
+            }
+            const auto byte = static_cast<unsigned char>(*pos_++);
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        failed_ = true;
+        return 0;
+    }
+
+    const char* pos_;
+    const char* end_;
+    bool failed_{false};
+};
+
+} // namespace
+
+namespace TlCodec {
+
+bool encode(const td::td_api::Object& object, std::string& out) {
+    const auto mark = out.size();
+    Writer writer(out);
+    writer.writeObject(object);
+    if (writer.failed()) {
+        out.resize(mark);
+        return false;
+    }
+    return true;
+}
+
+td::td_api::object_ptr<td::td_api::Object> decode(const char* data, std::size_t size) {
+    Reader reader(data, size);
+    auto object = reader.readObject();
+    if (reader.failed() || !reader.atEnd()) {
+        return nullptr;
+    }
+    return object;
+}
+
+} // namespace TlCodec
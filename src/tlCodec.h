@@ -0,0 +1,24 @@
+#ifndef TL_CODEC_H
+#define TL_CODEC_H
+
+#include <cstddef>
+#include <string>
+#include <td/telegram/td_api.h>
+
+// Compact binary encoding of the td_api objects the client consumes, used for update traces.
+// The public td_api has no binary serializer, so this follows TL's shape (constructor id, then fields in declaration
+// order, vectors prefixed with their length) with compact scalars: zigzag varints for integers, one byte for bools
+// and varint-length strings. Only the fields the UI reads are stored; the rest decode to their defaults.
+namespace TlCodec {
+
+// Appends the encoding of `object` to `out`. Returns false, leaving `out` as it was, if the object or anything
+// nested in it is outside the supported subset. Unsupported message contents, user types, statuses and chat
+// actions degrade to messageUnsupported, userTypeUnknown, userStatusEmpty and chatActionCancel instead.
+bool encode(const td::td_api::Object& object, std::string& out);
+
+// Decodes one object from [data, data + size). Returns null on malformed input.
+td::td_api::object_ptr<td::td_api::Object> decode(const char* data, std::size_t size);
+
+} // namespace TlCodec
+
+#endif
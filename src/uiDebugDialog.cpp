@@ -0,0 +1,126 @@
+#include "uiDebugDialog.h"
+
+#include "uiMainFrame.h"
+
+#include <wx/ffile.h>
+#include <wx/filedlg.h>
+
+CDebugDialog::CDebugDialog(CMainFrame* frame)
+    : wxDialog(frame, wxID_ANY, "Diagnostics", wxDefaultPosition, wxSize(700, 500),
+               wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER),
+      m_frame(frame), m_lastSampleTime(std::chrono::steady_clock::now()) {
+    auto* sizer = new wxBoxSizer(wxVERTICAL);
+    auto* reportLabel = new wxStaticText(this, wxID_ANY, "&Report");
+    m_report = new wxTextCtrl(this, wxID_ANY, "", wxDefaultPosition, wxDefaultSize,
+                              wxTE_READONLY | wxTE_MULTILINE | wxTE_DONTWRAP);
+    sizer->Add(reportLabel, 0, wxALL, 5);
+    sizer->Add(m_report, 1, wxEXPAND | wxALL, 5);
+
+    auto* buttonSizer = new wxBoxSizer(wxHORIZONTAL);
+    m_refreshButton = new wxButton(this, wxID_REFRESH, "Re&fresh");
+    m_saveButton = new wxButton(this, wxID_SAVE, "&Save to file...");
+    buttonSizer->Add(m_refreshButton, 0, wxALL, 5);
+    buttonSizer->Add(m_saveButton, 0, wxALL, 5);
+    sizer->Add(buttonSizer, 0, wxALIGN_CENTER);
+    SetSizer(sizer);
+
+    m_refreshButton->Bind(wxEVT_BUTTON, &CDebugDialog::OnRefreshPressed, this);
+    m_saveButton->Bind(wxEVT_BUTTON, &CDebugDialog::OnSavePressed, this);
+
+    RefreshReport();
+    m_report->SetFocus();
+}
+
+wxString CDebugDialog::BuildReport() {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - m_lastSampleTime).count();
+    const auto& metrics = m_frame->getTdManager()->getMetrics();
+
+    wxString report;
+    const auto requests = m_frame->getTdManager()->getRequestStats();
+    report += wxString::Format("Requests: %llu in flight, %llu issued, %llu completed, %llu cancelled, %llu timed out, "
+                               "%llu rejected, %llu stale\n\n",
+                               static_cast<unsigned long long>(requests.in_flight),
+                               static_cast<unsigned long long>(requests.issued),
+                               static_cast<unsigned long long>(requests.completed),
+                               static_cast<unsigned long long>(requests.cancelled),
+                               static_cast<unsigned long long>(requests.timed_out),
+                               static_cast<unsigned long long>(requests.rejected),
+                               static_cast<unsigned long long>(requests.stale));
+
+    const auto normalLane = m_frame->getTdManager()->getLaneStats(TdManager::Priority::Normal);
+    const auto backgroundLane = m_frame->getTdManager()->getLaneStats(TdManager::Priority::Background);
+    report += wxString::Format("Normal lane: %d in flight, %d queued. Background lane: %d in flight, %d queued\n\n",
+                               static_cast<int>(normalLane.in_flight), static_cast<int>(normalLane.queued),
+                               static_cast<int>(backgroundLane.in_flight), static_cast<int>(backgroundLane.queued));
+
+    report += "Latency by function, including time queued in a lane (microseconds)\n";
+    for (const auto& function : metrics.getFunctionStats()) {
+        report += wxString::Format("%s: %llu calls, %llu errors, %llu timeouts, mean %llu, p50 %llu, p90 %llu, "
+                                   "p99 %llu, max %llu\n",
+                                   wxString::FromUTF8(tlTypeName(function.function_id)),
+                                   static_cast<unsigned long long>(function.count),
+                                   static_cast<unsigned long long>(function.errors),
+                                   static_cast<unsigned long long>(function.timeouts),
+                                   static_cast<unsigned long long>(function.mean_us),
+                                   static_cast<unsigned long long>(function.p50_us),
+                                   static_cast<unsigned long long>(function.p90_us),
+                                   static_cast<unsigned long long>(function.p99_us),
+                                   static_cast<unsigned long long>(function.max_us));
+    }
+
+    const auto totalUpdates = metrics.getTotalUpdates();
+    const double totalRate = elapsed > 0 ? (totalUpdates - m_lastTotalUpdates) / elapsed : 0;
+    report += wxString::Format("\nUpdates from TDLib: %llu total, %.1f per second since last refresh\n",
+                               static_cast<unsigned long long>(totalUpdates), totalRate);
+    for (const auto& update : metrics.getUpdateStats()) {
+        const double rate = elapsed > 0 ? (update.count - m_lastUpdateCounts[update.constructor_id]) / elapsed : 0;
+        report += wxString::Format("%s: %llu, %.1f per second\n", wxString::FromUTF8(tlTypeName(update.constructor_id)),
+                                   static_cast<unsigned long long>(update.count), rate);
+        m_lastUpdateCounts[update.constructor_id] = update.count;
+    }
+    m_lastTotalUpdates = totalUpdates;
+    m_lastSampleTime = now;
+
+    const auto queue = m_frame->getUpdateCoalescer().getStats();
+    report += wxString::Format("\nUI queue: %llu received, %llu merged, %llu dropped, %llu delivered, "
+                               "%llu producer waits, %d queued, %d high water\n",
+                               static_cast<unsigned long long>(queue.received),
+                               static_cast<unsigned long long>(queue.merged),
+                               static_cast<unsigned long long>(queue.dropped),
+                               static_cast<unsigned long long>(queue.delivered),
+                               static_cast<unsigned long long>(queue.producer_waits), static_cast<int>(queue.queued),
+                               static_cast<int>(queue.high_water));
+
+    for (const auto& account : m_frame->getAccounts()) {
+        report += wxString::Format("\nDispatched to %s\n", account->displayName);
+        for (const auto& type : account->updates.getStats()) {
+            report += wxString::Format("%s: %llu, %d handlers\n", wxString::FromUTF8(tlTypeName(type.constructor_id)),
+                                       static_cast<unsigned long long>(type.hits), static_cast<int>(type.handlers));
+        }
+    }
+    return report;
+}
+
+void CDebugDialog::RefreshReport() {
+    m_report->ChangeValue(BuildReport());
+    m_report->SetInsertionPoint(0);
+}
+
+void CDebugDialog::OnRefreshPressed(wxCommandEvent& event) {
+    RefreshReport();
+    m_report->SetFocus();
+}
+
+void CDebugDialog::OnSavePressed(wxCommandEvent& event) {
+    wxString path = wxFileSelector("Save diagnostics", "", "mgram-diagnostics.txt", "txt", "Text files (*.txt)|*.txt",
+                                   wxFD_SAVE | wxFD_OVERWRITE_PROMPT, this);
+    if (path.IsEmpty()) {
+        return;
+    }
+    // What is on screen: building a new report would also restart the rate sampling the view is based on.
+    wxFFile file(path, "w");
+    if (!file.IsOpened() || !file.Write(m_report->GetValue(), wxConvUTF8)) {
+        wxMessageBox("Could not write " + path, "Error", wxOK | wxICON_ERROR);
+    }
+}
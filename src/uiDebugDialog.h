@@ -0,0 +1,36 @@
+#ifndef UI_DEBUG_DIALOG_H
+#define UI_DEBUG_DIALOG_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <wx/wx.h>
+
+class CMainFrame;
+
+// Hidden diagnostics window (Ctrl+Shift+D): request latency per function, update rates per type, queue and
+// dispatcher counters. The report is plain text so screen readers can walk it line by line.
+class CDebugDialog final : public wxDialog {
+  public:
+    CDebugDialog(CMainFrame* frame);
+
+  private:
+    wxString BuildReport();
+    void RefreshReport();
+
+    void OnRefreshPressed(wxCommandEvent& event);
+    void OnSavePressed(wxCommandEvent& event);
+
+    CMainFrame* m_frame;
+    wxTextCtrl* m_report;
+    wxButton* m_refreshButton;
+    wxButton* m_saveButton;
+
+    // Previous refresh, to turn the cumulative update counters into rates. The report is only rebuilt on request so
+    // it does not move under the reading cursor.
+    std::chrono::steady_clock::time_point m_lastSampleTime;
+    std::uint64_t m_lastTotalUpdates{0};
+    std::map<std::int32_t, std::uint64_t> m_lastUpdateCounts;
+};
+
+#endif
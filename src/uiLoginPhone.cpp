@@ -80,34 +80,35 @@ void CLoginPhoneWindow::OnNextPressed(wxCommandEvent& event) {
             auto error = td::td_api::move_object_as<td::td_api::error>(object);
             wxString error_message = wxString::Format("Error: %s (Code: %d)", error->message_, error->code_);
 
-            CallAfter([this, error_message]() {
-                wxMessageBox(error_message, "Login Failed", wxOK | wxICON_ERROR);
-                m_next->Enable();
-                m_entry->Enable();
-                m_entry->SelectAll();
-                m_entry->SetFocus();
-            });
+            wxMessageBox(error_message, "Login Failed", wxOK | wxICON_ERROR);
+            m_next->Enable();
+            m_entry->Enable();
+            m_entry->SelectAll();
+            m_entry->SetFocus();
         }
     };
 
     if (m_loginState == LOGIN_PHONE) {
         auto set_phone_number = td::td_api::make_object<td::td_api::setAuthenticationPhoneNumber>();
         set_phone_number->phone_number_ = value.ToStdString();
-        g_mainFrame->getTdManager()->send(std::move(set_phone_number), response_handler);
+        g_mainFrame->getTdClient()->send(std::move(set_phone_number), response_handler,
+                                         TdManager::Priority::Interactive);
     } else if (m_loginState == LOGIN_CODE) {
         auto check_code = td::td_api::make_object<td::td_api::checkAuthenticationCode>();
         check_code->code_ = value.ToStdString();
-        g_mainFrame->getTdManager()->send(std::move(check_code), response_handler);
+        g_mainFrame->getTdClient()->send(std::move(check_code), response_handler, TdManager::Priority::Interactive);
     } else if (m_loginState == LOGIN_PASSWORD) {
         auto check_password = td::td_api::make_object<td::td_api::checkAuthenticationPassword>();
         check_password->password_ = value.ToStdString();
-        g_mainFrame->getTdManager()->send(std::move(check_password), response_handler);
+        g_mainFrame->getTdClient()->send(std::move(check_password), response_handler,
+                                         TdManager::Priority::Interactive);
     }
 }
 
 void CLoginPhoneWindow::OnCancelPressed(wxCommandEvent& event) {
     SwitchLoginState(LOGIN_PHONE);
-    g_mainFrame->getTdManager()->send(td::td_api::make_object<td::td_api::logOut>());
+    g_mainFrame->getTdClient()->send(td::td_api::make_object<td::td_api::logOut>(), nullptr,
+                                     TdManager::Priority::Interactive);
 
     if (m_book && g_mainFrame && g_mainFrame->m_loginWindow) {
         if (m_book->FindPage(g_mainFrame->m_loginWindow) != wxNOT_FOUND) {
@@ -1,21 +1,36 @@
 #include "uiMainFrame.h"
 
 #include "constants.h"
+#include "uiDebugDialog.h"
 #include "uiLogin.h"
 #include "uiLoginPhone.h"
 #include "uiMainWindow.h"
 #include "uiTaskBarIcon.h"
 
 #include <wx/artprov.h>
+#include <wx/config.h>
+#include <wx/filename.h>
+#include <wx/menu.h>
 #include <wx/notifmsg.h>
 
 CMainFrame* g_mainFrame{nullptr};
 
+enum {
+    ID_ADD_ACCOUNT = wxID_HIGHEST + 1,
+    ID_ACCOUNT_FIRST,
+    ID_ACCOUNT_LAST = ID_ACCOUNT_FIRST + 99,
+    ID_SHOW_DIAGNOSTICS
+};
+
 BEGIN_EVENT_TABLE(CMainFrame, wxFrame)
 EVT_CLOSE(CMainFrame::OnClose)
 END_EVENT_TABLE()
 
-CMainFrame::CMainFrame(const wxString& title) : wxFrame(nullptr, wxID_ANY, title) {
+CMainFrame::CMainFrame(const wxString& title, const CTraceOptions& traceOptions)
+    : wxFrame(nullptr, wxID_ANY, title),
+      m_updateCoalescer(UPDATE_QUEUE_SOFT_LIMIT, UPDATE_QUEUE_HARD_LIMIT,
+                        [this]() { CallAfter(&CMainFrame::DrainUpdates); }),
+      m_traceOptions(traceOptions) {
     auto* taskBarIcon = new CMgramTaskBarIcon(this);
     taskBarIcon->SetIcon(wxArtProvider::GetIcon(wxART_INFORMATION, wxART_OTHER, wxSize(16, 16)), "MGram");
 #ifdef _WIN32
@@ -35,56 +50,149 @@ CMainFrame::CMainFrame(const wxString& title) : wxFrame(nullptr, wxID_ANY, title
     sizer->Add(m_book, 1, wxEXPAND);
     panel->SetSizer(sizer);
 
+    auto* menuBar = new wxMenuBar();
+    m_accountMenu = new wxMenu();
+    menuBar->Append(m_accountMenu, "&Accounts");
+    SetMenuBar(menuBar);
+    Bind(wxEVT_MENU, &CMainFrame::OnAddAccount, this, ID_ADD_ACCOUNT);
+    Bind(wxEVT_MENU, &CMainFrame::OnSwitchAccount, this, ID_ACCOUNT_FIRST, ID_ACCOUNT_LAST);
+
+    // Not in any menu on purpose: the diagnostics window is for tracking down slow paths, not for everyday use.
+    wxAcceleratorEntry accelerators[1];
+    accelerators[0].Set(wxACCEL_CTRL | wxACCEL_SHIFT, 'D', ID_SHOW_DIAGNOSTICS);
+    SetAcceleratorTable(wxAcceleratorTable(1, accelerators));
+    Bind(wxEVT_MENU, &CMainFrame::OnShowDiagnostics, this, ID_SHOW_DIAGNOSTICS);
+
     InitializeTdlib();
 }
 
-void CMainFrame::InitializeTdlib() {
-    m_tdManager.setUpdateCallback([this](td::td_api::object_ptr<td::td_api::Object> update) {
-        if (!update) {
-            return;
+CMainFrame::~CMainFrame() {
+    // Release the TDLib thread if it is waiting for queue space, then stop it from posting to this frame.
+    m_updateCoalescer.close();
+    m_tdManager.setUpdateBatchCallback(nullptr);
+    m_tdManager.setUiExecutor(nullptr);
+    // The accounts are members declared after the manager and would otherwise be destroyed while its thread still
+    // runs callbacks that reach them.
+    m_tdManager.shutdown();
+    // Main windows unsubscribe from their account's dispatcher, which goes away before wx destroys child windows.
+    for (auto& account : m_accounts) {
+        if (account->mainWindow) {
+            m_book->DeletePage(m_book->FindPage(account->mainWindow));
+            account->mainWindow = nullptr;
         }
+    }
+}
 
-        if (update->get_id() == td::td_api::updateAuthorizationState::ID) {
-            td::td_api::Object* raw_update_ptr = update.release();
-            CallAfter([this, raw_update_ptr]() {
-                td::td_api::object_ptr<td::td_api::Object> update_ptr(raw_update_ptr);
-                OnAuthorizationStateUpdate(std::move(update_ptr));
-            });
-        } else if (m_mainWindow) {
-            td::td_api::Object* raw_update_ptr = update.release();
-            CallAfter([this, raw_update_ptr]() {
-                td::td_api::object_ptr<td::td_api::Object> update_ptr(raw_update_ptr);
-                m_mainWindow->ProcessUpdate(std::move(update_ptr));
-            });
+void CMainFrame::InitializeTdlib() {
+    m_tdManager.setBatchLimits(UPDATE_BATCH_MAX_SIZE, UPDATE_BATCH_MAX_LATENCY);
+    m_tdManager.setPriorityLimits(REQUEST_NORMAL_MAX_IN_FLIGHT, REQUEST_BACKGROUND_MAX_IN_FLIGHT);
+    m_tdManager.setUpdateBatchCallback(
+        [this](TdManager::UpdateBatch batch) { m_updateCoalescer.push(std::move(batch)); });
+    m_tdManager.setUiExecutor([this](std::function<void()> task) { CallAfter(std::move(task)); });
+
+    if (!m_traceOptions.recordPath.IsEmpty() &&
+        !m_tdManager.startRecording(m_traceOptions.recordPath.ToStdString(wxConvUTF8))) {
+        wxLogError("Cannot write the trace file %s", m_traceOptions.recordPath);
+    }
+    const bool replaying = !m_traceOptions.replayPath.IsEmpty() &&
+                           m_tdManager.openReplay(m_traceOptions.replayPath.ToStdString(wxConvUTF8));
+    if (!m_traceOptions.replayPath.IsEmpty() && !replaying) {
+        wxLogError("Cannot read the trace file %s", m_traceOptions.replayPath);
+    }
+
+    LoadAccounts();
+    for (auto& account : m_accounts) {
+        StartAccount(*account);
+    }
+    RebuildAccountMenu();
+    if (replaying) {
+        m_tdManager.startReplay(m_traceOptions.replaySpeed);
+    }
+}
+
+void CMainFrame::LoadAccounts() {
+    auto* config = wxConfigBase::Get();
+    long count = config ? config->ReadLong("Accounts/Count", 0) : 0;
+    for (long i = 0; i < count; ++i) {
+        wxString directory;
+        if (config->Read(wxString::Format("Accounts/Directory%ld", i), &directory) && !directory.IsEmpty()) {
+            AddAccount(directory);
         }
-    });
+    }
+    if (m_accounts.empty()) {
+        // The database location used before accounts existed, so an existing login keeps working.
+        AddAccount("tdlib");
+    }
+}
+
+void CMainFrame::SaveAccounts() {
+    auto* config = wxConfigBase::Get();
+    if (!config) {
+        return;
+    }
+    config->Write("Accounts/Count", static_cast<long>(m_accounts.size()));
+    for (size_t i = 0; i < m_accounts.size(); ++i) {
+        config->Write(wxString::Format("Accounts/Directory%d", static_cast<int>(i)),
+                      m_accounts[i]->databaseDirectory);
+    }
+    config->Flush();
+}
+
+CAccount* CMainFrame::AddAccount(const wxString& databaseDirectory) {
+    auto account = std::make_unique<CAccount>();
+    account->databaseDirectory = databaseDirectory;
+    account->displayName = wxString::Format("Account %d", static_cast<int>(m_accounts.size() + 1));
+    account->updates.subscribe<td::td_api::updateAuthorizationState>(
+        [this, accountPtr = account.get()](td::td_api::updateAuthorizationState& update) {
+            OnAuthorizationStateUpdate(*accountPtr, update);
+        });
+    m_accounts.push_back(std::move(account));
+    return m_accounts.back().get();
+}
+
+void CMainFrame::StartAccount(CAccount& account) {
+    // Responses are handled on the UI thread like updates, so the account's caches are only touched from there.
+    account.client = std::make_unique<TdClient>(m_tdManager, m_tdManager.createClient(), TdManager::Executor::Ui);
+    account.authorizationState = 0;
 
     auto set_params = td::td_api::make_object<td::td_api::setTdlibParameters>();
     set_params->api_id_ = API_ID;
     set_params->api_hash_ = API_HASH;
-    set_params->database_directory_ = "tdlib";
+    set_params->database_directory_ = account.databaseDirectory.ToStdString(wxConvUTF8);
     set_params->use_test_dc_ = false;
     set_params->device_model_ = "Desktop";
     set_params->system_language_code_ = "en";
     set_params->application_version_ = "0.1";
     set_params->use_message_database_ = true;
 
-    m_tdManager.send(std::move(set_params), nullptr);
+    account.client->send(std::move(set_params), nullptr);
 }
 
-#include <wx/msgdlg.h>
-void CMainFrame::OnAuthorizationStateUpdate(td::td_api::object_ptr<td::td_api::Object> update) {
-    auto auth_state = td::td_api::move_object_as<td::td_api::updateAuthorizationState>(update);
-    auto state_id = auth_state->authorization_state_->get_id();
+CAccount* CMainFrame::FindAccount(std::int32_t clientId) {
+    for (auto& account : m_accounts) {
+        if (account->client && account->client->getClientId() == clientId) {
+            return account.get();
+        }
+    }
+    return nullptr;
+}
 
-    if (state_id == td::td_api::authorizationStateReady::ID) {
-        m_mainWindow = new CMainWindow(m_book);
-        m_book->AddPage(m_mainWindow, "Main");
-        m_book->SetSelection(m_book->FindPage(m_mainWindow));
-        m_loginWindow->Hide();
-        m_loginPhoneWindow->Hide();
+void CMainFrame::SwitchAccount(size_t index) {
+    if (index >= m_accounts.size()) {
         return;
-    } else if (state_id == td::td_api::authorizationStateWaitPhoneNumber::ID) {
+    }
+    m_activeAccount = index;
+    RebuildAccountMenu();
+    ShowAccountPage(*m_accounts[index]);
+}
+
+void CMainFrame::ShowAccountPage(CAccount& account) {
+    auto state_id = account.authorizationState;
+    if (state_id == td::td_api::authorizationStateReady::ID && account.mainWindow) {
+        m_book->SetSelection(m_book->FindPage(account.mainWindow));
+        return;
+    } else if (state_id == 0 || state_id == td::td_api::authorizationStateWaitPhoneNumber::ID) {
+        m_loginPhoneWindow->SwitchLoginState(CLoginPhoneWindow::LOGIN_PHONE);
         m_book->SetSelection(m_book->FindPage(m_loginWindow));
         return;
     }
@@ -97,13 +205,134 @@ void CMainFrame::OnAuthorizationStateUpdate(td::td_api::object_ptr<td::td_api::O
         m_loginPhoneWindow->SwitchLoginState(CLoginPhoneWindow::LOGIN_CODE);
     } else if (state_id == td::td_api::authorizationStateWaitPassword::ID) {
         m_loginPhoneWindow->SwitchLoginState(CLoginPhoneWindow::LOGIN_PASSWORD);
-    } else if (state_id == td::td_api::authorizationStateClosed::ID) {
-        wxMessageBox("Authentication failed or was terminated. Please try again.", "Login Error", wxOK | wxICON_ERROR);
-        wxCommandEvent evt;
-        m_loginPhoneWindow->OnCancelPressed(evt);
     }
 }
 
+void CMainFrame::RebuildAccountMenu() {
+    while (m_accountMenu->GetMenuItemCount() > 0) {
+        m_accountMenu->Destroy(m_accountMenu->FindItemByPosition(0));
+    }
+    for (size_t i = 0; i < m_accounts.size(); ++i) {
+        wxString label = m_accounts[i]->displayName;
+        if (i < 9) {
+            label += wxString::Format("\tCtrl+%d", static_cast<int>(i + 1));
+        }
+        m_accountMenu->AppendRadioItem(ID_ACCOUNT_FIRST + static_cast<int>(i), label);
+    }
+    if (!m_accounts.empty()) {
+        m_accountMenu->Check(ID_ACCOUNT_FIRST + static_cast<int>(m_activeAccount), true);
+    }
+    m_accountMenu->AppendSeparator();
+    m_accountMenu->Append(ID_ADD_ACCOUNT, "&Add account\tCtrl+N");
+}
+
+void CMainFrame::DrainUpdates() {
+    TdManager::UpdateBatch batch;
+    m_updateCoalescer.drain(batch);
+    ProcessUpdateBatch(batch);
+}
+
+void CMainFrame::ProcessUpdateBatch(TdManager::UpdateBatch& batch) {
+    for (auto& update : batch) {
+        if (update.task) {
+            update.task();
+            continue;
+        }
+        if (!update.object) {
+            continue;
+        }
+        if (auto* account = FindAccount(update.client_id)) {
+            account->updates.dispatch(*update.object);
+        }
+    }
+}
+
+#include <wx/msgdlg.h>
+void CMainFrame::OnAuthorizationStateUpdate(CAccount& account, td::td_api::updateAuthorizationState& update) {
+    auto state_id = update.authorization_state_->get_id();
+    account.authorizationState = state_id;
+    const bool isActive = &account == m_accounts[m_activeAccount].get();
+
+    if (state_id == td::td_api::authorizationStateReady::ID) {
+        if (!account.mainWindow) {
+            // A replayed trace paints only what it replays, so it neither reads nor overwrites the snapshot.
+            const std::string snapshotPath =
+                m_traceOptions.replayPath.IsEmpty()
+                    ? wxFileName(account.databaseDirectory, "chats.snapshot").GetFullPath().ToStdString(wxConvUTF8)
+                    : std::string();
+            account.mainWindow = new CMainWindow(m_book, *account.client, account.updates, snapshotPath);
+            m_book->AddPage(account.mainWindow, "Main");
+        }
+        account.client->send(td::td_api::make_object<td::td_api::getMe>(),
+                             [this, accountPtr = &account](TdManager::Object object) {
+                                 if (object->get_id() != td::td_api::user::ID) {
+                                     return;
+                                 }
+                                 auto* me = static_cast<const td::td_api::user*>(object.get());
+                                 accountPtr->displayName = wxString::FromUTF8(me->first_name_ + " " + me->last_name_);
+                                 RebuildAccountMenu();
+                             });
+        if (isActive) {
+            ShowAccountPage(account);
+        }
+        return;
+    }
+
+    if (state_id == td::td_api::authorizationStateClosed::ID) {
+        // A closed TDLib instance cannot be reused; give the account a fresh client on the same database.
+        if (account.mainWindow) {
+            // The snapshot belongs to the session that just ended; the next login may be someone else.
+            account.mainWindow->DiscardSnapshot();
+            m_book->DeletePage(m_book->FindPage(account.mainWindow));
+            account.mainWindow = nullptr;
+        }
+        m_tdManager.destroyClient(account.client->getClientId());
+        StartAccount(account);
+        if (isActive) {
+            wxMessageBox("Authentication failed or was terminated. Please try again.", "Login Error",
+                         wxOK | wxICON_ERROR);
+            m_loginPhoneWindow->SwitchLoginState(CLoginPhoneWindow::LOGIN_PHONE);
+        }
+        return;
+    }
+
+    if (isActive) {
+        ShowAccountPage(account);
+    }
+}
+
+void CMainFrame::OnAddAccount(wxCommandEvent& event) {
+    // Pick the first unused directory so a removed config entry never makes two accounts share a database.
+    wxString directory;
+    for (size_t n = m_accounts.size() + 1;; ++n) {
+        directory = wxString::Format("tdlib-%d", static_cast<int>(n));
+        bool used = false;
+        for (const auto& account : m_accounts) {
+            used = used || account->databaseDirectory == directory;
+        }
+        if (!used) {
+            break;
+        }
+    }
+
+    auto* account = AddAccount(directory);
+    SaveAccounts();
+    StartAccount(*account);
+    SwitchAccount(m_accounts.size() - 1);
+}
+
+void CMainFrame::OnSwitchAccount(wxCommandEvent& event) {
+    SwitchAccount(static_cast<size_t>(event.GetId() - ID_ACCOUNT_FIRST));
+}
+
+void CMainFrame::OnShowDiagnostics(wxCommandEvent& event) {
+    if (!m_debugDialog) {
+        m_debugDialog = new CDebugDialog(this);
+    }
+    m_debugDialog->Show();
+    m_debugDialog->Raise();
+}
+
 void CMainFrame::OnClose(wxCloseEvent& event) {
     if (event.CanVeto()) {
         event.Veto();
@@ -113,7 +342,31 @@ void CMainFrame::OnClose(wxCloseEvent& event) {
     }
 }
 
+void CMgramEntry::OnInitCmdLine(wxCmdLineParser& parser) {
+    wxApp::OnInitCmdLine(parser);
+    parser.AddOption("", "record", "write all TDLib updates and responses to a trace file");
+    parser.AddOption("", "replay", "serve a recorded trace file instead of connecting to Telegram");
+    parser.AddOption("", "replay-speed", "replay pace relative to the recording; 0 replays as fast as possible",
+                     wxCMD_LINE_VAL_DOUBLE);
+}
+
+bool CMgramEntry::OnCmdLineParsed(wxCmdLineParser& parser) {
+    if (!wxApp::OnCmdLineParsed(parser)) {
+        return false;
+    }
+    parser.Found("record", &m_traceOptions.recordPath);
+    parser.Found("replay", &m_traceOptions.replayPath);
+    double speed = 1.0;
+    if (parser.Found("replay-speed", &speed)) {
+        m_traceOptions.replaySpeed = speed < 0 ? 0 : speed;
+    }
+    return true;
+}
+
 bool CMgramEntry::OnInit() {
+    if (!wxApp::OnInit()) {
+        return false;
+    }
     wxLog::SetActiveTarget(new wxLogStderr);
     const wxString name = wxString::Format("MMADE-MGRAM-%s", wxGetUserId().c_str());
     m_instanceChecker = new wxSingleInstanceChecker(name);
@@ -133,7 +386,7 @@ bool CMgramEntry::OnInit() {
     m_server = new CMgramServer();
     m_server->Create(IPC_SERVICE_PORT);
 
-    g_mainFrame = new CMainFrame("MGram");
+    g_mainFrame = new CMainFrame("MGram", m_traceOptions);
     g_mainFrame->Show(true);
     return true;
 }
@@ -2,33 +2,82 @@
 #define UI_MAIN_FRAME_H
 
 #include "tdManager.h"
+#include "updateCoalescer.h"
+#include "updateDispatcher.h"
 
+#include <memory>
+#include <vector>
+#include <wx/cmdline.h>
 #include <wx/ipc.h>
 #include <wx/simplebook.h>
 #include <wx/snglinst.h>
 #include <wx/wx.h>
 
+class CDebugDialog;
 class CLoginWindow;
 class CLoginPhoneWindow;
 class CMainWindow;
 
+// A Telegram account: its own TDLib client and database directory, its own caches inside its main window.
+struct CAccount {
+    wxString databaseDirectory;
+    wxString displayName;
+    std::unique_ptr<TdClient> client;
+    UpdateDispatcher updates;
+    CMainWindow* mainWindow{nullptr};
+    std::int32_t authorizationState{0};
+};
+
+// Command line options for capturing TDLib traffic to a trace file or serving a trace instead of TDLib.
+struct CTraceOptions {
+    wxString recordPath;
+    wxString replayPath;
+    // 1 keeps the recorded pace, 0 replays as fast as possible.
+    double replaySpeed{1.0};
+};
+
 class CMainFrame final : public wxFrame {
   public:
     CLoginWindow* m_loginWindow;
     CLoginPhoneWindow* m_loginPhoneWindow;
-    CMainWindow* m_mainWindow;
     wxSimplebook* m_book;
 
-    CMainFrame(const wxString& title);
+    CMainFrame(const wxString& title, const CTraceOptions& traceOptions = CTraceOptions());
+    ~CMainFrame();
     TdManager* getTdManager() { return &m_tdManager; }
+    // The client of the account currently shown; login pages talk to it.
+    TdClient* getTdClient() { return m_accounts[m_activeAccount]->client.get(); }
+    const UpdateCoalescer& getUpdateCoalescer() const { return m_updateCoalescer; }
+    const std::vector<std::unique_ptr<CAccount>>& getAccounts() const { return m_accounts; }
 
   private:
     void InitializeTdlib();
-    void OnAuthorizationStateUpdate(td::td_api::object_ptr<td::td_api::Object> update);
+    void LoadAccounts();
+    void SaveAccounts();
+    CAccount* AddAccount(const wxString& databaseDirectory);
+    void StartAccount(CAccount& account);
+    CAccount* FindAccount(std::int32_t clientId);
+    void SwitchAccount(size_t index);
+    void ShowAccountPage(CAccount& account);
+    void RebuildAccountMenu();
+
+    void DrainUpdates();
+    void ProcessUpdateBatch(TdManager::UpdateBatch& batch);
+    void OnAuthorizationStateUpdate(CAccount& account, td::td_api::updateAuthorizationState& update);
 
+    void OnAddAccount(wxCommandEvent& event);
+    void OnSwitchAccount(wxCommandEvent& event);
+    void OnShowDiagnostics(wxCommandEvent& event);
     void OnClose(wxCloseEvent& event);
 
+    // Declared before the manager so it outlives the TDLib thread that pushes into it.
+    UpdateCoalescer m_updateCoalescer;
     TdManager m_tdManager;
+    std::vector<std::unique_ptr<CAccount>> m_accounts;
+    size_t m_activeAccount{0};
+    wxMenu* m_accountMenu;
+    CTraceOptions m_traceOptions;
+    CDebugDialog* m_debugDialog{nullptr};
     DECLARE_EVENT_TABLE()
 };
 
@@ -38,8 +87,11 @@ class CMgramEntry final : public wxApp {
   public:
     virtual bool OnInit() override;
     virtual int OnExit() override;
+    virtual void OnInitCmdLine(wxCmdLineParser& parser) override;
+    virtual bool OnCmdLineParsed(wxCmdLineParser& parser) override;
 
   private:
+    CTraceOptions m_traceOptions;
     wxSingleInstanceChecker* m_instanceChecker;
     wxServer* m_server;
 };
@@ -1,147 +1,106 @@
 #include "uiMainWindow.h"
 
+#include "chatSnapshot.h"
 #include "clientData.h"
+#include "constants.h"
 #include "notificationSender.h"
 #include "uiMainFrame.h"
 
 #include <atomic>
 #include <utility>
-#include <wx/datetime.h>
 #include <wx/listbox.h>
 #include <wx/wx.h>
 
-static wxString FormatTimestamp(int64_t unix_time) {
-    if (unix_time == 0) {
-        return "N/A";
-    }
-    wxDateTime dt(static_cast<time_t>(unix_time));
-    return dt.Format("%Y-%m-%d %H:%M");
-}
-
-static wxString FormatMessageContentPreview(const td::td_api::MessageContent* content) {
-    if (!content) {
-        return "No messages";
-    }
-    switch (content->get_id()) {
-        case td::td_api::messageText::ID: {
-            auto* textContent = static_cast<const td::td_api::messageText*>(content);
-            return wxString::FromUTF8(textContent->text_->text_);
-        }
-        case td::td_api::messageAnimation::ID:
-            return "[Animation]";
-        case td::td_api::messageAudio::ID:
-            return "[Audio]";
-        case td::td_api::messageDocument::ID:
-            return "[File]";
-        case td::td_api::messagePhoto::ID:
-            return "[Photo]";
-        case td::td_api::messageSticker::ID:
-            return "[Sticker]";
-        case td::td_api::messageVideo::ID:
-            return "[Video]";
-        case td::td_api::messageVoiceNote::ID:
-            return "[Voice message]";
-        case td::td_api::messageCall::ID:
-            return "[Call]";
-        case td::td_api::messageContact::ID:
-            return "[Contact]";
-        case td::td_api::messageLocation::ID:
-            return "[Location]";
-        case td::td_api::messagePoll::ID:
-            return "[Poll]";
-        case td::td_api::messageVideoNote::ID:
-            return "[Video message]";
-        case td::td_api::messageChatAddMembers::ID:
-            return "[Service: New members]";
-        case td::td_api::messageChatChangeTitle::ID: {
-            auto* titleChange = static_cast<const td::td_api::messageChatChangeTitle*>(content);
-            return "Title changed to " + wxString::FromUTF8(titleChange->title_);
-        }
-        case td::td_api::messagePinMessage::ID:
-            return "[Service: Pinned a message]";
-        default:
-            return "[Unsupported message]";
-    }
-}
-
-static wxString FormatMessageContent(const td::td_api::MessageContent* content) {
-    if (!content) {
-        return "[Empty message]";
-    }
-    wxString formatted_content;
-    wxString type_str;
-
-    switch (content->get_id()) {
-        case td::td_api::messageText::ID: {
-            auto* textContent = static_cast<const td::td_api::messageText*>(content);
-            return wxString::FromUTF8(textContent->text_->text_);
-        }
-        case td::td_api::messageVoiceNote::ID: {
-            auto* voice = static_cast<const td::td_api::messageVoiceNote*>(content);
-            type_str = "Voice";
-            if (voice->voice_note_) {
-                formatted_content = wxString::Format("%d seconds", voice->voice_note_->duration_);
+enum {
+    ID_SNAPSHOT_TIMER = wxID_HIGHEST + 1,
+    ID_PREFETCH_TIMER,
+    ID_PAGING_TIMER,
+    ID_READ_TIMER
+};
+
+// Type prefix and name; the name comes from the user for private chats once the user is known.
+static void AppendChatTitle(RowFormatter& formatter, const ChatStore& chats, const ChatRecord& chat,
+                            const PeerCache& peers, const UserRecord* user) {
+    switch (chat.kind) {
+        case ChatRecord::KIND_PRIVATE:
+            if (user && user->is_bot) {
+                formatter.append("Bot. ");
             }
             break;
-        }
-        case td::td_api::messageDocument::ID: {
-            auto* doc = static_cast<const td::td_api::messageDocument*>(content);
-            type_str = "File";
-            formatted_content = wxString::FromUTF8(doc->document_->file_name_);
+        case ChatRecord::KIND_BASIC_GROUP:
+            formatter.append("Group. ");
             break;
-        }
-        case td::td_api::messagePhoto::ID: {
-            type_str = "Photo";
-            auto* photo = static_cast<const td::td_api::messagePhoto*>(content);
-            if (!photo->caption_->text_.empty()) {
-                formatted_content = wxString::FromUTF8(photo->caption_->text_);
-            }
+        case ChatRecord::KIND_SECRET:
+            formatter.append("Secret. ");
             break;
-        }
-        case td::td_api::messageVideo::ID: {
-            type_str = "Video";
-            auto* video = static_cast<const td::td_api::messageVideo*>(content);
-            if (!video->caption_->text_.empty()) {
-                formatted_content = wxString::FromUTF8(video->caption_->text_);
-            }
+        case ChatRecord::KIND_SUPERGROUP:
+            formatter.append("Supergroup. ");
             break;
-        }
-        case td::td_api::messageChatAddMembers::ID:
-            type_str = "Service";
-            formatted_content = "Members added";
+        case ChatRecord::KIND_CHANNEL:
+            formatter.append("Channel. ");
             break;
-        case td::td_api::messageChatChangeTitle::ID: {
-            type_str = "Service";
-            auto* title_change = static_cast<const td::td_api::messageChatChangeTitle*>(content);
-            formatted_content = "Title changed to " + wxString::FromUTF8(title_change->title_);
+    }
+
+    if (user) {
+        formatter.append(peers.firstName(*user)).append(" ").append(peers.lastName(*user));
+    } else {
+        formatter.append(chats.title(chat));
+    }
+}
+
+static void AppendUserStatus(RowFormatter& formatter, const UserRecord* user) {
+    if (!user) {
+        return;
+    }
+    if (user->is_premium) {
+        formatter.append(", Premium account");
+    }
+    switch (user->status) {
+        case UserRecord::STATUS_ONLINE:
+            formatter.append(", online");
+            break;
+        case UserRecord::STATUS_OFFLINE:
+            formatter.append(", last seen at ").appendTimestamp(user->was_online);
+            break;
+        case UserRecord::STATUS_RECENTLY:
+            formatter.append(", last seen recently");
             break;
-        }
         default:
-            type_str = "Other";
-            formatted_content = "Unsupported content";
             break;
     }
+}
 
-    return type_str + (formatted_content.IsEmpty() ? "" : ", " + formatted_content);
+static void AppendUnreadCount(RowFormatter& formatter, const ChatRecord& chat) {
+    if (chat.unread_count > 0) {
+        formatter.append(", ").appendNumber(chat.unread_count).append(" unread messages");
+    }
 }
 
-static bool IsPositionInCurrentList(const td::td_api::ChatList* position_list,
-                                    const td::td_api::ChatList* current_list) {
-    if (!position_list || !current_list)
-        return false;
-    if (position_list->get_id() != current_list->get_id())
-        return false;
+static void AppendLastMessage(RowFormatter& formatter, const ChatRecord& chat) {
+    if (chat.last_message_id != 0) {
+        formatter.append(", received at ")
+            .appendTimestamp(chat.last_message_date)
+            .append(": ")
+            .append(chat.last_message_preview);
+    }
+}
 
-    if (current_list->get_id() == td::td_api::chatListFolder::ID) {
-        auto* pos_folder = static_cast<const td::td_api::chatListFolder*>(position_list);
-        auto* current_folder = static_cast<const td::td_api::chatListFolder*>(current_list);
-        return pos_folder->chat_folder_id_ == current_folder->chat_folder_id_;
+static ChatListId ListIdOf(const CFolderClientData& folder) {
+    switch (folder.GetType()) {
+        case CFolderClientData::ARCHIVE:
+            return kArchiveChatList;
+        case CFolderClientData::FOLDER:
+            return folder.GetFolderId();
+        default:
+            return kMainChatList;
     }
-    return true;
 }
 
-CMainWindow::CMainWindow(wxSimplebook* book)
-    : wxPanel(book, wxID_ANY), m_book(book), m_currentChatId(0), m_lastMessageId(0), m_loadingMore(false) {
+CMainWindow::CMainWindow(wxSimplebook* book, TdClient& client, UpdateDispatcher& updates,
+                         const std::string& snapshotPath)
+    : wxPanel(book, wxID_ANY), m_book(book), m_client(client), m_updates(updates), m_chatScope(client),
+      m_folderScope(client), m_listScope(client), m_prefetchScope(client), m_currentChatId(0),
+      m_parkedChats(MESSAGE_CACHE_MAX_CHATS), m_prefetchedChats(CHAT_PREFETCH_MAX_CHATS), m_snapshotPath(snapshotPath) {
     auto* sizer = new wxBoxSizer(wxVERTICAL);
     m_splitter = new wxSplitterWindow(this, wxID_ANY);
 
@@ -154,22 +113,29 @@ CMainWindow::CMainWindow(wxSimplebook* book)
     leftSizer->Add(m_folderList, 0, wxEXPAND | wxALL, 5);
 
     auto* chatListLabel = new wxStaticText(leftPanel, wxID_ANY, "&Chats");
-    m_chatList = new wxListBox(leftPanel, wxID_ANY, wxDefaultPosition, wxDefaultSize, 0, nullptr);
+    m_chatList = new CVirtualListCtrl(leftPanel, "Chat", [this](long row) {
+        return FormatChatRow(m_chatStore.chatAt(GetCurrentListId(), row));
+    });
     leftSizer->Add(chatListLabel, 0, wxALL, 5);
     leftSizer->Add(m_chatList, 1, wxEXPAND | wxALL, 5);
     leftPanel->SetSizer(leftSizer);
 
     m_folderList->Bind(wxEVT_LISTBOX, &CMainWindow::OnFolderSelected, this);
-    m_chatList->Bind(wxEVT_LISTBOX, &CMainWindow::OnChatSelected, this);
+    m_chatList->Bind(wxEVT_LIST_ITEM_SELECTED, &CMainWindow::OnChatSelected, this);
+    m_chatList->Bind(wxEVT_LIST_ITEM_FOCUSED, [this](wxListEvent& event) {
+        SchedulePrefetch();
+        event.Skip();
+    });
 
     auto* rightPanel = new wxPanel(m_splitter);
     auto* rightSizer = new wxBoxSizer(wxVERTICAL);
     auto* messagesLabel = new wxStaticText(rightPanel, wxID_ANY, "&Messages");
-    m_messageView = new wxListBox(rightPanel, wxID_ANY, wxDefaultPosition, wxDefaultSize, 0, nullptr);
+    m_messageView = new CVirtualListCtrl(rightPanel, "Message", [this](long row) { return FormatMessageRow(row); });
     rightSizer->Add(messagesLabel, 0, wxALL, 5);
     rightSizer->Add(m_messageView, 1, wxEXPAND | wxALL, 5);
 
-    m_messageView->Bind(wxEVT_LISTBOX, &CMainWindow::OnMessageSelected, this);
+    m_messageView->Bind(wxEVT_LIST_ITEM_SELECTED, &CMainWindow::OnMessageSelected, this);
+    m_messageView->Bind(wxEVT_LIST_CACHE_HINT, &CMainWindow::OnMessageCacheHint, this);
 
     auto* bottomSizer = new wxBoxSizer(wxHORIZONTAL);
     m_messageInputLabel = new wxStaticText(rightPanel, wxID_ANY, "Message:", wxDefaultPosition, wxDefaultSize);
@@ -188,338 +154,643 @@ CMainWindow::CMainWindow(wxSimplebook* book)
     m_sendButton->Bind(wxEVT_BUTTON, &CMainWindow::OnSendPressed, this);
     m_messageInput->Bind(wxEVT_TEXT_ENTER, &CMainWindow::OnSendPressed, this);
 
-    m_currentChatList = td::td_api::make_object<td::td_api::chatListMain>();
     m_chatList->SetFocus();
+
+    // The notification handler only reads the message, so it goes before the one that moves it into the chat.
+    m_subscriptions = {
+        m_updates.subscribe(this, &CMainWindow::OnUpdateChatFolders),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateNewChat),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateChatTitle),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateChatLastMessage),
+        m_updates.subscribe(this, &CMainWindow::OnNewMessageNotification),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateNewMessage),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateChatPosition),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateMessageContent),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateMessageEdited),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateMessageSendSucceeded),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateMessageSendFailed),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateDeleteMessages),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateChatReadInbox),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateUser),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateBasicGroup),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateSupergroup),
+        m_updates.subscribe(this, &CMainWindow::OnUpdateSecretChat),
+    };
+
+    RestoreSnapshot();
+    m_snapshotTimer.SetOwner(this, ID_SNAPSHOT_TIMER);
+    Bind(wxEVT_TIMER, &CMainWindow::OnSnapshotTimer, this, ID_SNAPSHOT_TIMER);
+    m_snapshotTimer.Start(static_cast<int>(CHAT_SNAPSHOT_SAVE_INTERVAL.count()));
+    m_prefetchTimer.SetOwner(this, ID_PREFETCH_TIMER);
+    Bind(wxEVT_TIMER, &CMainWindow::OnPrefetchTimer, this, ID_PREFETCH_TIMER);
+    m_pagingTimer.SetOwner(this, ID_PAGING_TIMER);
+    Bind(wxEVT_TIMER, &CMainWindow::OnPagingTimer, this, ID_PAGING_TIMER);
+    m_readTimer.SetOwner(this, ID_READ_TIMER);
+    Bind(wxEVT_TIMER, &CMainWindow::OnReadTimer, this, ID_READ_TIMER);
+}
+
+CMainWindow::~CMainWindow() {
+    m_snapshotTimer.Stop();
+    m_prefetchTimer.Stop();
+    m_pagingTimer.Stop();
+    m_readTimer.Stop();
+    SaveSnapshot();
+    for (auto id : m_subscriptions) {
+        m_updates.unsubscribe(id);
+    }
+}
+
+void CMainWindow::DiscardSnapshot() {
+    if (!m_snapshotPath.empty()) {
+        ChatSnapshot::discard(m_snapshotPath);
+        m_snapshotPath.clear();
+    }
+}
+
+void CMainWindow::RestoreSnapshot() {
+    // The store takes the chats as if TDLib had announced them; the real updateNewChat replaces each one later.
+    ChatSnapshot snapshot;
+    if (m_snapshotPath.empty() || !ChatSnapshot::load(m_snapshotPath, snapshot, m_chatStore, m_peers)) {
+        return;
+    }
+    m_snapshotChats.insert(snapshot.chat_ids.begin(), snapshot.chat_ids.end());
+
+    m_currentListId = snapshot.view.shown_list;
+    td::td_api::updateChatFolders folders;
+    folders.chat_folders_ = std::move(snapshot.folders);
+    OnUpdateChatFolders(folders);
+
+    RebuildChatList();
+    m_chatList->ScrollToRow(static_cast<long>(snapshot.view.chat_list_top_row));
+    if (m_chatStore.find(snapshot.view.open_chat_id)) {
+        OpenChat(snapshot.view.open_chat_id, snapshot.view.top_message_id);
+        SyncChatSelection();
+    }
 }
 
-void CMainWindow::LoadChats() {
-    if (!m_currentChatList)
+void CMainWindow::SaveSnapshot() {
+    if (m_snapshotPath.empty()) {
         return;
+    }
+    ChatSnapshot::View view;
+    view.shown_list = m_currentListId;
+    view.chat_list_top_row = m_chatList->GetTopItem();
+    view.open_chat_id = m_currentChatId;
+    const long topMessage = m_messageView->GetTopItem();
+    if (topMessage >= 0 && static_cast<std::size_t>(topMessage) < m_messageWindow.size()) {
+        view.top_message_id = m_messageWindow.at(topMessage)->id_;
+    }
 
-    td::td_api::object_ptr<td::td_api::ChatList> chat_list_to_load;
-    switch (m_currentChatList->get_id()) {
-        case td::td_api::chatListMain::ID:
-            chat_list_to_load = td::td_api::make_object<td::td_api::chatListMain>();
-            break;
-        case td::td_api::chatListArchive::ID:
-            chat_list_to_load = td::td_api::make_object<td::td_api::chatListArchive>();
-            break;
-        case td::td_api::chatListFolder::ID: {
-            auto* folder_list = static_cast<td::td_api::chatListFolder*>(m_currentChatList.get());
-            chat_list_to_load = td::td_api::make_object<td::td_api::chatListFolder>(folder_list->chat_folder_id_);
-            break;
+    // Only chats that are in some list are painted, and only the users that private chats take their titles from.
+    ChatSnapshotWriter writer(view);
+    for (const auto& folder : m_chatFolders) {
+        writer.addFolder(*folder);
+    }
+    m_chatStore.forEach([this, &writer](const ChatRecord& chat) {
+        if (chat.positions.empty()) {
+            return;
+        }
+        writer.addChat(m_chatStore, chat);
+        if (chat.kind == ChatRecord::KIND_PRIVATE) {
+            if (const UserRecord* user = m_peers.findUser(chat.user_id)) {
+                writer.addUser(m_peers, chat.user_id, *user);
+            }
+        }
+    });
+    writer.save(m_snapshotPath);
+}
+
+void CMainWindow::OnSnapshotTimer(wxTimerEvent& event) {
+    SaveSnapshot();
+}
+
+void CMainWindow::DropSnapshotChats(ChatListId list) {
+    for (auto chatId : m_snapshotChats) {
+        if (m_chatStore.rankOf(list, chatId) == ChatStore::npos) {
+            continue;
         }
+        ApplyChatMove(m_chatStore.setPosition(chatId, ChatPosition{list, 0, false}));
+    }
+    for (auto it = m_snapshotChats.begin(); it != m_snapshotChats.end();) {
+        const long long chatId = *it++;
+        CollectChat(chatId);
     }
+}
 
-    if (chat_list_to_load) {
-        g_mainFrame->getTdManager()->send(
-            td::td_api::make_object<td::td_api::loadChats>(std::move(chat_list_to_load), 100), {});
+void CMainWindow::CollectChat(long long chatId) {
+    // The open chat stays until it is left; anything else that is in no list is only kept as long as it is shown.
+    if (chatId != m_currentChatId && m_chatStore.collect(chatId)) {
+        m_chatRows.erase(chatId);
+        m_snapshotChats.erase(chatId);
+        if (m_parkedChats.erase(chatId)) {
+            CloseTdChat(chatId);
+        }
+        m_readTracker.forget(chatId);
     }
 }
 
-void CMainWindow::UpdateChatInList(long long chatId) {
-    auto it = m_chats.find(chatId);
-    if (it == m_chats.end()) {
+void CMainWindow::FetchChat(long long chatId) {
+    // TDLib announces a chat only once, so one that was collected and comes back into a list is asked for again.
+    if (!m_requestedChats.insert(chatId).second) {
         return;
     }
-    auto& chat = it->second;
-
-    if (chat->type_->get_id() == td::td_api::chatTypePrivate::ID) {
-        auto* privateChat = static_cast<td::td_api::chatTypePrivate*>(chat->type_.get());
-        GetUser(privateChat->user_id_, [this, chatId](const td::td_api::user* user) {
-            if (!user)
+    m_listScope.request(td::td_api::make_object<td::td_api::getChat>(chatId), TdManager::Priority::Background)
+        .then([this, chatId](TdResult<td::td_api::chat> chat) {
+            m_requestedChats.erase(chatId);
+            if (!chat.isOk() || m_chatStore.find(chatId)) {
                 return;
-            auto chat_it = m_chats.find(chatId);
-            if (chat_it != m_chats.end()) {
-                FormatAndUpdateChatListEntry(chat_it->second, user);
             }
+            for (const auto& move : m_chatStore.add(*chat.value)) {
+                ApplyChatMove(move);
+            }
+            StoreLastMessage(chatId, chat->last_message_.get());
+            // Positions that changed while the request was out may already have taken it out of every list again.
+            CollectChat(chatId);
         });
+}
+
+void CMainWindow::StoreLastMessage(long long chatId, const td::td_api::message* message) {
+    if (!message) {
+        m_chatStore.setLastMessage(chatId, 0, 0, {});
         return;
     }
-    FormatAndUpdateChatListEntry(chat, nullptr);
+    StoreLastMessage(chatId, message->id_, message->date_, message->content_.get());
 }
 
-void CMainWindow::FormatAndUpdateChatListEntry(const td::td_api::object_ptr<td::td_api::chat>& chat,
-                                               const td::td_api::user* user) {
-    long long chatId = chat->id_;
-    wxString display_str;
+void CMainWindow::StoreLastMessage(long long chatId, long long messageId, int date,
+                                   const td::td_api::MessageContent* content) {
+    m_formatter.begin().appendContentPreview(content).truncate(CHAT_PREVIEW_MAX_BYTES);
+    m_chatStore.setLastMessage(chatId, messageId, date, m_formatter.view());
+}
 
-    wxString type_prefix;
-    switch (chat->type_->get_id()) {
-        case td::td_api::chatTypePrivate::ID:
-            if (user && user->type_->get_id() == td::td_api::userTypeBot::ID) {
-                type_prefix = "Bot. ";
-            }
-            break;
-        case td::td_api::chatTypeBasicGroup::ID:
-            type_prefix = "Group. ";
-            break;
-        case td::td_api::chatTypeSecret::ID:
-            type_prefix = "Secret. ";
-            break;
-        case td::td_api::chatTypeSupergroup::ID: {
-            auto* sg = static_cast<const td::td_api::chatTypeSupergroup*>(chat->type_.get());
-            type_prefix = sg->is_channel_ ? "Channel. " : "Supergroup. ";
-            break;
-        }
+void CMainWindow::LoadChats(ChatListId list, TdManager::Priority priority) {
+    CChatListView& view = m_listViews[list];
+    if (view.loadRequested || view.allLoaded) {
+        return;
     }
-    display_str += type_prefix;
+    view.loadRequested = true;
+    // Not scoped to the shown list: the chats land in the store through updates whichever list is shown by then.
+    m_listScope.send(
+        td::td_api::make_object<td::td_api::loadChats>(ChatStore::makeChatList(list), 100),
+        [this, list](TdManager::Object result) {
+            CChatListView& view = m_listViews[list];
+            view.loadRequested = false;
+            if (result && result->get_id() == td::td_api::error::ID) {
+                // 404: TDLib has announced every chat of the list, so snapshot chats still unconfirmed are gone.
+                // Any other error leaves the rest of the list to the next time it is shown.
+                if (static_cast<const td::td_api::error&>(*result).code_ == 404) {
+                    view.allLoaded = true;
+                    DropSnapshotChats(list);
+                }
+                return;
+            }
+            // The next page goes on the background lane, so a large account fills in without holding up the rest.
+            LoadChats(list, TdManager::Priority::Background);
+        },
+        priority);
+}
 
-    if (user) {
-        display_str += wxString::FromUTF8(user->first_name_ + " " + user->last_name_);
+ChatListId CMainWindow::GetCurrentListId() const {
+    return m_currentListId;
+}
+
+void CMainWindow::ApplyChatMove(const ChatStore::Move& move) {
+    if (move.list != GetCurrentListId() || (move.from == ChatStore::npos && move.to == ChatStore::npos)) {
+        return;
+    }
+    const long count = static_cast<long>(m_chatStore.size(move.list));
+    if (m_chatList->GetItemCount() != count) {
+        m_chatList->SetItemCount(count);
+    }
+    // Rows between the old and the new rank now show other chats; when the chat entered or left the list, every
+    // row after that point shifted by one.
+    if (move.from == ChatStore::npos || move.to == ChatStore::npos) {
+        m_chatList->RefreshRows(static_cast<long>(std::min(move.from, move.to)), count - 1);
     } else {
-        display_str += wxString::FromUTF8(chat->title_);
+        m_chatList->RefreshRows(static_cast<long>(move.from), static_cast<long>(move.to));
     }
+    SyncChatSelection();
+}
 
-    if (user && user->is_premium_)
-        display_str += ", Premium account";
-
-    if (user && user->status_) {
-        wxString status_str;
-        switch (user->status_->get_id()) {
-            case td::td_api::userStatusOnline::ID:
-                status_str = "online";
-                break;
-            case td::td_api::userStatusOffline::ID: {
-                auto* offline = static_cast<const td::td_api::userStatusOffline*>(user->status_.get());
-                status_str = "last seen at " + FormatTimestamp(offline->was_online_);
-                break;
-            }
-            case td::td_api::userStatusRecently::ID:
-                status_str = "last seen recently";
-                break;
-            default:
-                break;
-        }
-        if (!status_str.IsEmpty()) {
-            display_str += ", " + status_str;
-        }
+void CMainWindow::UpdateChatInList(long long chatId, unsigned int changed) {
+    auto it = m_chatRows.find(chatId);
+    if (it == m_chatRows.end()) {
+        // Never shown yet: the row is formatted from scratch when it first comes on screen.
+        return;
     }
+    it->second.dirty |= changed;
 
-    if (chat->unread_count_ > 0) {
-        display_str += wxString::Format(", %d unread messages", chat->unread_count_);
+    // Rows off screen stay dirty until they are painted; a visible row is only repainted if its text changed.
+    const auto rank = m_chatStore.rankOf(GetCurrentListId(), chatId);
+    if (rank == ChatStore::npos) {
+        return;
     }
-
-    if (chat->last_message_) {
-        wxString timestamp = FormatTimestamp(chat->last_message_->date_);
-        wxString content_preview = FormatMessageContentPreview(chat->last_message_->content_.get());
-        display_str += wxString::Format(", received at %s: %s", timestamp, content_preview);
+    const long row = static_cast<long>(rank);
+    const long top = m_chatList->GetTopItem();
+    if (row < top || row > top + m_chatList->GetCountPerPage()) {
+        return;
     }
+    if (RenderChatRow(chatId, it->second)) {
+        m_chatList->RefreshItem(row);
+    }
+}
 
-    bool is_pinned = false;
-    long long order = 0x7FFFFFFFFFFFFFFF;
-    bool in_current_list = false;
+void CMainWindow::RebuildChatList() {
+    m_chatList->SetItemCount(static_cast<long>(m_chatStore.size(GetCurrentListId())));
+    m_chatList->Refresh();
+    SyncChatSelection();
+}
 
-    if (!chat->positions_.empty()) {
-        for (const auto& pos : chat->positions_) {
-            if (pos && IsPositionInCurrentList(pos->list_.get(), m_currentChatList.get())) {
-                order = pos->order_;
-                is_pinned = pos->is_pinned_;
-                in_current_list = true;
-                break;
-            }
-        }
+void CMainWindow::SyncChatSelection() {
+    // The control remembers the selection by row, so it has to follow the open chat when rows move under it.
+    const auto row = m_currentChatId != 0 ? m_chatStore.rankOf(GetCurrentListId(), m_currentChatId) : ChatStore::npos;
+    m_chatList->SelectRow(row == ChatStore::npos ? -1 : static_cast<long>(row));
+}
+
+wxString CMainWindow::FormatChatRow(long long chatId) {
+    if (!m_chatStore.find(chatId)) {
+        return wxString();
     }
-    if (!in_current_list)
-        return;
+    CChatRow& row = m_chatRows[chatId];
+    RenderChatRow(chatId, row);
+    return row.text;
+}
 
-    long long sortKey = (static_cast<long long>(is_pinned) << 62) | order;
+bool CMainWindow::RenderChatRow(long long chatId, CChatRow& row) {
+    if (row.dirty == 0) {
+        return false;
+    }
+    const ChatRecord* chat = m_chatStore.find(chatId);
+    if (!chat) {
+        return false;
+    }
 
-    CallAfter([this, chatId, display_str, sortKey]() {
-        m_chatList->Freeze();
-        for (unsigned int i = 0; i < m_chatList->GetCount(); ++i) {
-            auto* clientData = static_cast<CChatClientData*>(m_chatList->GetClientObject(i));
-            if (clientData && clientData->GetChatId() == chatId) {
-                m_chatList->Delete(i);
-                break;
-            }
-        }
-        unsigned int insertPos = 0;
-        for (; insertPos < m_chatList->GetCount(); ++insertPos) {
-            auto* existingClientData = static_cast<CChatClientData*>(m_chatList->GetClientObject(insertPos));
-            if (existingClientData && sortKey > existingClientData->GetSortKey()) {
-                break;
-            }
+    const UserRecord* user = nullptr;
+    if (chat->kind == ChatRecord::KIND_PRIVATE && (row.dirty & (ROW_TITLE | ROW_USER))) {
+        const long long userId = chat->user_id;
+        user = m_peers.findUser(userId);
+        if (!user && m_requestedUsers.insert(userId).second) {
+            // Only rows that get painted ask for their user, once each; these must not hold up what the user is
+            // doing.
+            GetUser(
+                m_folderScope, userId,
+                [this, chatId, userId](const UserRecord* fetched) {
+                    m_requestedUsers.erase(userId);
+                    if (fetched) {
+                        UpdateChatInList(chatId, ROW_TITLE | ROW_USER);
+                    }
+                },
+                TdManager::Priority::Background);
         }
-        m_chatList->Insert(display_str, insertPos);
-        m_chatList->SetClientObject(insertPos, new CChatClientData(chatId, sortKey));
-        m_chatList->Thaw();
-    });
-}
+    }
 
-void CMainWindow::ProcessChatUpdate(td::td_api::object_ptr<td::td_api::chat> chat) {
-    if (!chat) {
-        return;
+    // Each segment is formatted into the shared buffer and copied into the row's own string, which keeps its
+    // capacity from the last time; only a row whose text really changed pays for a new wxString.
+    if (row.dirty & (ROW_TITLE | ROW_USER)) {
+        AppendChatTitle(m_formatter.begin(), m_chatStore, *chat, m_peers, user);
+        row.title.assign(m_formatter.view());
+    }
+    if (row.dirty & ROW_USER) {
+        AppendUserStatus(m_formatter.begin(), user);
+        row.userStatus.assign(m_formatter.view());
+    }
+    if (row.dirty & ROW_UNREAD) {
+        AppendUnreadCount(m_formatter.begin(), *chat);
+        row.unread.assign(m_formatter.view());
+    }
+    if (row.dirty & ROW_LAST_MESSAGE) {
+        AppendLastMessage(m_formatter.begin(), *chat);
+        row.lastMessage.assign(m_formatter.view());
+    }
+    row.dirty = 0;
+
+    m_formatter.begin().append(row.title).append(row.userStatus).append(row.unread).append(row.lastMessage);
+    if (m_formatter.view() == row.utf8) {
+        return false;
     }
-    long long chatId = chat->id_;
-    m_chats[chatId] = std::move(chat);
-    UpdateChatInList(chatId);
+    row.utf8.assign(m_formatter.view());
+    row.text = m_formatter.finish();
+    return true;
 }
 
-wxString CMainWindow::FormatMessageForView(const td::td_api::message* message, const wxString& sender_name) {
+wxString CMainWindow::FormatMessageForView(const td::td_api::message* message) {
     if (!message)
         return "";
 
-    wxString sender_str = sender_name;
-    wxString content_str = FormatMessageContent(message->content_.get());
-    wxString timestamp_str = FormatTimestamp(message->date_);
-
-    wxString sign_str;
+    m_formatter.begin();
+    AppendSenderName(m_formatter, message);
     if (!message->author_signature_.empty()) {
-        auto chat_it = m_chats.find(message->chat_id_);
-        if (chat_it != m_chats.end()) {
-            if (chat_it->second->type_->get_id() == td::td_api::chatTypeSupergroup::ID) {
-                auto* sg = static_cast<const td::td_api::chatTypeSupergroup*>(chat_it->second->type_.get());
-                if (sg && sg->is_channel_) {
-                    sign_str = " user " + wxString::FromUTF8(message->author_signature_);
-                }
-            }
+        const ChatRecord* chat = m_chatStore.find(message->chat_id_);
+        if (chat && chat->kind == ChatRecord::KIND_CHANNEL) {
+            m_formatter.append(" user ").append(message->author_signature_);
         }
     }
-    return wxString::Format("%s%s: %s, received at %s", sender_str, sign_str, content_str, timestamp_str);
+    m_formatter.append(": ")
+        .appendContent(message->content_.get())
+        .append(", received at ")
+        .appendTimestamp(message->date_);
+    if (message->edit_date_ != 0) {
+        m_formatter.append(", edited at ").appendTimestamp(message->edit_date_);
+    }
+    // The view asks for the same rows on every repaint and scroll step; most of them read as they did last time.
+    return m_messageTexts.convert(m_formatter.view());
 }
 
-void CMainWindow::ProcessUpdate(td::td_api::object_ptr<td::td_api::Object> update) {
-    switch (update->get_id()) {
-        case td::td_api::updateChatFolders::ID: {
-            auto chatFoldersUpdate = td::td_api::move_object_as<td::td_api::updateChatFolders>(update);
+void CMainWindow::OnUpdateChatFolders(td::td_api::updateChatFolders& update) {
+    m_folderList->Freeze();
+    m_folderList->Clear();
+    m_chatFolders.clear();
+
+    m_folderList->Append("All Chats");
+    m_folderList->SetClientObject(0, new CFolderClientData(CFolderClientData::ALL_CHATS));
+    m_folderList->Append("Archive");
+    m_folderList->SetClientObject(1, new CFolderClientData(CFolderClientData::ARCHIVE));
+
+    for (const auto& chatFolderInfo : update.chat_folders_) {
+        int pos = m_folderList->GetCount();
+        if (chatFolderInfo && chatFolderInfo->name_) {
+            m_folderList->Append(utf8ToWxString(chatFolderInfo->name_->text_->text_));
+            m_folderList->SetClientObject(pos, new CFolderClientData(CFolderClientData::FOLDER, chatFolderInfo->id_));
+        }
+    }
+    // Kept for the snapshot.
+    for (auto& chatFolderInfo : update.chat_folders_) {
+        if (chatFolderInfo && chatFolderInfo->name_) {
+            m_chatFolders.push_back(std::move(chatFolderInfo));
+        }
+    }
 
-            auto folders_ptr = std::make_shared<std::vector<td::td_api::object_ptr<td::td_api::chatFolderInfo>>>(
-                std::move(chatFoldersUpdate->chat_folders_));
+    // Keep the shown list selected if it still exists; a removed folder falls back to all chats.
+    int selection = 0;
+    for (unsigned int i = 0; i < m_folderList->GetCount(); ++i) {
+        auto* clientData = static_cast<CFolderClientData*>(m_folderList->GetClientObject(i));
+        if (clientData && ListIdOf(*clientData) == m_currentListId) {
+            selection = static_cast<int>(i);
+            break;
+        }
+    }
+    m_folderList->SetSelection(selection);
+    m_folderList->Thaw();
+    if (selection == 0) {
+        ShowChatList(kMainChatList);
+    }
 
-            CallAfter([this, captured_folders_ptr = folders_ptr]() {
-                m_folderList->Freeze();
-                m_folderList->Clear();
-                m_chatFolders.clear();
+    // The shown list first, then every other one in the background, so that switching to it later finds its
+    // chats already in the store.
+    LoadChats(m_currentListId);
+    for (unsigned int i = 0; i < m_folderList->GetCount(); ++i) {
+        if (auto* clientData = static_cast<CFolderClientData*>(m_folderList->GetClientObject(i))) {
+            LoadChats(ListIdOf(*clientData), TdManager::Priority::Background);
+        }
+    }
+}
 
-                m_folderList->Append("All Chats");
-                m_folderList->SetClientObject(0, new CFolderClientData(CFolderClientData::ALL_CHATS));
-                m_folderList->Append("Archive");
-                m_folderList->SetClientObject(1, new CFolderClientData(CFolderClientData::ARCHIVE));
+void CMainWindow::OnUpdateNewChat(td::td_api::updateNewChat& update) {
+    if (!update.chat_) {
+        return;
+    }
+    const long long chatId = update.chat_->id_;
+    for (const auto& move : m_chatStore.add(*update.chat_)) {
+        ApplyChatMove(move);
+    }
+    StoreLastMessage(chatId, update.chat_->last_message_.get());
+    // A chat painted from the snapshot is now the live one; its row may read differently.
+    if (m_snapshotChats.erase(chatId) != 0) {
+        UpdateChatInList(chatId, ROW_ALL);
+    }
+}
 
-                for (const auto& chatFolderInfo : *captured_folders_ptr) {
-                    int pos = m_folderList->GetCount();
-                    if (chatFolderInfo && chatFolderInfo->name_) {
-                        m_folderList->Append(wxString::FromUTF8(chatFolderInfo->name_->text_->text_));
-                        m_folderList->SetClientObject(
-                            pos, new CFolderClientData(CFolderClientData::FOLDER, chatFolderInfo->id_));
-                    }
-                }
+void CMainWindow::OnUpdateChatTitle(td::td_api::updateChatTitle& update) {
+    if (m_chatStore.find(update.chat_id_)) {
+        m_chatStore.setTitle(update.chat_id_, update.title_);
+        UpdateChatInList(update.chat_id_, ROW_TITLE);
+    }
+}
 
-                m_folderList->SetSelection(0);
-                m_folderList->Thaw();
-            });
-            LoadChats();
-            break;
-        }
-        case td::td_api::updateNewChat::ID: {
-            ProcessChatUpdate(std::move(td::td_api::move_object_as<td::td_api::updateNewChat>(update)->chat_));
-            break;
-        }
-        case td::td_api::updateChatTitle::ID: {
-            auto title_update = td::td_api::move_object_as<td::td_api::updateChatTitle>(update);
-            auto it = m_chats.find(title_update->chat_id_);
-            if (it != m_chats.end()) {
-                it->second->title_ = title_update->title_;
-                UpdateChatInList(title_update->chat_id_);
+void CMainWindow::OnUpdateChatLastMessage(td::td_api::updateChatLastMessage& update) {
+    if (!m_chatStore.find(update.chat_id_)) {
+        for (const auto& position : update.positions_) {
+            if (position && position->order_ != 0) {
+                FetchChat(update.chat_id_);
+                break;
             }
-            break;
         }
-        case td::td_api::updateChatLastMessage::ID: {
-            auto last_msg_update = td::td_api::move_object_as<td::td_api::updateChatLastMessage>(update);
-            auto it = m_chats.find(last_msg_update->chat_id_);
-            if (it != m_chats.end()) {
-                it->second->last_message_ = std::move(last_msg_update->last_message_);
-                it->second->positions_ = std::move(last_msg_update->positions_);
-                UpdateChatInList(last_msg_update->chat_id_);
-            }
-            break;
+        return;
+    }
+    StoreLastMessage(update.chat_id_, update.last_message_.get());
+    for (const auto& position : update.positions_) {
+        if (position) {
+            ApplyChatMove(m_chatStore.setPosition(update.chat_id_, *position));
         }
-        case td::td_api::updateNewMessage::ID: {
-            auto msg_update = td::td_api::move_object_as<td::td_api::updateNewMessage>(update);
-            if (msg_update->message_->chat_id_ == m_currentChatId) {
-                AppendMessage(msg_update->message_);
-            }
-            auto it = m_chats.find(msg_update->message_->chat_id_);
-            if (it != m_chats.end()) {
-                if (!it->second->default_disable_notification_) {
-                    wxString title = wxString::FromUTF8(it->second->title_);
-                    wxString content = "No content";
-                    if (it->second->last_message_ && it->second->last_message_->content_) {
-                        content = FormatMessageContent(&*it->second->last_message_->content_);
-                    }
-                    g_notificationSender.Send(title, content);
-                }
-                it->second->unread_count_++;
-                it->second->last_message_ = std::move(msg_update->message_);
-                UpdateChatInList(it->first);
+    }
+    UpdateChatInList(update.chat_id_, ROW_LAST_MESSAGE);
+    CollectChat(update.chat_id_);
+}
+
+void CMainWindow::OnNewMessageNotification(td::td_api::updateNewMessage& update) {
+    const auto& message = update.message_;
+    if (!message) {
+        return;
+    }
+    const ChatRecord* chat = m_chatStore.find(message->chat_id_);
+    if (!chat || chat->default_disable_notification) {
+        return;
+    }
+    wxString title = utf8ToWxString(m_chatStore.title(*chat));
+    wxString content = "No content";
+    if (message->content_) {
+        content = m_formatter.begin().appendContent(message->content_.get()).finish();
+    }
+    g_notificationSender.Send(title, content);
+}
+
+void CMainWindow::OnUpdateNewMessage(td::td_api::updateNewMessage& update) {
+    const long long chatId = update.message_->chat_id_;
+    auto* chat = m_chatStore.find(chatId);
+    if (chat) {
+        chat->unread_count++;
+    }
+    // The open chat's message goes into the message window; its preview follows from the updateChatLastMessage
+    // that TDLib sends for every new last message. Other chats keep only the preview.
+    if (chatId == m_currentChatId) {
+        AppendMessage(std::move(update.message_));
+    } else if (chat) {
+        StoreLastMessage(chatId, update.message_.get());
+        if (auto* cached = FindCachedWindow(chatId); cached && cached->addLatest(std::move(update.message_))) {
+            if (cached->size() > MESSAGE_WINDOW_MAX_MESSAGES) {
+                cached->evictOlder(cached->size() - MESSAGE_WINDOW_MAX_MESSAGES);
             }
-            break;
         }
-        case td::td_api::updateChatPosition::ID: {
-            auto pos_update = td::td_api::move_object_as<td::td_api::updateChatPosition>(update);
-            auto it = m_chats.find(pos_update->chat_id_);
-            if (it != m_chats.end()) {
-                bool found = false;
-                for (auto& pos : it->second->positions_) {
-                    if (pos->list_->get_id() == pos_update->position_->list_->get_id()) {
-                        pos = std::move(pos_update->position_);
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    it->second->positions_.push_back(std::move(pos_update->position_));
-                }
-                UpdateChatInList(pos_update->chat_id_);
-            }
-            break;
+    }
+    if (chat) {
+        UpdateChatInList(chatId, ROW_UNREAD | ROW_LAST_MESSAGE);
+    }
+}
+
+void CMainWindow::OnUpdateChatPosition(td::td_api::updateChatPosition& update) {
+    if (!update.position_) {
+        return;
+    }
+    if (!m_chatStore.find(update.chat_id_)) {
+        if (update.position_->order_ != 0) {
+            FetchChat(update.chat_id_);
         }
-        case td::td_api::updateMessageContent::ID: {
-            auto content_update = td::td_api::move_object_as<td::td_api::updateMessageContent>(update);
-            if (content_update->chat_id_ == m_currentChatId) {
-                m_lastMessageId = 0;
-                LoadMessages(m_currentChatId);
-            }
-            auto it = m_chats.find(content_update->chat_id_);
-            if (it != m_chats.end() && it->second->last_message_ &&
-                it->second->last_message_->id_ == content_update->message_id_) {
-                UpdateChatInList(content_update->chat_id_);
-            }
-            break;
+        return;
+    }
+    ApplyChatMove(m_chatStore.setPosition(update.chat_id_, *update.position_));
+    CollectChat(update.chat_id_);
+}
+
+void CMainWindow::OnUpdateMessageContent(td::td_api::updateMessageContent& update) {
+    // The preview is taken before the content moves into the message window.
+    const ChatRecord* chat = m_chatStore.find(update.chat_id_);
+    if (chat && chat->last_message_id == update.message_id_) {
+        StoreLastMessage(update.chat_id_, chat->last_message_id, chat->last_message_date, update.new_content_.get());
+        UpdateChatInList(update.chat_id_, ROW_LAST_MESSAGE);
+    }
+    // Only the edited message's row is repainted, however busy the chat.
+    MessageWindow* window = FindWindow(update.chat_id_);
+    if (!window) {
+        return;
+    }
+    if (auto* message = window->find(update.message_id_)) {
+        message->content_ = std::move(update.new_content_);
+        if (window == &m_messageWindow) {
+            m_messageView->RefreshItem(static_cast<long>(m_messageWindow.indexOf(update.message_id_)));
         }
-        case td::td_api::updateChatReadInbox::ID: {
-            auto read_update = td::td_api::move_object_as<td::td_api::updateChatReadInbox>(update);
-            auto it = m_chats.find(read_update->chat_id_);
-            if (it != m_chats.end()) {
-                it->second->unread_count_ = read_update->unread_count_;
-                UpdateChatInList(read_update->chat_id_);
-            }
-            break;
+    }
+}
+
+void CMainWindow::OnUpdateMessageEdited(td::td_api::updateMessageEdited& update) {
+    MessageWindow* window = FindWindow(update.chat_id_);
+    if (!window) {
+        return;
+    }
+    if (auto* message = window->find(update.message_id_)) {
+        message->edit_date_ = update.edit_date_;
+        if (window == &m_messageWindow) {
+            m_messageView->RefreshItem(static_cast<long>(m_messageWindow.indexOf(update.message_id_)));
         }
-        case td::td_api::updateUser::ID: {
-            auto user_update = td::td_api::move_object_as<td::td_api::updateUser>(update);
-            m_users[user_update->user_->id_] = std::move(user_update->user_);
-            break;
+    }
+}
+
+void CMainWindow::OnUpdateMessageSendSucceeded(td::td_api::updateMessageSendSucceeded& update) {
+    ReplaceMessage(update.old_message_id_, std::move(update.message_));
+}
+
+void CMainWindow::OnUpdateMessageSendFailed(td::td_api::updateMessageSendFailed& update) {
+    // A failed message gets a new id too, and stays in the chat marked as failed.
+    ReplaceMessage(update.old_message_id_, std::move(update.message_));
+}
+
+void CMainWindow::ReplaceMessage(long long oldId, td::td_api::object_ptr<td::td_api::message> message) {
+    if (!message) {
+        return;
+    }
+    MessageWindow* window = FindWindow(message->chat_id_);
+    if (!window) {
+        return;
+    }
+    if (window != &m_messageWindow) {
+        window->replace(oldId, std::move(message));
+        return;
+    }
+    const auto oldRow = m_messageWindow.indexOf(oldId);
+    const auto row = m_messageWindow.replace(oldId, std::move(message));
+    if (row == MessageWindow::npos) {
+        return;
+    }
+    m_messageView->RefreshRows(static_cast<long>(oldRow), static_cast<long>(row));
+    if (row != oldRow && m_messageView->GetSelectedRow() == static_cast<long>(oldRow)) {
+        m_messageView->SelectRow(static_cast<long>(row));
+    }
+}
+
+void CMainWindow::OnUpdateDeleteMessages(td::td_api::updateDeleteMessages& update) {
+    // Messages TDLib only dropped from its cache still exist, and the window may keep them.
+    if (update.from_cache_) {
+        return;
+    }
+    MessageWindow* window = FindWindow(update.chat_id_);
+    if (!window) {
+        return;
+    }
+    if (window != &m_messageWindow) {
+        for (auto messageId : update.message_ids_) {
+            window->remove(messageId);
         }
-        case td::td_api::updateBasicGroup::ID: {
-            auto basic_group_update = td::td_api::move_object_as<td::td_api::updateBasicGroup>(update);
-            m_basicGroups[basic_group_update->basic_group_->id_] = std::move(basic_group_update->basic_group_);
-            break;
+        return;
+    }
+
+    // The top row and the selection follow their messages as rows above them go away.
+    const long top = m_messageView->GetTopItem();
+    long newTop = top;
+    long selected = m_messageView->GetSelectedRow();
+    long firstRemoved = -1;
+    for (auto messageId : update.message_ids_) {
+        const auto removed = m_messageWindow.remove(messageId);
+        if (removed == MessageWindow::npos) {
+            continue;
         }
-        case td::td_api::updateSupergroup::ID: {
-            auto supergroup_update = td::td_api::move_object_as<td::td_api::updateSupergroup>(update);
-            m_supergroups[supergroup_update->supergroup_->id_] = std::move(supergroup_update->supergroup_);
-            break;
+        const long row = static_cast<long>(removed);
+        firstRemoved = firstRemoved == -1 ? row : std::min(firstRemoved, row);
+        if (row < newTop) {
+            --newTop;
         }
-        case td::td_api::updateSecretChat::ID: {
-            auto secret_chat_update = td::td_api::move_object_as<td::td_api::updateSecretChat>(update);
-            m_secretChats[secret_chat_update->secret_chat_->id_] = std::move(secret_chat_update->secret_chat_);
-            break;
+        if (row == selected) {
+            selected = -1;
+        } else if (row < selected) {
+            --selected;
         }
-        default:
-            break;
     }
+    if (firstRemoved == -1) {
+        return;
+    }
+    const long count = static_cast<long>(m_messageWindow.size());
+    m_messageView->Freeze();
+    m_messageView->SetItemCount(count);
+    if (firstRemoved < count) {
+        m_messageView->RefreshRows(firstRemoved, count - 1);
+    }
+    if (newTop != top) {
+        m_messageView->ScrollToRow(newTop);
+    }
+    m_messageView->SelectRow(selected);
+    m_messageView->Thaw();
+}
+
+MessageWindow* CMainWindow::FindWindow(long long chatId) {
+    if (chatId != 0 && chatId == m_currentChatId) {
+        return &m_messageWindow;
+    }
+    return FindCachedWindow(chatId);
+}
+
+void CMainWindow::OnUpdateChatReadInbox(td::td_api::updateChatReadInbox& update) {
+    m_readTracker.setReadUpTo(update.chat_id_, update.last_read_inbox_message_id_);
+    if (auto* chat = m_chatStore.find(update.chat_id_)) {
+        chat->unread_count = update.unread_count_;
+        UpdateChatInList(update.chat_id_, ROW_UNREAD);
+    }
+}
+
+void CMainWindow::OnUpdateUser(td::td_api::updateUser& update) {
+    const long long userId = update.user_->id_;
+    m_peers.setUser(*update.user_);
+    // A private chat has the same id as its user.
+    UpdateChatInList(userId, ROW_TITLE | ROW_USER);
+}
+
+void CMainWindow::OnUpdateBasicGroup(td::td_api::updateBasicGroup& update) {
+    m_peers.setBasicGroup(*update.basic_group_);
+}
+
+void CMainWindow::OnUpdateSupergroup(td::td_api::updateSupergroup& update) {
+    m_peers.setSupergroup(*update.supergroup_);
+}
+
+void CMainWindow::OnUpdateSecretChat(td::td_api::updateSecretChat& update) {
+    m_peers.setSecretChat(*update.secret_chat_);
 }
 
 void CMainWindow::OnFolderSelected(wxCommandEvent& event) {
@@ -529,235 +800,487 @@ void CMainWindow::OnFolderSelected(wxCommandEvent& event) {
     auto* clientData = static_cast<CFolderClientData*>(m_folderList->GetClientObject(selectedIndex));
     if (!clientData)
         return;
+    ShowChatList(ListIdOf(*clientData));
+}
 
-    switch (clientData->GetType()) {
-        case CFolderClientData::ALL_CHATS:
-            m_currentChatList = td::td_api::make_object<td::td_api::chatListMain>();
-            break;
-        case CFolderClientData::ARCHIVE:
-            m_currentChatList = td::td_api::make_object<td::td_api::chatListArchive>();
-            break;
-        case CFolderClientData::FOLDER:
-            m_currentChatList = td::td_api::make_object<td::td_api::chatListFolder>(clientData->GetFolderId());
-            break;
+void CMainWindow::ShowChatList(ChatListId list) {
+    if (list == m_currentListId) {
+        return;
     }
+    m_listViews[m_currentListId].topRow = m_chatList->GetTopItem();
+    m_currentListId = list;
+
+    // Nothing still on its way for the previous list or its open chat is wanted any more.
+    m_folderScope.reset();
+    m_chatScope.reset();
+    m_requestedUsers.clear();
+    m_olderPage = CPageRequest{};
+    m_newerPage = CPageRequest{};
+
+    ParkOpenChat();
+    m_messageView->SetItemCount(0);
+
+    // Every list's order is kept up to date as positions change, so the new one is ready: only its length and the
+    // place it was scrolled to have to be restored. Rows already formatted for another list are reused by chat id.
+    m_chatList->Freeze();
+    RebuildChatList();
+    m_chatList->ScrollToRow(m_listViews[list].topRow);
+    m_chatList->Thaw();
+
+    LoadChats(list, TdManager::Priority::Interactive);
+    SchedulePrefetch();
+}
 
-    m_chatList->Clear();
-    m_messageView->Clear();
-    m_currentChatId = 0;
-    m_lastMessageId = 0;
+void CMainWindow::OnChatSelected(wxListEvent& event) {
+    long long chatId = m_chatStore.chatAt(GetCurrentListId(), event.GetIndex());
+    if (chatId != 0 && chatId != m_currentChatId) {
+        OpenChat(chatId);
+    }
+}
 
-    for (const auto& chat_pair : m_chats) {
-        UpdateChatInList(chat_pair.first);
+void CMainWindow::OpenChat(long long chatId, long long topMessageId) {
+    const long long previousChatId = m_currentChatId;
+    // History and sender lookups for the chat being left are dropped before any of them gets formatted, and a page
+    // still loading for it must not block the one for the new chat.
+    m_chatScope.reset();
+    m_olderPage = CPageRequest{};
+    m_newerPage = CPageRequest{};
+    ParkOpenChat();
+    m_currentChatId = chatId;
+
+    MessageWindowCache::Entry cached;
+    if (m_parkedChats.take(chatId, cached)) {
+        // Still open in TDLib and kept current while parked, so it is shown as it was left.
+        m_messageWindow = std::move(cached.window);
+        ShowMessageWindow(topMessageId != 0 ? topMessageId : cached.top_message_id, cached.selected_message_id);
+    } else if (m_prefetchedChats.take(chatId, cached) && !cached.window.empty()) {
+        m_client.send(td::td_api::make_object<td::td_api::openChat>(chatId), nullptr, TdManager::Priority::Interactive);
+        m_messageWindow = std::move(cached.window);
+        ShowMessageWindow(topMessageId, 0);
+    } else {
+        m_restoreMessageId = topMessageId;
+        m_client.send(td::td_api::make_object<td::td_api::openChat>(chatId), nullptr, TdManager::Priority::Interactive);
+        m_messageWindow.reset(chatId);
+        m_messageView->SetItemCount(0);
+        LoadMessages(true);
+    }
+    // The chat just left may have been kept only because it was open.
+    if (previousChatId != 0) {
+        CollectChat(previousChatId);
     }
+    SchedulePrefetch();
+}
 
-    LoadChats();
+void CMainWindow::ShowMessageWindow(long long topMessageId, long long selectedMessageId) {
+    const long count = static_cast<long>(m_messageWindow.size());
+    const auto top = m_messageWindow.indexOf(topMessageId);
+    const long perPage = std::max(1, m_messageView->GetCountPerPage());
+    m_messageView->SetItemCount(count);
+    m_messageView->Refresh();
+    m_messageView->ScrollToRow(top != MessageWindow::npos ? static_cast<long>(top) : std::max(0L, count - perPage));
+    const auto selected = m_messageWindow.indexOf(selectedMessageId);
+    m_messageView->SelectRow(selected != MessageWindow::npos ? static_cast<long>(selected) : -1);
+    OnMessageViewed();
 }
 
-void CMainWindow::OnChatSelected(wxCommandEvent& event) {
-    int selectedIndex = m_chatList->GetSelection();
-    if (selectedIndex == wxNOT_FOUND)
+void CMainWindow::ParkOpenChat() {
+    if (m_currentChatId == 0) {
         return;
-    auto* clientData = static_cast<CChatClientData*>(m_chatList->GetClientObject(selectedIndex));
-    if (!clientData)
+    }
+    if (m_messageWindow.empty()) {
+        // Nothing arrived yet, so there is nothing to show when the reader comes back.
+        CloseTdChat(m_currentChatId);
+        m_currentChatId = 0;
         return;
+    }
+    MessageWindowCache::Entry entry;
+    const long top = m_messageView->GetTopItem();
+    const long selected = m_messageView->GetSelectedRow();
+    const long count = static_cast<long>(m_messageWindow.size());
+    entry.top_message_id = top >= 0 && top < count ? m_messageWindow.at(top)->id_ : 0;
+    entry.selected_message_id = selected >= 0 && selected < count ? m_messageWindow.at(selected)->id_ : 0;
+    entry.window = std::move(m_messageWindow);
+    m_messageWindow.reset(0);
+    m_currentChatId = 0;
+    if (const long long evicted = m_parkedChats.park(std::move(entry))) {
+        CloseTdChat(evicted);
+    }
+}
 
-    long long chatId = clientData->GetChatId();
-    if (chatId != 0 && chatId != m_currentChatId) {
-        if (m_currentChatId != 0) {
-            g_mainFrame->getTdManager()->send(td::td_api::make_object<td::td_api::closeChat>(m_currentChatId));
+void CMainWindow::CloseTdChat(long long chatId) {
+    // Reads not reported yet go first, while TDLib still counts the chat as open.
+    FlushReadReceipts();
+    m_client.send(td::td_api::make_object<td::td_api::closeChat>(chatId), nullptr, TdManager::Priority::Interactive);
+}
+
+MessageWindow* CMainWindow::FindCachedWindow(long long chatId) {
+    if (MessageWindow* parked = m_parkedChats.find(chatId)) {
+        return parked;
+    }
+    return m_prefetchedChats.find(chatId);
+}
+
+void CMainWindow::SchedulePrefetch() {
+    // Restarted on every move, so nothing is fetched while the reader is still scrolling through the list.
+    m_prefetchTimer.StartOnce(static_cast<int>(CHAT_PREFETCH_DELAY.count()));
+}
+
+void CMainWindow::OnPrefetchTimer(wxTimerEvent& event) {
+    // Pages for chats that are no longer likely make room for the ones that are.
+    const std::vector<long long> likely = GetLikelyChats();
+    std::vector<long long> stale;
+    m_prefetchedChats.forEachChat([&likely, &stale](long long chatId) {
+        if (std::find(likely.begin(), likely.end(), chatId) == likely.end()) {
+            stale.push_back(chatId);
+        }
+    });
+    for (long long chatId : stale) {
+        m_prefetchedChats.erase(chatId);
+    }
+    PrefetchLikelyChats();
+}
+
+std::vector<long long> CMainWindow::GetLikelyChats() const {
+    const ChatListId list = GetCurrentListId();
+    std::vector<long long> likely;
+    auto consider = [this, &likely](long long chatId) {
+        if (chatId != 0 && chatId != m_currentChatId && likely.size() < CHAT_PREFETCH_MAX_CHATS &&
+            std::find(likely.begin(), likely.end(), chatId) == likely.end()) {
+            likely.push_back(chatId);
+        }
+    };
+
+    // Moving through the list with the arrow keys opens the neighbours next.
+    long focused = m_chatList->GetFocusedItem();
+    if (focused < 0) {
+        focused = m_chatList->GetTopItem();
+    }
+    for (long distance = 1; distance <= CHAT_PREFETCH_NEIGHBOURS; ++distance) {
+        consider(m_chatStore.chatAt(list, static_cast<std::size_t>(focused + distance)));
+        if (focused >= distance) {
+            consider(m_chatStore.chatAt(list, static_cast<std::size_t>(focused - distance)));
+        }
+    }
+    // Pinned chats come first in the list order, so one pass from the top finds them before the unread ones.
+    const std::size_t count = m_chatStore.size(list);
+    for (std::size_t rank = 0; rank < count && likely.size() < CHAT_PREFETCH_MAX_CHATS; ++rank) {
+        const long long chatId = m_chatStore.chatAt(list, rank);
+        const ChatRecord* chat = m_chatStore.find(chatId);
+        if (!chat) {
+            continue;
+        }
+        const ChatPosition* position = ChatStore::positionIn(*chat, list);
+        if ((position && position->is_pinned) || chat->unread_count > 0) {
+            consider(chatId);
+        }
+    }
+    return likely;
+}
+
+void CMainWindow::PrefetchLikelyChats() {
+    for (long long chatId : GetLikelyChats()) {
+        if (m_prefetchingChats.size() >= CHAT_PREFETCH_MAX_IN_FLIGHT) {
+            return;
+        }
+        if (!m_parkedChats.find(chatId) && !m_prefetchedChats.find(chatId) && m_prefetchingChats.count(chatId) == 0) {
+            PrefetchChat(chatId);
         }
-        m_currentChatId = chatId;
-        g_mainFrame->getTdManager()->send(td::td_api::make_object<td::td_api::openChat>(m_currentChatId));
-        m_messageView->Clear();
-        m_lastMessageId = 0;
-        LoadMessages(m_currentChatId);
     }
 }
 
-void CMainWindow::OnMessageSelected(wxCommandEvent& event) {
-    LoadMessages(m_currentChatId);
+void CMainWindow::PrefetchChat(long long chatId) {
+    m_prefetchingChats.insert(chatId);
+    auto getHistory = td::td_api::make_object<td::td_api::getChatHistory>(chatId, 0, 0, MESSAGE_PAGE_SIZE, false);
+    m_prefetchScope.request(std::move(getHistory), TdManager::Priority::Background)
+        .then([this, chatId](TdResult<td::td_api::messages> history) {
+            if (!history.isOk()) {
+                // Not retried until the reader moves again, so a failing chat cannot keep the lane busy.
+                m_prefetchingChats.erase(chatId);
+                return;
+            }
+            RequestSenders(m_prefetchScope, history->messages_, TdManager::Priority::Background)
+                .then([this, chatId, messages = std::move(history->messages_)](
+                          std::vector<TdResult<td::td_api::user>> users) mutable {
+                    for (auto& user : users) {
+                        if (user.isOk()) {
+                            m_peers.setUser(*user.value);
+                        }
+                    }
+                    m_prefetchingChats.erase(chatId);
+                    // Opened or parked while the page was on its way: that window is the one that counts.
+                    if (chatId != m_currentChatId && !m_parkedChats.find(chatId) && m_chatStore.find(chatId)) {
+                        MessageWindowCache::Entry entry;
+                        entry.window.reset(chatId);
+                        entry.window.addOlder(std::move(messages));
+                        m_prefetchedChats.park(std::move(entry));
+                    }
+                    PrefetchLikelyChats();
+                });
+        });
+}
+
+void CMainWindow::OnMessageSelected(wxListEvent& event) {
+    // Moving the selection within the page changes nothing; paging follows the rows on screen.
+    CheckVisibleMessagePaging();
     OnMessageViewed();
     event.Skip();
 }
 
-void CMainWindow::GetUser(long long userId, std::function<void(const td::td_api::user*)> callback) {
-    auto it = m_users.find(userId);
-    if (it != m_users.end()) {
-        callback(it->second.get());
+void CMainWindow::OnMessageCacheHint(wxListEvent& event) {
+    CheckMessagePaging(event.GetCacheFrom(), event.GetCacheTo());
+}
+
+void CMainWindow::CheckMessagePaging(long first, long last) {
+    if (m_messageWindow.empty()) {
+        return;
+    }
+    // Both ends are looked at: a short window can be near both, and each direction has its own request.
+    if (first < MESSAGE_PREFETCH_ROWS) {
+        LoadMessages(true);
+    }
+    if (last + MESSAGE_PREFETCH_ROWS >= static_cast<long>(m_messageWindow.size())) {
+        LoadMessages(false);
+    }
+}
+
+void CMainWindow::CheckVisibleMessagePaging() {
+    const long top = m_messageView->GetTopItem();
+    CheckMessagePaging(top, top + std::max(1, m_messageView->GetCountPerPage()) - 1);
+}
+
+void CMainWindow::OnPagingTimer(wxTimerEvent& event) {
+    CheckVisibleMessagePaging();
+}
+
+void CMainWindow::GetUser(RequestScope& scope, long long userId,
+                          std::function<void(const UserRecord*)> callback, TdManager::Priority priority) {
+    if (const UserRecord* user = m_peers.findUser(userId)) {
+        callback(user);
     } else {
-        g_mainFrame->getTdManager()->send(td::td_api::make_object<td::td_api::getUser>(userId),
-                                          [this, userId, callback](TdManager::Object userObject) {
-                                              if (userObject->get_id() == td::td_api::user::ID) {
-                                                  auto user = td::td_api::move_object_as<td::td_api::user>(userObject);
-                                                  m_users[userId] = std::move(user);
-                                                  callback(m_users[userId].get());
-                                              } else {
-                                                  callback(nullptr);
-                                              }
-                                          });
+        scope.request(td::td_api::make_object<td::td_api::getUser>(userId), priority)
+            .then([this, userId, callback](TdResult<td::td_api::user> user) {
+                if (!user.isOk()) {
+                    callback(nullptr);
+                    return;
+                }
+                callback(&m_peers.setUser(*user.value));
+            });
     }
 }
 
-void CMainWindow::LoadMessages(long long chatId) {
-    if (m_loadingMore || chatId == 0)
+void CMainWindow::AppendSenderName(RowFormatter& formatter, const td::td_api::message* message) {
+    if (message->sender_id_->get_id() == td::td_api::messageSenderUser::ID) {
+        auto userId = static_cast<const td::td_api::messageSenderUser*>(message->sender_id_.get())->user_id_;
+        const UserRecord* user = m_peers.findUser(userId);
+        if (!user) {
+            formatter.append("Unknown User");
+            return;
+        }
+        formatter.append(m_peers.firstName(*user)).append(" ").append(m_peers.lastName(*user));
         return;
-    m_loadingMore = true;
+    }
+    if (message->sender_id_->get_id() == td::td_api::messageSenderChat::ID) {
+        auto senderChatId = static_cast<const td::td_api::messageSenderChat*>(message->sender_id_.get())->chat_id_;
+        if (const ChatRecord* chat = m_chatStore.find(senderChatId)) {
+            formatter.append(m_chatStore.title(*chat));
+            return;
+        }
+    }
+    formatter.append("Unknown");
+}
 
-    if (chatId != m_currentChatId) {
-        m_messageView->Clear();
-        m_currentChatId = chatId;
-        m_lastMessageId = 0;
+TdFuture<std::vector<TdResult<td::td_api::user>>> CMainWindow::RequestSenders(
+    RequestScope& scope, const std::vector<td::td_api::object_ptr<td::td_api::message>>& messages,
+    TdManager::Priority priority) {
+    // Every unknown sender is requested at once.
+    std::vector<long long> requestedUserIds;
+    std::vector<TdFuture<TdResult<td::td_api::user>>> senderRequests;
+    for (const auto& message : messages) {
+        if (!message || message->sender_id_->get_id() != td::td_api::messageSenderUser::ID) {
+            continue;
+        }
+        auto userId = static_cast<const td::td_api::messageSenderUser*>(message->sender_id_.get())->user_id_;
+        if (!m_peers.findUser(userId) &&
+            std::find(requestedUserIds.begin(), requestedUserIds.end(), userId) == requestedUserIds.end()) {
+            requestedUserIds.push_back(userId);
+            senderRequests.push_back(scope.request(td::td_api::make_object<td::td_api::getUser>(userId), priority));
+        }
     }
+    return whenAll(std::move(senderRequests));
+}
 
-    auto getHistory = td::td_api::make_object<td::td_api::getChatHistory>(chatId, m_lastMessageId, 0, 50, false);
-    g_mainFrame->getTdManager()->send(std::move(getHistory), [this, chatId](TdManager::Object object) {
-        m_loadingMore = false;
-        if (object->get_id() == td::td_api::messages::ID) {
-            auto messages = td::td_api::move_object_as<td::td_api::messages>(object);
-            if (messages->messages_.empty()) {
+void CMainWindow::LoadMessages(bool older) {
+    CPageRequest& page = older ? m_olderPage : m_newerPage;
+    if (page.inFlight || m_currentChatId == 0 ||
+        (older ? m_messageWindow.reachedOldest() : m_messageWindow.reachedNewest())) {
+        return;
+    }
+    // Holding a scroll key would otherwise ask for a page per repaint. The view is looked at again when the
+    // interval is over, wherever it has got to by then.
+    const auto now = std::chrono::steady_clock::now();
+    const auto wait = page.sentAt + MESSAGE_PAGE_MIN_INTERVAL - now;
+    if (wait > std::chrono::steady_clock::duration::zero()) {
+        if (!m_pagingTimer.IsRunning()) {
+            const auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(wait).count() + 1;
+            m_pagingTimer.StartOnce(static_cast<int>(waitMs));
+        }
+        return;
+    }
+    page.inFlight = true;
+    page.sentAt = now;
+
+    // Older pages continue below the oldest loaded message (from the newest one when nothing is loaded yet); newer
+    // pages ask for the messages above the newest loaded one with a negative offset.
+    const long long chatId = m_currentChatId;
+    const long long fromId = older ? m_messageWindow.getOldestId() : m_messageWindow.getNewestId();
+    const int offset = older ? 0 : -MESSAGE_PAGE_SIZE;
+    const int limit = older ? MESSAGE_PAGE_SIZE : MESSAGE_PAGE_SIZE + 1;
+    auto getHistory = td::td_api::make_object<td::td_api::getChatHistory>(chatId, fromId, offset, limit, false);
+    m_chatScope.request(std::move(getHistory), TdManager::Priority::Interactive)
+        .then([this, older, fromId](TdResult<td::td_api::messages> history) {
+            if (!history.isOk()) {
+                (older ? m_olderPage : m_newerPage).inFlight = false;
                 return;
             }
-            m_lastMessageId = messages->messages_.back()->id_;
-
-            auto message_queue = std::make_shared<std::vector<td::td_api::object_ptr<td::td_api::message>>>(
-                std::move(messages->messages_));
-            auto history_strs = std::make_shared<std::vector<wxString>>(message_queue->size());
-            auto message_data = std::make_shared<std::vector<std::pair<long long, long long>>>(message_queue->size());
-            auto completed_count = std::make_shared<std::atomic<size_t>>(0);
-            size_t total_messages = message_queue->size();
-
-            size_t i = 0;
-            for (auto it = message_queue->rbegin(); it != message_queue->rend(); ++it, ++i) {
-                const auto& message = *it;
-                const size_t history_idx = i;
-
-                (*message_data)[history_idx] = std::make_pair(message->id_, message->chat_id_);
-
-                long long sender_user_id = 0;
-                wxString sender_name = "Unknown";
-
-                if (message->sender_id_->get_id() == td::td_api::messageSenderUser::ID) {
-                    sender_user_id =
-                        static_cast<const td::td_api::messageSenderUser*>(message->sender_id_.get())->user_id_;
-                } else if (message->sender_id_->get_id() == td::td_api::messageSenderChat::ID) {
-                    auto sender_chat_id =
-                        static_cast<const td::td_api::messageSenderChat*>(message->sender_id_.get())->chat_id_;
-                    auto chat_it = m_chats.find(sender_chat_id);
-                    if (chat_it != m_chats.end()) {
-                        sender_name = wxString::FromUTF8(chat_it->second->title_);
-                    }
-                    (*history_strs)[history_idx] = FormatMessageForView(message.get(), sender_name);
-                    if (++(*completed_count) == total_messages) {
-                        CallAfter([this, history_strs, message_data]() {
-                            m_messageView->Freeze();
-                            for (size_t idx = 0; idx < history_strs->size(); ++idx) {
-                                if (!(*history_strs)[idx].IsEmpty()) {
-                                    m_messageView->Insert((*history_strs)[idx], idx);
-                                    m_messageView->SetClientObject(idx,
-                                                                   new CMessageClientData((*message_data)[idx].first,
-                                                                                          (*message_data)[idx].second));
-                                }
-                            }
-                            m_messageView->Thaw();
-                        });
-                    }
-                    continue;
-                }
 
-                GetUser(sender_user_id, [this, history_idx, message_queue, message_ptr = message.get(), history_strs,
-                                         message_data, completed_count, total_messages](const td::td_api::user* user) {
-                    wxString name =
-                        (user) ? wxString::FromUTF8(user->first_name_ + " " + user->last_name_) : "Unknown User";
-                    (*history_strs)[history_idx] = FormatMessageForView(message_ptr, name);
-
-                    if (++(*completed_count) == total_messages) {
-                        CallAfter([this, history_strs, message_data]() {
-                            m_messageView->Freeze();
-                            for (size_t idx = 0; idx < history_strs->size(); ++idx) {
-                                if (!(*history_strs)[idx].IsEmpty()) {
-                                    m_messageView->Insert((*history_strs)[idx], idx);
-                                    m_messageView->SetClientObject(idx,
-                                                                   new CMessageClientData((*message_data)[idx].first,
-                                                                                          (*message_data)[idx].second));
-                                }
-                            }
-                            m_messageView->Thaw();
-                        });
+            // The page is shown when the last of its unknown senders has answered.
+            RequestSenders(m_chatScope, history->messages_, TdManager::Priority::Interactive)
+                .then([this, older, fromId, messages = std::move(history->messages_)](
+                          std::vector<TdResult<td::td_api::user>> users) mutable {
+                    for (auto& user : users) {
+                        if (user.isOk()) {
+                            m_peers.setUser(*user.value);
+                        }
                     }
+                    (older ? m_olderPage : m_newerPage).inFlight = false;
+                    InsertMessagePage(std::move(messages), older, fromId);
+                    // The view may still be near an end: a short first page, or a reader who kept scrolling.
+                    CheckVisibleMessagePaging();
                 });
-            }
+        });
+}
 
-            std::vector<long long> messageIds;
-            for (const auto& msg : *message_queue) {
-                messageIds.push_back(msg->id_);
-            }
-            MarkMessagesAsRead(chatId, messageIds);
+void CMainWindow::InsertMessagePage(std::vector<td::td_api::object_ptr<td::td_api::message>> messages, bool older,
+                                    long long fromId) {
+    // A page in the other direction may have evicted this end meanwhile; this page would then leave a gap.
+    if ((older ? m_messageWindow.getOldestId() : m_messageWindow.getNewestId()) != fromId) {
+        return;
+    }
+    const bool wasEmpty = m_messageWindow.empty();
+    const long selected = m_messageView->GetSelectedRow();
+    const long long selectedId = selected != -1 ? m_messageWindow.at(selected)->id_ : 0;
+    const long perPage = std::max(1, m_messageView->GetCountPerPage());
+    const long top = m_messageView->GetTopItem();
+
+    const std::size_t added =
+        older ? m_messageWindow.addOlder(std::move(messages)) : m_messageWindow.addNewer(std::move(messages));
+    if (added == 0) {
+        return;
+    }
+
+    // The rows the reader was looking at, as they are numbered now. A freshly opened chat shows its newest messages.
+    const long count = static_cast<long>(m_messageWindow.size());
+    long firstVisible = wasEmpty ? std::max(0L, count - perPage) : top + (older ? static_cast<long>(added) : 0);
+    if (wasEmpty && m_restoreMessageId != 0) {
+        const auto restored = m_messageWindow.indexOf(m_restoreMessageId);
+        if (restored != MessageWindow::npos) {
+            firstVisible = static_cast<long>(restored);
         }
-    });
+        m_restoreMessageId = 0;
+    }
+    const long lastVisible = std::min(count - 1, firstVisible + perPage - 1);
+    const long evicted = static_cast<long>(TrimMessageWindow(older, firstVisible, lastVisible));
+    firstVisible -= evicted;
+
+    // The rows on screen stay where they were: the view is scrolled by exactly the rows inserted above them, with
+    // painting held until it is, so the page does not jump while it comes in.
+    m_messageView->Freeze();
+    m_messageView->SetItemCount(static_cast<long>(m_messageWindow.size()));
+    m_messageView->Refresh();
+    m_messageView->ScrollToRow(firstVisible);
+    // The control keeps the selection by row, so it has to be moved along with the message.
+    if (selectedId != 0) {
+        const auto row = m_messageWindow.indexOf(selectedId);
+        m_messageView->SelectRow(row == MessageWindow::npos ? -1 : static_cast<long>(row));
+    }
+    m_messageView->Thaw();
+    OnMessageViewed();
 }
 
-void CMainWindow::AppendMessage(const td::td_api::object_ptr<td::td_api::message>& message) {
-    long long sender_user_id = 0;
-    if (message->sender_id_->get_id() == td::td_api::messageSenderUser::ID) {
-        sender_user_id = static_cast<const td::td_api::messageSenderUser*>(message->sender_id_.get())->user_id_;
-    } else {
-        wxString sender_name = "A Chat";
-        if (message->sender_id_->get_id() == td::td_api::messageSenderChat::ID) {
-            auto sender_chat_id =
-                static_cast<const td::td_api::messageSenderChat*>(message->sender_id_.get())->chat_id_;
-            auto it = m_chats.find(sender_chat_id);
-            if (it != m_chats.end()) {
-                sender_name = wxString::FromUTF8(it->second->title_);
-            }
-        }
-        wxString formatted_msg = FormatMessageForView(message.get(), sender_name);
-        CallAfter([this, formatted_msg, msg = message.get()]() {
-            m_messageView->Append(formatted_msg);
-            int newIndex = m_messageView->GetCount() - 1;
-            m_messageView->SetClientObject(newIndex, new CMessageClientData(msg->id_, msg->chat_id_));
-            m_messageView->SetSelection(newIndex);
-        });
+std::size_t CMainWindow::TrimMessageWindow(bool evictNewer, long firstVisible, long lastVisible) {
+    const std::size_t size = m_messageWindow.size();
+    if (size <= MESSAGE_WINDOW_MAX_MESSAGES) {
+        return 0;
+    }
+    // Only the far end goes, and a page of margin around what is on screen always stays.
+    const std::size_t excess = size - MESSAGE_WINDOW_MAX_MESSAGES;
+    if (evictNewer) {
+        const std::size_t keep = static_cast<std::size_t>(lastVisible + 1 + MESSAGE_PAGE_SIZE);
+        m_messageWindow.evictNewer(std::min(excess, size > keep ? size - keep : 0));
+        return 0;
+    }
+    const std::size_t evictable = firstVisible > MESSAGE_PAGE_SIZE ? firstVisible - MESSAGE_PAGE_SIZE : 0;
+    return m_messageWindow.evictOlder(std::min(excess, evictable));
+}
+
+wxString CMainWindow::FormatMessageRow(long row) {
+    if (row < 0 || static_cast<std::size_t>(row) >= m_messageWindow.size()) {
+        return wxString();
+    }
+    const td::td_api::message* message = m_messageWindow.at(row);
+    return FormatMessageForView(message);
+}
+
+void CMainWindow::AppendMessage(td::td_api::object_ptr<td::td_api::message> message) {
+    // Only lands in the window while it reaches the newest end; otherwise paging down brings it in.
+    if (!m_messageWindow.addLatest(std::move(message))) {
         return;
     }
+    const long last = static_cast<long>(m_messageWindow.size()) - 1;
+    const long perPage = std::max(1, m_messageView->GetCountPerPage());
+    TrimMessageWindow(false, std::max(0L, last - perPage + 1), last);
+
+    // TDLib sends updateUser before any object that refers to the user, so the sender is already known here.
+    const long newIndex = static_cast<long>(m_messageWindow.size()) - 1;
+    m_messageView->SetItemCount(newIndex + 1);
+    m_messageView->Refresh();
+    m_messageView->SelectRow(newIndex);
+    m_messageView->EnsureVisible(newIndex);
+}
 
-    GetUser(sender_user_id, [this, msg = message.get()](const td::td_api::user* user) {
-        if (user) {
-            wxString name = wxString::FromUTF8(user->first_name_ + " " + user->last_name_);
-            wxString formatted_msg = FormatMessageForView(msg, name);
-            CallAfter([this, formatted_msg, msg]() {
-                m_messageView->Append(formatted_msg);
-                int newIndex = m_messageView->GetCount() - 1;
-                m_messageView->SetClientObject(newIndex, new CMessageClientData(msg->id_, msg->chat_id_));
-                m_messageView->SetSelection(newIndex);
-            });
-        }
-    });
+void CMainWindow::MarkMessagesAsRead(long long chatId, const std::vector<std::int64_t>& messageIds, bool forceRead) {
+    m_readTracker.markViewed(chatId, messageIds, forceRead);
+    // Not restarted by later marks, so a reader who keeps scrolling still reports once per interval.
+    if (m_readTracker.hasPending() && !m_readTimer.IsRunning()) {
+        m_readTimer.StartOnce(static_cast<int>(READ_RECEIPT_DELAY.count()));
+    }
 }
 
-void CMainWindow::MarkMessagesAsRead(long long chatId, const std::vector<long long>& messageIds, bool forceRead) {
-    auto viewMessages = td::td_api::make_object<td::td_api::viewMessages>();
-    viewMessages->chat_id_ = chatId;
-    for (const long long& message : messageIds) {
-        viewMessages->message_ids_.push_back(message);
+void CMainWindow::FlushReadReceipts() {
+    m_readTimer.Stop();
+    for (auto& batch : m_readTracker.takePending()) {
+        auto viewMessages = td::td_api::make_object<td::td_api::viewMessages>();
+        viewMessages->chat_id_ = batch.chat_id;
+        viewMessages->message_ids_ = std::move(batch.message_ids);
+        viewMessages->force_read_ = batch.force_read;
+        m_client.send(std::move(viewMessages), nullptr, TdManager::Priority::Background);
     }
-    viewMessages->force_read_ = true;
-    g_mainFrame->getTdManager()->send(std::move(viewMessages));
+}
+
+void CMainWindow::OnReadTimer(wxTimerEvent& event) {
+    FlushReadReceipts();
 }
 
 void CMainWindow::OnMessageViewed() {
     if (m_currentChatId == 0)
         return;
 
-    int visibleStart = m_messageView->GetTopItem();
-    int visibleEnd = visibleStart + m_messageView->GetCountPerPage();
+    const long visibleStart = m_messageView->GetTopItem();
+    const long visibleEnd = visibleStart + m_messageView->GetCountPerPage();
 
-    std::vector<long long> visibleMessageIds;
-    for (int i = visibleStart; i <= visibleEnd && i < m_messageView->GetCount(); ++i) {
-        auto* clientData = static_cast<CMessageClientData*>(m_messageView->GetClientObject(i));
-        if (clientData) {
-            visibleMessageIds.push_back(clientData->GetMessageId());
-        }
+    std::vector<std::int64_t> visibleMessageIds;
+    for (long i = visibleStart; i <= visibleEnd && i < static_cast<long>(m_messageWindow.size()); ++i) {
+        visibleMessageIds.push_back(m_messageWindow.at(i)->id_);
     }
 
     if (!visibleMessageIds.empty()) {
@@ -779,13 +1302,17 @@ void CMainWindow::OnSendPressed(wxCommandEvent& event) {
     sendMessage->chat_id_ = m_currentChatId;
     sendMessage->input_message_content_ = std::move(content);
 
-    g_mainFrame->getTdManager()->send(std::move(sendMessage), [this](TdManager::Object object) {
-        if (object->get_id() == td::td_api::error::ID) {
-            auto error = td::td_api::move_object_as<td::td_api::error>(object);
-            wxString error_msg = wxString::Format("Failed to send message: %s", wxString::FromUTF8(error->message_));
-            CallAfter([error_msg]() { wxMessageBox(error_msg, "Error", wxOK | wxICON_ERROR); });
-        }
-    });
+    m_client.send(
+        std::move(sendMessage),
+        [this](TdManager::Object object) {
+            if (object->get_id() == td::td_api::error::ID) {
+                auto error = td::td_api::move_object_as<td::td_api::error>(object);
+                wxString error_msg =
+                    wxString::Format("Failed to send message: %s", utf8ToWxString(error->message_));
+                wxMessageBox(error_msg, "Error", wxOK | wxICON_ERROR);
+            }
+        },
+        TdManager::Priority::Interactive);
 
     m_messageInput->Clear();
     m_messageInput->SetFocus();
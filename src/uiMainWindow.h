@@ -1,13 +1,27 @@
 #ifndef UI_MAIN_WINDOW_H
 #define UI_MAIN_WINDOW_H
 
+#include "chatStore.h"
+#include "messageWindow.h"
+#include "peerCache.h"
+#include "readTracker.h"
+#include "requestScope.h"
+#include "rowFormatter.h"
 #include "tdManager.h"
+#include "uiVirtualListCtrl.h"
+#include "updateDispatcher.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <wx/simplebook.h>
 #include <wx/splitter.h>
+#include <wx/timer.h>
 #include <wx/wx.h>
 
 class CMainWindow final : public wxPanel {
@@ -18,35 +32,162 @@ class CMainWindow final : public wxPanel {
         EDIT
     };
 
-    CMainWindow(wxSimplebook* book);
+    // The chat list is painted from the snapshot at `snapshotPath` right away and saved back there; an empty path
+    // does without one.
+    CMainWindow(wxSimplebook* book, TdClient& client, UpdateDispatcher& updates, const std::string& snapshotPath);
+    ~CMainWindow();
 
-    void ProcessUpdate(td::td_api::object_ptr<td::td_api::Object> update);
+    // Deletes the snapshot and stops saving it, for an account that is logged out.
+    void DiscardSnapshot();
 
     void SwitchChatWindowState(const EChatWindowState& state);
 
   private:
-    void ProcessChatUpdate(td::td_api::object_ptr<td::td_api::chat> chat);
-    void FormatAndUpdateChatListEntry(const td::td_api::object_ptr<td::td_api::chat>& chat,
-                                      const td::td_api::user* user);
+    void OnUpdateChatFolders(td::td_api::updateChatFolders& update);
+    void OnUpdateNewChat(td::td_api::updateNewChat& update);
+    void OnUpdateChatTitle(td::td_api::updateChatTitle& update);
+    void OnUpdateChatLastMessage(td::td_api::updateChatLastMessage& update);
+    void OnNewMessageNotification(td::td_api::updateNewMessage& update);
+    void OnUpdateNewMessage(td::td_api::updateNewMessage& update);
+    void OnUpdateChatPosition(td::td_api::updateChatPosition& update);
+    void OnUpdateMessageContent(td::td_api::updateMessageContent& update);
+    void OnUpdateMessageEdited(td::td_api::updateMessageEdited& update);
+    void OnUpdateMessageSendSucceeded(td::td_api::updateMessageSendSucceeded& update);
+    void OnUpdateMessageSendFailed(td::td_api::updateMessageSendFailed& update);
+    void OnUpdateDeleteMessages(td::td_api::updateDeleteMessages& update);
+    // Swaps a sent message's temporary id for the one TDLib settled on, repainting only the rows involved.
+    void ReplaceMessage(long long oldId, td::td_api::object_ptr<td::td_api::message> message);
+    void OnUpdateChatReadInbox(td::td_api::updateChatReadInbox& update);
+    void OnUpdateUser(td::td_api::updateUser& update);
+    void OnUpdateBasicGroup(td::td_api::updateBasicGroup& update);
+    void OnUpdateSupergroup(td::td_api::updateSupergroup& update);
+    void OnUpdateSecretChat(td::td_api::updateSecretChat& update);
 
-    wxString FormatMessageForView(const td::td_api::message* message, const wxString& sender_name);
+    ChatListId GetCurrentListId() const;
+    // The parts of a chat row that are formatted separately, as flags for UpdateChatInList.
+    enum EChatRowField : unsigned char {
+        ROW_TITLE = 1,
+        ROW_USER = 2,
+        ROW_UNREAD = 4,
+        ROW_LAST_MESSAGE = 8,
+        ROW_ALL = ROW_TITLE | ROW_USER | ROW_UNREAD | ROW_LAST_MESSAGE
+    };
+
+    // A chat row's formatted segments and the text made from them. Segments are reformatted only when their field
+    // was marked dirty; positions are not part of the text, so moving a row never reformats it. Segments stay UTF-8
+    // and the row is converted to wxString only when its composed text changes.
+    struct CChatRow {
+        std::string title;
+        std::string userStatus;
+        std::string unread;
+        std::string lastMessage;
+        std::string utf8;
+        wxString text;
+        unsigned int dirty{ROW_ALL};
+    };
+
+    // What is remembered of a chat list while another one is shown.
+    struct CChatListView {
+        long topRow{0};
+        // A loadChats is in flight, and whether TDLib has answered 404 (every chat of the list announced).
+        bool loadRequested{false};
+        bool allLoaded{false};
+    };
 
-    void OnChatSelected(wxCommandEvent& event);
+    // Mirrors a move in the store onto m_chatList when it concerns the shown list.
+    void ApplyChatMove(const ChatStore::Move& move);
+    void RebuildChatList();
+    void SyncChatSelection();
+    wxString FormatChatRow(long long chatId);
+    // Reformats the dirty segments; returns true if the row's text changed.
+    bool RenderChatRow(long long chatId, CChatRow& row);
+
+    wxString FormatMessageForView(const td::td_api::message* message);
+
+    void RestoreSnapshot();
+    void SaveSnapshot();
+    void OnSnapshotTimer(wxTimerEvent& event);
+    // Removes chats that only the snapshot still had from a list TDLib has now loaded completely.
+    void DropSnapshotChats(ChatListId list);
+    // Forgets the chat if it is in no list and not open.
+    void CollectChat(long long chatId);
+    // Asks TDLib again for a chat that was collected and has come back into a list.
+    void FetchChat(long long chatId);
+    // Keeps the chat's last message as the short preview its row shows.
+    void StoreLastMessage(long long chatId, const td::td_api::message* message);
+    void StoreLastMessage(long long chatId, long long messageId, int date, const td::td_api::MessageContent* content);
+
+    void OnChatSelected(wxListEvent& event);
+    // Switches the message view to the chat, scrolled to `topMessageId` if it is among the first page loaded.
+    void OpenChat(long long chatId, long long topMessageId = 0);
+    // Moves the open chat's window into m_parkedChats and leaves no chat open; the chat stays open in TDLib.
+    void ParkOpenChat();
+    // Tells TDLib the chat is no longer shown, once it is neither open nor parked.
+    void CloseTdChat(long long chatId);
+    // Shows m_messageWindow, which already holds messages, from `topMessageId` or else from the newest ones.
+    void ShowMessageWindow(long long topMessageId, long long selectedMessageId);
+    void SchedulePrefetch();
+    void OnPrefetchTimer(wxTimerEvent& event);
+    // Requests first pages for the chats most likely to be opened next that have none yet, within the budget.
+    void PrefetchLikelyChats();
+    // The chats PrefetchLikelyChats wants ready, most likely first.
+    std::vector<long long> GetLikelyChats() const;
+    void PrefetchChat(long long chatId);
+    // The window of a chat that is not open but keeps its messages, parked or prefetched; null if there is none.
+    MessageWindow* FindCachedWindow(long long chatId);
+    // The open chat's window or else FindCachedWindow.
+    MessageWindow* FindWindow(long long chatId);
     void OnSendPressed(wxCommandEvent& event);
     void OnFolderSelected(wxCommandEvent& event);
-    void LoadChats();
-    void GetUser(long long userId, std::function<void(const td::td_api::user*)> callback);
-    void LoadMessages(long long chatId);
-    void AppendMessage(const td::td_api::object_ptr<td::td_api::message>& message);
-    void MarkMessagesAsRead(long long chatId, const std::vector<long long>& messageIds, bool forceRead = false);
+    // Has TDLib announce the list's chats page by page until it answers 404; later changes arrive as position
+    // updates. At most one request per list is in flight.
+    void LoadChats(ChatListId list, TdManager::Priority priority = TdManager::Priority::Normal);
+    // Swaps the shown list for another one the store already keeps ordered.
+    void ShowChatList(ChatListId list);
+    void GetUser(RequestScope& scope, long long userId, std::function<void(const UserRecord*)> callback,
+                 TdManager::Priority priority = TdManager::Priority::Normal);
+    void AppendSenderName(RowFormatter& formatter, const td::td_api::message* message);
+    // Requests the senders of the messages that are not known yet; ready once every one of them has answered.
+    TdFuture<std::vector<TdResult<td::td_api::user>>> RequestSenders(
+        RequestScope& scope, const std::vector<td::td_api::object_ptr<td::td_api::message>>& messages,
+        TdManager::Priority priority);
+    // Requests the next page of the open chat's history, older or newer than what the window holds.
+    void LoadMessages(bool older);
+    // Adds a page that continues the window from `fromId`; dropped if that end of the window has moved since.
+    void InsertMessagePage(std::vector<td::td_api::object_ptr<td::td_api::message>> messages, bool older,
+                           long long fromId);
+    // Evicts past the window budget from the end away from the visible rows; returns the rows removed before them.
+    std::size_t TrimMessageWindow(bool evictNewer, long firstVisible, long lastVisible);
+    void CheckMessagePaging(long first, long last);
+    void CheckVisibleMessagePaging();
+    void OnPagingTimer(wxTimerEvent& event);
+    wxString FormatMessageRow(long row);
+    void AppendMessage(td::td_api::object_ptr<td::td_api::message> message);
+    // Queues the messages for the next viewMessages of the chat; see ReadTracker.
+    void MarkMessagesAsRead(long long chatId, const std::vector<std::int64_t>& messageIds, bool forceRead = false);
+    void FlushReadReceipts();
+    void OnReadTimer(wxTimerEvent& event);
     void OnMessageViewed();
-    void UpdateChatInList(long long chatId);
-    void OnMessageSelected(wxCommandEvent& event);
+    // Marks the changed fields of the chat's row dirty and repaints the row if it is on screen and reads differently.
+    void UpdateChatInList(long long chatId, unsigned int changed);
+    void OnMessageSelected(wxListEvent& event);
+    void OnMessageCacheHint(wxListEvent& event);
 
     wxSimplebook* m_book;
+    TdClient& m_client;
+    UpdateDispatcher& m_updates;
+    // Work for the open chat and for the shown chat list; switching either drops what the previous one still had
+    // in flight.
+    RequestScope m_chatScope;
+    RequestScope m_folderScope;
+    // loadChats for every list, which goes on whichever list is shown.
+    RequestScope m_listScope;
+    // History pages loaded ahead of time; they never hold up the open chat's requests.
+    RequestScope m_prefetchScope;
+    std::vector<UpdateDispatcher::SubscriptionId> m_subscriptions;
     wxListBox* m_folderList;
-    wxListBox* m_chatList;
-    wxListBox* m_messageView;
+    CVirtualListCtrl* m_chatList;
+    CVirtualListCtrl* m_messageView;
     wxStaticText* m_messageInputLabel; // We store it as member, because it can be broadcast or payed message.
     wxTextCtrl* m_messageInput;
     wxButton* m_attachMediaButton;
@@ -56,19 +197,46 @@ class CMainWindow final : public wxPanel {
 
     long long m_lastChatId{0};
     long long m_lastChatOrder{0x7FFFFFFFFFFFFFFF};
-    long long m_lastMessageId{0};
     EChatWindowState m_ChatState{MESSAGING};
     bool m_allChatsLoaded{false};
-    bool m_loadingMore{false};
+    // One history page of the open chat at most per direction is in flight.
+    struct CPageRequest {
+        bool inFlight{false};
+        std::chrono::steady_clock::time_point sentAt{};
+    };
+    CPageRequest m_olderPage;
+    CPageRequest m_newerPage;
+    // Looks at the view again once a throttled page may be requested.
+    wxTimer m_pagingTimer;
+    ReadTracker m_readTracker;
+    wxTimer m_readTimer;
 
-    td::td_api::object_ptr<td::td_api::ChatList> m_currentChatList;
-    std::map<int32_t, td::td_api::object_ptr<td::td_api::chatFolderInfo>> m_chatFolders;
+    ChatListId m_currentListId{kMainChatList};
+    std::unordered_map<ChatListId, CChatListView> m_listViews;
+    std::vector<td::td_api::object_ptr<td::td_api::chatFolderInfo>> m_chatFolders;
 
-    std::map<long long, td::td_api::object_ptr<td::td_api::chat>> m_chats;
-    std::map<long long, td::td_api::object_ptr<td::td_api::user>> m_users;
-    std::map<long long, td::td_api::object_ptr<td::td_api::basicGroup>> m_basicGroups;
-    std::map<long long, td::td_api::object_ptr<td::td_api::supergroup>> m_supergroups;
-    std::map<long long, td::td_api::object_ptr<td::td_api::secretChat>> m_secretChats;
+    ChatStore m_chatStore;
+    // Shared by every row formatted on the UI thread; see RowFormatter.
+    RowFormatter m_formatter;
+    Utf8Cache m_messageTexts;
+    std::unordered_map<long long, CChatRow> m_chatRows;
+    MessageWindow m_messageWindow;
+    MessageWindowCache m_parkedChats;
+    // First pages of chats never opened yet, kept up to date like parked ones but not open in TDLib.
+    MessageWindowCache m_prefetchedChats;
+    std::set<long long> m_prefetchingChats;
+    wxTimer m_prefetchTimer;
+    // Message to scroll to once the first page of the open chat arrives.
+    long long m_restoreMessageId{0};
+    std::string m_snapshotPath;
+    wxTimer m_snapshotTimer;
+    // Chats restored from the snapshot that TDLib has not announced yet.
+    std::set<long long> m_snapshotChats;
+    // Chats asked for again with getChat and not answered yet.
+    std::set<long long> m_requestedChats;
+    PeerCache m_peers;
+    // Users asked for on behalf of chat rows and not answered yet.
+    std::set<long long> m_requestedUsers;
 };
 
 #endif
@@ -0,0 +1,61 @@
+#include "uiVirtualListCtrl.h"
+
+#include <algorithm>
+#include <utility>
+
+CVirtualListCtrl::CVirtualListCtrl(wxWindow* parent, const wxString& column, RowTextProvider provider)
+    : wxListCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize,
+                 wxLC_REPORT | wxLC_VIRTUAL | wxLC_SINGLE_SEL | wxLC_NO_HEADER),
+      m_provider(std::move(provider)) {
+    InsertColumn(0, column);
+    Bind(wxEVT_SIZE, &CVirtualListCtrl::OnSize, this);
+}
+
+void CVirtualListCtrl::RefreshRows(long from, long to) {
+    const long count = GetItemCount();
+    if (count == 0) {
+        return;
+    }
+    from = std::clamp(from, 0L, count - 1);
+    to = std::clamp(to, 0L, count - 1);
+    RefreshItems(std::min(from, to), std::max(from, to));
+}
+
+long CVirtualListCtrl::GetSelectedRow() const {
+    return GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+}
+
+void CVirtualListCtrl::SelectRow(long row) {
+    const long selected = GetSelectedRow();
+    if (selected == row) {
+        return;
+    }
+    if (selected != -1) {
+        SetItemState(selected, 0, wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED);
+    }
+    if (row != -1) {
+        SetItemState(row, wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED, wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED);
+    }
+}
+
+void CVirtualListCtrl::ScrollToRow(long row) {
+    const long count = GetItemCount();
+    if (count == 0) {
+        return;
+    }
+    row = std::clamp(row, 0L, count - 1);
+    // EnsureVisible scrolls as little as it can: bringing in the last row of the wanted page first leaves the row
+    // itself at the top whether the list was above or below it.
+    EnsureVisible(std::min(count - 1, row + std::max(GetCountPerPage(), 1) - 1));
+    EnsureVisible(row);
+}
+
+wxString CVirtualListCtrl::OnGetItemText(long item, long column) const {
+    return m_provider ? m_provider(item) : wxString();
+}
+
+void CVirtualListCtrl::OnSize(wxSizeEvent& event) {
+    // The only column always spans the control, so there is never a horizontal scrollbar to navigate.
+    SetColumnWidth(0, GetClientSize().GetWidth());
+    event.Skip();
+}
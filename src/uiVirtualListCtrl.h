@@ -0,0 +1,33 @@
+#ifndef UI_VIRTUAL_LIST_CTRL_H
+#define UI_VIRTUAL_LIST_CTRL_H
+
+#include <functional>
+#include <wx/listctrl.h>
+#include <wx/wx.h>
+
+// Single-column virtual list (chats, messages). The control keeps no text of its own: it asks the owner for the
+// rows that are on screen, so a list of thousands of entries costs only what is visible, and a reorder is a refresh
+// of the affected rows. It stays a native list view, so screen readers announce rows and positions as before.
+class CVirtualListCtrl final : public wxListCtrl {
+  public:
+    using RowTextProvider = std::function<wxString(long row)>;
+
+    CVirtualListCtrl(wxWindow* parent, const wxString& column, RowTextProvider provider);
+
+    // Rows from..to (inclusive, in either order) changed text or now hold other entries.
+    void RefreshRows(long from, long to);
+    // Selected, focused row or -1.
+    long GetSelectedRow() const;
+    // Selects and focuses the row without scrolling; -1 clears the selection.
+    void SelectRow(long row);
+    // Scrolls so that the row is the first one on screen, or as close to it as the list's length allows.
+    void ScrollToRow(long row);
+
+  private:
+    wxString OnGetItemText(long item, long column) const override;
+    void OnSize(wxSizeEvent& event);
+
+    RowTextProvider m_provider;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "updateCoalescer.h"
+
+#include <utility>
+
+namespace {
+std::int64_t getChatListKey(const td::td_api::ChatList* list) {
+    if (!list) {
+        return -1;
+    }
+    switch (list->get_id()) {
+        case td::td_api::chatListMain::ID:
+            return 0;
+        case td::td_api::chatListArchive::ID:
+            return 1;
+        case td::td_api::chatListFolder::ID:
+            return 2 + static_cast<const td::td_api::chatListFolder*>(list)->chat_folder_id_;
+        default:
+            return -1;
+    }
+}
+
+// Users and sender chats share one key space; chat ids are shifted so they can never collide with user ids.
+std::int64_t getSenderKey(const td::td_api::MessageSender* sender) {
+    if (!sender) {
+        return 0;
+    }
+    if (sender->get_id() == td::td_api::messageSenderUser::ID) {
+        return static_cast<const td::td_api::messageSenderUser*>(sender)->user_id_;
+    }
+    return -static_cast<const td::td_api::messageSenderChat*>(sender)->chat_id_ - (1ll << 52);
+}
+} // namespace
+
+UpdateCoalescer::UpdateCoalescer(std::size_t soft_limit, std::size_t hard_limit,
+                                 std::function<void()> schedule_drain)
+    : soft_limit_(soft_limit), hard_limit_(hard_limit < soft_limit ? soft_limit : hard_limit),
+      schedule_drain_(std::move(schedule_drain)) {}
+
+void UpdateCoalescer::push(TdManager::UpdateBatch batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto& update : batch) {
+        if (!update.object && !update.task) {
+            continue;
+        }
+        ++stats_.received;
+        if (live_ >= hard_limit_ && !closed_) {
+            ++stats_.producer_waits;
+            scheduleDrain(lock);
+            space_available_.wait(lock, [this]() { return live_ < hard_limit_ || closed_; });
+        }
+        enqueue(std::move(update));
+    }
+    if (live_ > 0) {
+        scheduleDrain(lock);
+    }
+}
+
+void UpdateCoalescer::drain(TdManager::UpdateBatch& out) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.reserve(out.size() + live_);
+        for (auto& update : queue_) {
+            if (update.object || update.task) {
+                out.push_back(std::move(update));
+            }
+        }
+        stats_.delivered += live_;
+        queue_.clear();
+        latest_.clear();
+        live_ = 0;
+        drain_scheduled_ = false;
+    }
+    space_available_.notify_all();
+}
+
+void UpdateCoalescer::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    space_available_.notify_all();
+}
+
+UpdateCoalescer::Stats UpdateCoalescer::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.queued = live_;
+    return stats;
+}
+
+void UpdateCoalescer::enqueue(TdManager::Update update) {
+    // Response tasks carry no object: they are never dropped or merged, only kept behind the updates before them.
+    if (update.object) {
+        if (live_ >= soft_limit_ && isDroppable(*update.object)) {
+            ++stats_.dropped;
+            return;
+        }
+
+        Key key;
+        if (getCoalesceKey(update, key)) {
+            auto it = latest_.find(key);
+            if (it != latest_.end()) {
+                queue_[it->second].object.reset();
+                it->second = queue_.size();
+                ++stats_.merged;
+                queue_.push_back(std::move(update));
+                // A stream of updates to the same few objects would otherwise grow the queue without ever reaching
+                // the limits, which only count live entries.
+                if (queue_.size() - live_ > live_) {
+                    compact();
+                }
+                return;
+            }
+            latest_.emplace(key, queue_.size());
+        }
+    }
+    queue_.push_back(std::move(update));
+    ++live_;
+    if (live_ > stats_.high_water) {
+        stats_.high_water = live_;
+    }
+}
+
+void UpdateCoalescer::compact() {
+    std::vector<std::size_t> moved_to(queue_.size());
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < queue_.size(); ++i) {
+        if (queue_[i].object || queue_[i].task) {
+            moved_to[i] = kept;
+            if (kept != i) {
+                queue_[kept] = std::move(queue_[i]);
+            }
+            ++kept;
+        }
+    }
+    queue_.resize(kept);
+    for (auto& entry : latest_) {
+        entry.second = moved_to[entry.second];
+    }
+}
+
+void UpdateCoalescer::scheduleDrain(std::unique_lock<std::mutex>& lock) {
+    if (drain_scheduled_ || !schedule_drain_) {
+        return;
+    }
+    drain_scheduled_ = true;
+    lock.unlock();
+    schedule_drain_();
+    lock.lock();
+}
+
+bool UpdateCoalescer::getCoalesceKey(const TdManager::Update& client_update, Key& key) {
+    const auto& update = *client_update.object;
+    key = {client_update.client_id, update.get_id(), 0, 0};
+    switch (update.get_id()) {
+        case td::td_api::updateChatLastMessage::ID:
+            key.object_id = static_cast<const td::td_api::updateChatLastMessage&>(update).chat_id_;
+            return true;
+        case td::td_api::updateChatPosition::ID: {
+            const auto& position_update = static_cast<const td::td_api::updateChatPosition&>(update);
+            key.object_id = position_update.chat_id_;
+            key.sub_id = position_update.position_ ? getChatListKey(position_update.position_->list_.get()) : -1;
+            return true;
+        }
+        case td::td_api::updateChatReadInbox::ID:
+            key.object_id = static_cast<const td::td_api::updateChatReadInbox&>(update).chat_id_;
+            return true;
+        case td::td_api::updateChatReadOutbox::ID:
+            key.object_id = static_cast<const td::td_api::updateChatReadOutbox&>(update).chat_id_;
+            return true;
+        case td::td_api::updateChatTitle::ID:
+            key.object_id = static_cast<const td::td_api::updateChatTitle&>(update).chat_id_;
+            return true;
+        case td::td_api::updateChatOnlineMemberCount::ID:
+            key.object_id = static_cast<const td::td_api::updateChatOnlineMemberCount&>(update).chat_id_;
+            return true;
+        case td::td_api::updateUserStatus::ID:
+            key.object_id = static_cast<const td::td_api::updateUserStatus&>(update).user_id_;
+            return true;
+        case td::td_api::updateChatAction::ID: {
+            const auto& action_update = static_cast<const td::td_api::updateChatAction&>(update);
+            key.object_id = action_update.chat_id_;
+            key.sub_id = getSenderKey(action_update.sender_id_.get());
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool UpdateCoalescer::isDroppable(const td::td_api::Object& update) {
+    // Typing and upload indicators describe a moment that has already passed by the time a backlog is drained.
+    return update.get_id() == td::td_api::updateChatAction::ID;
+}
@@ -0,0 +1,91 @@
+#ifndef UPDATE_COALESCER_H
+#define UPDATE_COALESCER_H
+
+#include "tdManager.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Queue between the TDLib thread and the UI thread. State-carrying updates that supersede each other
+// (last message, position in a list, read inbox, title, user status, ...) are merged per (client, kind, object) so
+// only the newest survives; typing notifications are dropped once the queue is over its soft limit, and the
+// producer blocks once it reaches the hard limit, pushing the backlog back into TDLib until the UI catches up.
+// Response tasks for the UI (see TdManager::Update) queue in arrival order with the updates.
+class UpdateCoalescer {
+  public:
+    struct Stats {
+        std::uint64_t received;
+        std::uint64_t merged;
+        std::uint64_t dropped;
+        std::uint64_t delivered;
+        std::uint64_t producer_waits;
+        std::size_t queued;
+        std::size_t high_water;
+    };
+
+    // `schedule_drain` is invoked from the producer thread whenever the queue goes from drained to non-empty; it
+    // must arrange for drain() to be called on the consumer thread.
+    UpdateCoalescer(std::size_t soft_limit, std::size_t hard_limit, std::function<void()> schedule_drain);
+
+    // Called on the TDLib thread.
+    void push(TdManager::UpdateBatch batch);
+    // Called on the UI thread. Moves every queued update, oldest first, into `out`.
+    void drain(TdManager::UpdateBatch& out);
+    // Releases a producer blocked on the hard limit; later pushes never block.
+    void close();
+
+    Stats getStats() const;
+
+  private:
+    struct Key {
+        std::int32_t client_id;
+        std::int32_t kind;
+        std::int64_t object_id;
+        std::int64_t sub_id;
+
+        bool operator==(const Key& other) const {
+            return client_id == other.client_id && kind == other.kind && object_id == other.object_id &&
+                   sub_id == other.sub_id;
+        }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const {
+            std::uint64_t h = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.client_id)) << 32) |
+                              static_cast<std::uint32_t>(key.kind);
+            h = h * 0x9E3779B97F4A7C15ull ^ static_cast<std::uint64_t>(key.object_id);
+            h = h * 0x9E3779B97F4A7C15ull ^ static_cast<std::uint64_t>(key.sub_id);
+            return static_cast<std::size_t>(h ^ (h >> 29));
+        }
+    };
+
+    static bool getCoalesceKey(const TdManager::Update& update, Key& key);
+    static bool isDroppable(const td::td_api::Object& update);
+
+    void enqueue(TdManager::Update update);
+    // Squeezes out superseded entries and points latest_ at the new positions.
+    void compact();
+    void scheduleDrain(std::unique_lock<std::mutex>& lock);
+
+    const std::size_t soft_limit_;
+    const std::size_t hard_limit_;
+    const std::function<void()> schedule_drain_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable space_available_;
+    // Superseded entries are reset to null in place so the surviving updates keep their relative order, and squeezed
+    // out once they outnumber the live ones.
+    TdManager::UpdateBatch queue_;
+    std::unordered_map<Key, std::size_t, KeyHash> latest_;
+    std::size_t live_{0};
+    bool drain_scheduled_{false};
+    bool closed_{false};
+
+    Stats stats_{};
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "updateDispatcher.h"
+
+#include <algorithm>
+
+namespace {
+constexpr std::size_t kInitialSlots = 256;
+}
+
+UpdateDispatcher::UpdateDispatcher() : slots_(kInitialSlots, Slot{0, nullptr}) {}
+
+void UpdateDispatcher::unsubscribe(SubscriptionId id) {
+    for (auto& entry : entries_) {
+        auto it = std::find_if(entry.handlers.begin(), entry.handlers.end(),
+                               [id](const Handler& handler) { return handler.id == id; });
+        if (it != entry.handlers.end()) {
+            entry.handlers.erase(it);
+            return;
+        }
+    }
+}
+
+bool UpdateDispatcher::dispatch(td::td_api::Object& update) {
+    Entry& entry = getEntry(update.get_id());
+    ++entry.hits;
+    for (auto& handler : entry.handlers) {
+        handler.invoke(update);
+    }
+    return !entry.handlers.empty();
+}
+
+std::vector<UpdateDispatcher::TypeStats> UpdateDispatcher::getStats() const {
+    std::vector<TypeStats> stats;
+    stats.reserve(entries_.size());
+    for (const auto& entry : entries_) {
+        stats.push_back({entry.constructor_id, entry.hits, entry.handlers.size()});
+    }
+    std::sort(stats.begin(), stats.end(), [](const TypeStats& a, const TypeStats& b) { return a.hits > b.hits; });
+    return stats;
+}
+
+UpdateDispatcher::SubscriptionId UpdateDispatcher::addHandler(std::int32_t constructor_id,
+                                                              std::function<void(td::td_api::Object&)> invoke) {
+    SubscriptionId id = next_subscription_id_++;
+    getEntry(constructor_id).handlers.push_back({id, std::move(invoke)});
+    return id;
+}
+
+UpdateDispatcher::Entry& UpdateDispatcher::getEntry(std::int32_t constructor_id) {
+    const std::size_t mask = slots_.size() - 1;
+    for (std::size_t i = hashId(constructor_id) & mask;; i = (i + 1) & mask) {
+        Slot& slot = slots_[i];
+        if (slot.entry && slot.constructor_id == constructor_id) {
+            return *slot.entry;
+        }
+        if (!slot.entry) {
+            break;
+        }
+    }
+
+    // Unknown constructor: give it an entry so its hits are counted even without handlers.
+    entries_.push_back({constructor_id, 0, {}});
+    Entry* entry = &entries_.back();
+    if ((entries_.size()) * 2 > slots_.size()) {
+        std::vector<Slot> grown(slots_.size() * 2, Slot{0, nullptr});
+        for (auto& existing : entries_) {
+            insertSlot(grown, &existing);
+        }
+        slots_ = std::move(grown);
+    } else {
+        insertSlot(slots_, entry);
+    }
+    return *entry;
+}
+
+void UpdateDispatcher::insertSlot(std::vector<Slot>& slots, Entry* entry) {
+    const std::size_t mask = slots.size() - 1;
+    std::size_t i = hashId(entry->constructor_id) & mask;
+    while (slots[i].entry) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = {entry->constructor_id, entry};
+}
+
+std::size_t UpdateDispatcher::hashId(std::int32_t constructor_id) {
+    // TL constructor ids are CRC32 values already; one multiply spreads them over the low bits.
+    return static_cast<std::size_t>((static_cast<std::uint32_t>(constructor_id) * 0x9E3779B1u) >> 8);
+}
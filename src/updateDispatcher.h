@@ -0,0 +1,75 @@
+#ifndef UPDATE_DISPATCHER_H
+#define UPDATE_DISPATCHER_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <td/telegram/td_api.h>
+#include <utility>
+#include <vector>
+
+// Routes updates to handlers registered for a concrete td_api::update* type. Lookup is a flat open-addressed
+// table keyed by the TL constructor id, each handler receives the update already downcast, and every constructor
+// that passes through is counted. Handlers of one type run in subscription order and share the same object, so a
+// handler that moves fields out of the update must be subscribed after the ones that only read it.
+// A handler may subscribe or unsubscribe other update types, but not the type it is currently handling.
+class UpdateDispatcher {
+  public:
+    using SubscriptionId = std::uint32_t;
+
+    struct TypeStats {
+        std::int32_t constructor_id;
+        std::uint64_t hits;
+        std::size_t handlers;
+    };
+
+    UpdateDispatcher();
+
+    template <class T, class F> SubscriptionId subscribe(F&& handler) {
+        return addHandler(T::ID, [fn = std::forward<F>(handler)](td::td_api::Object& update) {
+            fn(static_cast<T&>(update));
+        });
+    }
+
+    template <class T, class C> SubscriptionId subscribe(C* object, void (C::*method)(T&)) {
+        return addHandler(T::ID, [object, method](td::td_api::Object& update) {
+            (object->*method)(static_cast<T&>(update));
+        });
+    }
+
+    void unsubscribe(SubscriptionId id);
+
+    // Returns false when nobody is subscribed to the update's type.
+    bool dispatch(td::td_api::Object& update);
+
+    std::vector<TypeStats> getStats() const;
+
+  private:
+    struct Handler {
+        SubscriptionId id;
+        std::function<void(td::td_api::Object&)> invoke;
+    };
+
+    struct Entry {
+        std::int32_t constructor_id;
+        std::uint64_t hits;
+        std::vector<Handler> handlers;
+    };
+
+    struct Slot {
+        std::int32_t constructor_id;
+        Entry* entry;
+    };
+
+    SubscriptionId addHandler(std::int32_t constructor_id, std::function<void(td::td_api::Object&)> invoke);
+    Entry& getEntry(std::int32_t constructor_id);
+    void insertSlot(std::vector<Slot>& slots, Entry* entry);
+    static std::size_t hashId(std::int32_t constructor_id);
+
+    // Power-of-two sized, at most half full; entries live in a deque so their addresses stay stable on growth.
+    std::vector<Slot> slots_;
+    std::deque<Entry> entries_;
+    SubscriptionId next_subscription_id_{1};
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "updateTrace.h"
+
+#include "tlCodec.h"
+
+#include <algorithm>
+
+namespace {
+constexpr char kMagic[4] = {'M', 'G', 'T', 'R'};
+constexpr char kVersion = 1;
+constexpr std::size_t kFlushThreshold = 1 << 16;
+// Larger payloads are treated as corruption rather than allocated.
+constexpr std::uint64_t kMaxPayloadSize = 64ull << 20;
+
+void appendVarint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+std::uint64_t zigzag(std::int32_t value) {
+    return (static_cast<std::uint64_t>(static_cast<std::int64_t>(value)) << 1) ^
+           static_cast<std::uint64_t>(static_cast<std::int64_t>(value) >> 63);
+}
+
+std::int32_t unzigzag(std::uint64_t value) {
+    return static_cast<std::int32_t>(static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1));
+}
+} // namespace
+
+UpdateTraceWriter::~UpdateTraceWriter() {
+    flush();
+}
+
+bool UpdateTraceWriter::open(const std::string& path) {
+    file_.open(path, std::ios::binary | std::ios::trunc);
+    if (!file_) {
+        return false;
+    }
+    buffer_.assign(kMagic, sizeof(kMagic));
+    buffer_.push_back(kVersion);
+    flush();
+    return static_cast<bool>(file_);
+}
+
+void UpdateTraceWriter::write(UpdateTraceRecord::Kind kind, std::chrono::microseconds time, std::int32_t client_id,
+                              std::int32_t function_id, const td::td_api::Object& object) {
+    payload_.clear();
+    if (!TlCodec::encode(object, payload_)) {
+        ++skipped_;
+        return;
+    }
+    const auto delta = time > last_time_ ? time - last_time_ : std::chrono::microseconds::zero();
+    last_time_ += delta;
+
+    buffer_.push_back(static_cast<char>(kind));
+    appendVarint(buffer_, static_cast<std::uint64_t>(delta.count()));
+    appendVarint(buffer_, zigzag(client_id));
+    if (kind == UpdateTraceRecord::RESPONSE) {
+        appendVarint(buffer_, zigzag(function_id));
+    }
+    appendVarint(buffer_, payload_.size());
+    buffer_.append(payload_);
+    ++written_;
+    if (buffer_.size() >= kFlushThreshold) {
+        flush();
+    }
+}
+
+void UpdateTraceWriter::flush() {
+    if (file_ && !buffer_.empty()) {
+        file_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        file_.flush();
+    }
+    buffer_.clear();
+}
+
+bool UpdateTraceReader::open(const std::string& path) {
+    file_.open(path, std::ios::binary);
+    char header[sizeof(kMagic) + 1];
+    if (!file_ || !file_.read(header, sizeof(header))) {
+        return false;
+    }
+    return std::equal(kMagic, kMagic + sizeof(kMagic), header) && header[sizeof(kMagic)] == kVersion;
+}
+
+bool UpdateTraceReader::next(UpdateTraceRecord& record) {
+    for (;;) {
+        char kind = 0;
+        std::uint64_t delta = 0;
+        std::uint64_t client_id = 0;
+        std::uint64_t function_id = 0;
+        std::uint64_t size = 0;
+        if (!file_.get(kind) || !readVarint(delta) || !readVarint(client_id)) {
+            return false;
+        }
+        if (kind == UpdateTraceRecord::RESPONSE && !readVarint(function_id)) {
+            return false;
+        }
+        if (!readVarint(size) || size > kMaxPayloadSize) {
+            return false;
+        }
+        payload_.resize(static_cast<std::size_t>(size));
+        if (size > 0 && !file_.read(&payload_[0], static_cast<std::streamsize>(size))) {
+            return false;
+        }
+        time_ += std::chrono::microseconds(static_cast<std::int64_t>(delta));
+
+        if (kind != UpdateTraceRecord::UPDATE && kind != UpdateTraceRecord::RESPONSE) {
+            continue;
+        }
+        auto object = TlCodec::decode(payload_.data(), payload_.size());
+        if (!object) {
+            continue;
+        }
+        record.kind = static_cast<UpdateTraceRecord::Kind>(kind);
+        record.time = time_;
+        record.client_id = unzigzag(client_id);
+        record.function_id = unzigzag(function_id);
+        record.object = std::move(object);
+        return true;
+    }
+}
+
+bool UpdateTraceReader::readVarint(std::uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        char byte = 0;
+        if (!file_.get(byte)) {
+            return false;
+        }
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,66 @@
+#ifndef UPDATE_TRACE_H
+#define UPDATE_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <td/telegram/td_api.h>
+
+// A recorded stream of TDLib traffic: every update and every response, with the time it arrived.
+// File layout: the magic "MGTR", a format version byte, then records of
+//   kind (1 byte) | microseconds since the previous record | client id | function id (responses only) |
+//   payload length | payload (TlCodec encoding)
+// with all integers as varints. Objects TlCodec cannot encode are counted and left out.
+struct UpdateTraceRecord {
+    enum Kind : unsigned char {
+        UPDATE = 1,
+        RESPONSE = 2
+    };
+
+    Kind kind{UPDATE};
+    // Since the start of the recording.
+    std::chrono::microseconds time{0};
+    std::int32_t client_id{0};
+    // TL id of the function a response answers; 0 for updates.
+    std::int32_t function_id{0};
+    td::td_api::object_ptr<td::td_api::Object> object;
+};
+
+class UpdateTraceWriter {
+  public:
+    ~UpdateTraceWriter();
+
+    bool open(const std::string& path);
+    void write(UpdateTraceRecord::Kind kind, std::chrono::microseconds time, std::int32_t client_id,
+               std::int32_t function_id, const td::td_api::Object& object);
+
+    std::uint64_t getWritten() const { return written_; }
+    std::uint64_t getSkipped() const { return skipped_; }
+
+  private:
+    void flush();
+
+    std::ofstream file_;
+    std::string buffer_;
+    std::string payload_;
+    std::chrono::microseconds last_time_{0};
+    std::uint64_t written_{0};
+    std::uint64_t skipped_{0};
+};
+
+class UpdateTraceReader {
+  public:
+    bool open(const std::string& path);
+    // Reads the next record, skipping any whose payload does not decode. Returns false at the end of the trace.
+    bool next(UpdateTraceRecord& record);
+
+  private:
+    bool readVarint(std::uint64_t& value);
+
+    std::ifstream file_;
+    std::string payload_;
+    std::chrono::microseconds time_{0};
+};
+
+#endif
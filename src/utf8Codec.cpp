@@ -0,0 +1,571 @@
+#include "utf8Codec.h"
+
+#include <functional>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define UTF8_CODEC_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace {
+
+static_assert(sizeof(wchar_t) == 2 || sizeof(wchar_t) == 4, "wchar_t is expected to be UTF-16 or UTF-32");
+
+// Widens the longest ASCII prefix of [in, in + size) whole blocks at a time and returns its length.
+using AsciiKernel = std::size_t (*)(const unsigned char* in, std::size_t size, wchar_t* out);
+
+// Validates and decodes [in, in + size) 16 bytes at a time, multi-byte characters included. Stops in front of a block
+// of pure ASCII, so the ASCII kernel can take over, or when less than a block is left; that tail, and everything on a
+// CPU without a block decoder, goes to the scalar decoder. `read` is kInvalidUtf8 if a block is malformed.
+struct BlockResult {
+    std::size_t read;
+    std::size_t written;
+};
+using BlockDecoder = BlockResult (*)(const unsigned char* in, std::size_t size, wchar_t* out);
+
+BlockResult decodeNoBlocks(const unsigned char*, std::size_t, wchar_t*) {
+    return {0, 0};
+}
+
+#ifdef UTF8_CODEC_X86
+
+std::size_t widenAsciiSse2(const unsigned char* in, std::size_t size, wchar_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        if (_mm_movemask_epi8(bytes) != 0) {
+            break;
+        }
+        const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        auto* target = reinterpret_cast<__m128i*>(out + i);
+        if constexpr (sizeof(wchar_t) == 2) {
+            _mm_storeu_si128(target, low);
+            _mm_storeu_si128(target + 1, high);
+        } else {
+            _mm_storeu_si128(target, _mm_unpacklo_epi16(low, zero));
+            _mm_storeu_si128(target + 1, _mm_unpackhi_epi16(low, zero));
+            _mm_storeu_si128(target + 2, _mm_unpacklo_epi16(high, zero));
+            _mm_storeu_si128(target + 3, _mm_unpackhi_epi16(high, zero));
+        }
+    }
+    return i;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UTF8_CODEC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define UTF8_CODEC_TARGET_AVX2
+#endif
+
+UTF8_CODEC_TARGET_AVX2 std::size_t widenAsciiAvx2(const unsigned char* in, std::size_t size, wchar_t* out) {
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        if (_mm256_movemask_epi8(bytes) != 0) {
+            break;
+        }
+        auto* target = reinterpret_cast<__m256i*>(out + i);
+        if constexpr (sizeof(wchar_t) == 2) {
+            _mm256_storeu_si256(target, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+            _mm256_storeu_si256(target + 1, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+        } else {
+            for (int part = 0; part < 4; ++part) {
+                const __m128i eight = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i + part * 8));
+                _mm256_storeu_si256(target + part, _mm256_cvtepu8_epi32(eight));
+            }
+        }
+    }
+    // GCC does not always clear the upper halves itself, and the SSE code that runs next would stall on them.
+    _mm256_zeroupper();
+    // A tail of 16 or more still gets a vector pass.
+    return i + widenAsciiSse2(in + i, size - i, out + i);
+}
+
+bool cpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // The OS has to save the YMM registers too, or AVX instructions fault.
+    const bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+    const bool hasAvx = (info[2] & (1 << 28)) != 0;
+    if (!osSavesYmm || !hasAvx) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    // Runs from a static initializer, before the runtime would otherwise have filled in the CPU model.
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+AsciiKernel selectAsciiKernel() {
+    return cpuHasAvx2() ? widenAsciiAvx2 : widenAsciiSse2;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UTF8_CODEC_TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+#define UTF8_CODEC_TARGET_SSE41
+#endif
+
+// Byte pairs the block decoder rejects, classified after Keiser and Lemire, "Validating UTF-8 in less than one
+// instruction per byte". Each table maps one nibble of the pair to the classes it can belong to; the pair is
+// malformed when all three nibbles agree on a class.
+constexpr unsigned char kTooShort = 1 << 0;    // a lead byte not followed by a continuation byte
+constexpr unsigned char kTooLong = 1 << 1;     // a continuation byte after ASCII
+constexpr unsigned char kOverlong3 = 1 << 2;   // E0 80..9F
+constexpr unsigned char kTooLarge = 1 << 3;    // F4 90..BF and F5..FF
+constexpr unsigned char kSurrogate = 1 << 4;   // ED A0..BF
+constexpr unsigned char kOverlong2 = 1 << 5;   // C0 and C1
+constexpr unsigned char kTooLarge1000 = 1 << 6; // F5..FF 80..8F
+constexpr unsigned char kOverlong4 = 1 << 6;   // F0 80..8F
+constexpr unsigned char kTwoConts = 1 << 7;    // two continuation bytes in a row; only right inside a sequence
+constexpr unsigned char kCarry = kTooShort | kTooLong | kTwoConts;
+
+alignas(16) constexpr unsigned char kFirstHigh[16] = {
+    kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+    kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+    kTooShort | kOverlong2,
+    kTooShort,
+    kTooShort | kOverlong3 | kSurrogate,
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4,
+};
+alignas(16) constexpr unsigned char kFirstLow[16] = {
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    kCarry | kOverlong2,
+    kCarry,
+    kCarry,
+    kCarry | kTooLarge,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+};
+alignas(16) constexpr unsigned char kSecondHigh[16] = {
+    kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooShort, kTooShort, kTooShort, kTooShort,
+};
+
+// pshufb controls that pack the lanes picked by a mask to the front of a register and zero the rest: eight 16-bit
+// lanes by an 8-bit mask, or four 32-bit lanes by a 4-bit mask.
+struct CompactTables {
+    unsigned char lanes16[256][16];
+    unsigned char count16[256];
+    unsigned char lanes32[16][16];
+    unsigned char count32[16];
+};
+
+constexpr CompactTables makeCompactTables() {
+    CompactTables tables{};
+    for (unsigned mask = 0; mask < 256; ++mask) {
+        unsigned kept = 0;
+        for (unsigned lane = 0; lane < 8; ++lane) {
+            if (mask & (1u << lane)) {
+                for (unsigned byte = 0; byte < 2; ++byte) {
+                    tables.lanes16[mask][2 * kept + byte] = static_cast<unsigned char>(2 * lane + byte);
+                }
+                ++kept;
+            }
+        }
+        for (unsigned byte = 2 * kept; byte < 16; ++byte) {
+            tables.lanes16[mask][byte] = 0x80;
+        }
+        tables.count16[mask] = static_cast<unsigned char>(kept);
+    }
+    for (unsigned mask = 0; mask < 16; ++mask) {
+        unsigned kept = 0;
+        for (unsigned lane = 0; lane < 4; ++lane) {
+            if (mask & (1u << lane)) {
+                for (unsigned byte = 0; byte < 4; ++byte) {
+                    tables.lanes32[mask][4 * kept + byte] = static_cast<unsigned char>(4 * lane + byte);
+                }
+                ++kept;
+            }
+        }
+        for (unsigned byte = 4 * kept; byte < 16; ++byte) {
+            tables.lanes32[mask][byte] = 0x80;
+        }
+        tables.count32[mask] = static_cast<unsigned char>(kept);
+    }
+    return tables;
+}
+
+alignas(16) constexpr CompactTables kCompact = makeCompactTables();
+
+unsigned countTrailingZeros(unsigned value) {
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanForward(&index, value);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(value));
+#endif
+}
+
+UTF8_CODEC_TARGET_SSE41 __m128i lookupNibbles(const unsigned char (&table)[16], __m128i nibbles) {
+    return _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(table)), nibbles);
+}
+
+// Bytes of `input` in [low, high], as 0xFF lanes; both bounds are at least 0x80.
+UTF8_CODEC_TARGET_SSE41 __m128i bytesBetween(__m128i input, int low, int high) {
+    // Signed compares: 0x80..0xFF are -128..-1, and a bound of 0x100 wraps to 0, above all of them.
+    const __m128i above = _mm_cmpgt_epi8(input, _mm_set1_epi8(static_cast<char>(low - 1)));
+    const __m128i below = _mm_cmplt_epi8(input, _mm_set1_epi8(static_cast<char>(high + 1)));
+    return _mm_and_si128(above, below);
+}
+
+// Whether a block read from a character boundary holds a malformed sequence. A sequence cut off by the end of the
+// block is not an error here; the next block starts at its lead byte.
+UTF8_CODEC_TARGET_SSE41 bool hasMalformedSequence(__m128i input) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i prev1 = _mm_slli_si128(input, 1);
+    const __m128i first_high = lookupNibbles(kFirstHigh, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    const __m128i first_low = lookupNibbles(kFirstLow, _mm_and_si128(prev1, nibble));
+    const __m128i second_high = lookupNibbles(kSecondHigh, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    const __m128i special = _mm_and_si128(_mm_and_si128(first_high, first_low), second_high);
+    // The third and fourth bytes of a sequence are the continuation bytes the pairs flag as kTwoConts; anywhere
+    // else two continuation bytes in a row are an error, and so is anything but one in those places.
+    const __m128i third = _mm_subs_epu8(_mm_slli_si128(input, 2), _mm_set1_epi8(0xE0 - 0x80));
+    const __m128i fourth = _mm_subs_epu8(_mm_slli_si128(input, 3), _mm_set1_epi8(0xF0 - 0x80));
+    const __m128i expected = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+    const __m128i error = _mm_xor_si128(expected, special);
+    return !_mm_testz_si128(error, error);
+}
+
+// Writes the 16-bit lanes of `units` picked by the 8-bit mask to out and returns how many there were.
+UTF8_CODEC_TARGET_SSE41 std::size_t storeUnits16(__m128i units, unsigned kept, wchar_t* out) {
+    const __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kCompact.lanes16[kept]));
+    const __m128i packed = _mm_shuffle_epi8(units, control);
+    auto* target = reinterpret_cast<__m128i*>(out);
+    if constexpr (sizeof(wchar_t) == 2) {
+        _mm_storeu_si128(target, packed);
+    } else {
+        _mm_storeu_si128(target, _mm_cvtepu16_epi32(packed));
+        _mm_storeu_si128(target + 1, _mm_cvtepu16_epi32(_mm_srli_si128(packed, 8)));
+    }
+    return kCompact.count16[kept];
+}
+
+// Writes the 32-bit lanes of `chars` picked by the 4-bit mask to out and returns how many there were.
+UTF8_CODEC_TARGET_SSE41 std::size_t storeChars32(__m128i chars, unsigned kept, wchar_t* out) {
+    const __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kCompact.lanes32[kept]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(chars, control));
+    return kCompact.count32[kept];
+}
+
+// Decodes the characters starting in one half of the block as 16-bit lanes, given its bytes and the payloads of the
+// one and two bytes after each, all widened to 16 bits. Lanes of continuation bytes come out as garbage.
+UTF8_CODEC_TARGET_SSE41 __m128i decodeUnits16(__m128i lead, __m128i next1, __m128i next2, __m128i ascii,
+                                              __m128i three_byte, bool has_three_byte) {
+    __m128i units = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(lead, _mm_set1_epi16(0x1F)), 6), next1);
+    if (has_three_byte) {
+        const __m128i three = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(lead, 12), _mm_slli_epi16(next1, 6)), next2);
+        units = _mm_blendv_epi8(units, three, three_byte);
+    }
+    return _mm_blendv_epi8(units, lead, ascii);
+}
+
+// Decodes the characters starting at bytes 4 * Group to 4 * Group + 3 of the block as 32-bit lanes, given the
+// payloads of the one, two and three bytes after each. Lanes of continuation bytes come out as garbage.
+template <int Group>
+UTF8_CODEC_TARGET_SSE41 __m128i decodeChars32(__m128i input, __m128i next1, __m128i next2, __m128i next3,
+                                              __m128i ascii, __m128i two_byte, __m128i three_byte) {
+    constexpr int kShift = 4 * Group;
+    const __m128i b0 = _mm_cvtepu8_epi32(_mm_srli_si128(input, kShift));
+    const __m128i b1 = _mm_cvtepu8_epi32(_mm_srli_si128(next1, kShift));
+    const __m128i b2 = _mm_cvtepu8_epi32(_mm_srli_si128(next2, kShift));
+    const __m128i b3 = _mm_cvtepu8_epi32(_mm_srli_si128(next3, kShift));
+    const __m128i two = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x1F)), 6), b1);
+    const __m128i three = _mm_or_si128(
+        _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x0F)), 12), _mm_slli_epi32(b1, 6)), b2);
+    const __m128i four =
+        _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x07)), 18), _mm_slli_epi32(b1, 12)),
+                     _mm_or_si128(_mm_slli_epi32(b2, 6), b3));
+    __m128i chars = _mm_blendv_epi8(four, three, _mm_cvtepi8_epi32(_mm_srli_si128(three_byte, kShift)));
+    chars = _mm_blendv_epi8(chars, two, _mm_cvtepi8_epi32(_mm_srli_si128(two_byte, kShift)));
+    return _mm_blendv_epi8(chars, b0, _mm_cvtepi8_epi32(_mm_srli_si128(ascii, kShift)));
+}
+
+// Replaces the lanes of four-byte characters with their high surrogates and returns the low surrogates.
+UTF8_CODEC_TARGET_SSE41 __m128i splitSurrogates(__m128i& chars, __m128i four_byte) {
+    const __m128i high = _mm_add_epi32(_mm_set1_epi32(0xD800 - (0x10000 >> 10)), _mm_srli_epi32(chars, 10));
+    const __m128i low = _mm_or_si128(_mm_set1_epi32(0xDC00), _mm_and_si128(chars, _mm_set1_epi32(0x3FF)));
+    chars = _mm_blendv_epi8(chars, high, four_byte);
+    return low;
+}
+
+UTF8_CODEC_TARGET_SSE41 BlockResult decodeBlocksSse41(const unsigned char* in, std::size_t size, wchar_t* out) {
+    // Each block writes at most one unit per byte it reads, so with out sized to the input, full-register stores at
+    // out + written stay inside it as long as a whole block is left to read.
+    BlockResult result{0, 0};
+    while (size - result.read >= 16) {
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + result.read));
+        const unsigned non_ascii = static_cast<unsigned>(_mm_movemask_epi8(input));
+        if (non_ascii == 0) {
+            break;
+        }
+        if (hasMalformedSequence(input)) {
+            return {kInvalidUtf8, 0};
+        }
+
+        const __m128i ascii = _mm_cmpgt_epi8(input, _mm_set1_epi8(-1));
+        const __m128i two_byte = bytesBetween(input, 0xC0, 0xDF);
+        const __m128i three_byte = bytesBetween(input, 0xE0, 0xEF);
+        const __m128i four_byte = bytesBetween(input, 0xF0, 0xFF);
+        const unsigned two_mask = static_cast<unsigned>(_mm_movemask_epi8(two_byte));
+        const unsigned three_mask = static_cast<unsigned>(_mm_movemask_epi8(three_byte));
+        const unsigned four_mask = static_cast<unsigned>(_mm_movemask_epi8(four_byte));
+        const unsigned leads = two_mask | three_mask | four_mask;
+
+        // A character that runs past the block is left for the next one, which starts at its lead byte.
+        const unsigned cut_off = (two_mask & 0x8000) | (three_mask & 0xC000) | (four_mask & 0xE000);
+        const unsigned length = cut_off != 0 ? countTrailingZeros(cut_off) : 16;
+        const unsigned starts = (~non_ascii | leads) & ((1u << length) - 1);
+
+        const __m128i payload = _mm_set1_epi8(0x3F);
+        const __m128i next1 = _mm_and_si128(_mm_srli_si128(input, 1), payload);
+        const __m128i next2 = _mm_and_si128(_mm_srli_si128(input, 2), payload);
+        wchar_t* target = out + result.written;
+        std::size_t written = 0;
+        if (four_mask == 0) {
+            const __m128i zero = _mm_setzero_si128();
+            const bool has_three_byte = three_mask != 0;
+            const __m128i low = decodeUnits16(_mm_unpacklo_epi8(input, zero), _mm_unpacklo_epi8(next1, zero),
+                                              _mm_unpacklo_epi8(next2, zero), _mm_unpacklo_epi8(ascii, ascii),
+                                              _mm_unpacklo_epi8(three_byte, three_byte), has_three_byte);
+            const __m128i high = decodeUnits16(_mm_unpackhi_epi8(input, zero), _mm_unpackhi_epi8(next1, zero),
+                                               _mm_unpackhi_epi8(next2, zero), _mm_unpackhi_epi8(ascii, ascii),
+                                               _mm_unpackhi_epi8(three_byte, three_byte), has_three_byte);
+            written = storeUnits16(low, starts & 0xFF, target);
+            written += storeUnits16(high, starts >> 8, target + written);
+        } else {
+            const __m128i next3 = _mm_and_si128(_mm_srli_si128(input, 3), payload);
+            __m128i chars[4] = {
+                decodeChars32<0>(input, next1, next2, next3, ascii, two_byte, three_byte),
+                decodeChars32<1>(input, next1, next2, next3, ascii, two_byte, three_byte),
+                decodeChars32<2>(input, next1, next2, next3, ascii, two_byte, three_byte),
+                decodeChars32<3>(input, next1, next2, next3, ascii, two_byte, three_byte),
+            };
+            if constexpr (sizeof(wchar_t) == 4) {
+                for (unsigned group = 0; group < 4; ++group) {
+                    written += storeChars32(chars[group], (starts >> (4 * group)) & 0xF, target + written);
+                }
+            } else {
+                // Past U+FFFF a character takes two units: the high surrogate goes in the lane of its lead byte and
+                // the low one in the lane of the byte after it.
+                __m128i lows[4];
+                lows[0] = splitSurrogates(chars[0], _mm_cvtepi8_epi32(four_byte));
+                lows[1] = splitSurrogates(chars[1], _mm_cvtepi8_epi32(_mm_srli_si128(four_byte, 4)));
+                lows[2] = splitSurrogates(chars[2], _mm_cvtepi8_epi32(_mm_srli_si128(four_byte, 8)));
+                lows[3] = splitSurrogates(chars[3], _mm_cvtepi8_epi32(_mm_srli_si128(four_byte, 12)));
+                const __m128i low_units = _mm_packus_epi32(lows[0], lows[1]);
+                const __m128i high_units = _mm_packus_epi32(lows[2], lows[3]);
+                const __m128i second = _mm_slli_si128(four_byte, 1);
+                const __m128i low = _mm_blendv_epi8(_mm_packus_epi32(chars[0], chars[1]),
+                                                    _mm_slli_si128(low_units, 2), _mm_unpacklo_epi8(second, second));
+                const __m128i high =
+                    _mm_blendv_epi8(_mm_packus_epi32(chars[2], chars[3]), _mm_alignr_epi8(high_units, low_units, 14),
+                                    _mm_unpackhi_epi8(second, second));
+                const unsigned kept = starts | ((starts & four_mask) << 1);
+                written = storeUnits16(low, kept & 0xFF, target);
+                written += storeUnits16(high, (kept >> 8) & 0xFF, target + written);
+            }
+        }
+        result.read += length;
+        result.written += written;
+    }
+    return result;
+}
+
+bool cpuHasSse41() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    // SSSE3 for pshufb and palignr, SSE4.1 for the blends and widening loads.
+    return (info[2] & (1 << 9)) != 0 && (info[2] & (1 << 19)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+BlockDecoder selectBlockDecoder() {
+    return cpuHasSse41() ? decodeBlocksSse41 : decodeNoBlocks;
+}
+
+#else
+
+std::size_t widenAsciiScalar(const unsigned char* in, std::size_t size, wchar_t* out) {
+    std::size_t i = 0;
+    while (i < size && in[i] < 0x80) {
+        out[i] = static_cast<wchar_t>(in[i]);
+        ++i;
+    }
+    return i;
+}
+
+AsciiKernel selectAsciiKernel() {
+    return widenAsciiScalar;
+}
+
+BlockDecoder selectBlockDecoder() {
+    return decodeNoBlocks;
+}
+
+#endif
+
+const AsciiKernel widenAscii = selectAsciiKernel();
+const BlockDecoder decodeBlocks = selectBlockDecoder();
+
+// Decodes one multi-byte sequence starting at in[i], rejecting overlong forms, surrogates and code points past
+// U+10FFFF. Returns the sequence length, or 0 if it is malformed.
+std::size_t decodeSequence(const unsigned char* in, std::size_t size, std::size_t i, char32_t& code) {
+    const unsigned char lead = in[i];
+    std::size_t length = 0;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+        code = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        code = lead & 0x0F;
+        if (lead == 0xE0) {
+            low = 0xA0;
+        } else if (lead == 0xED) {
+            high = 0x9F;
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        code = lead & 0x07;
+        if (lead == 0xF0) {
+            low = 0x90;
+        } else if (lead == 0xF4) {
+            high = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+    if (size - i < length || in[i + 1] < low || in[i + 1] > high) {
+        return 0;
+    }
+    code = (code << 6) | (in[i + 1] & 0x3F);
+    for (std::size_t k = 2; k < length; ++k) {
+        if ((in[i + k] & 0xC0) != 0x80) {
+            return 0;
+        }
+        code = (code << 6) | (in[i + k] & 0x3F);
+    }
+    return length;
+}
+
+} // namespace
+
+std::size_t decodeUtf8(std::string_view text, wchar_t* out) {
+    const auto* in = reinterpret_cast<const unsigned char*>(text.data());
+    const std::size_t size = text.size();
+    std::size_t i = 0;
+    std::size_t written = 0;
+    while (i < size) {
+        const std::size_t ascii = widenAscii(in + i, size - i, out + written);
+        i += ascii;
+        written += ascii;
+
+        // The ASCII kernel stops only in front of a block with a multi-byte character in it, which the block decoder
+        // takes; what comes past both is the tail shorter than a block, or text on a CPU without a block decoder.
+        if (size - i >= 16) {
+            const BlockResult blocks = decodeBlocks(in + i, size - i, out + written);
+            if (blocks.read == kInvalidUtf8) {
+                return kInvalidUtf8;
+            }
+            i += blocks.read;
+            written += blocks.written;
+            if (blocks.read != 0) {
+                continue;
+            }
+        }
+
+        // Decode up to a block's worth one character at a time before trying the vector paths again.
+        const std::size_t blockEnd = i + 32;
+        while (i < size && i < blockEnd) {
+            if (in[i] < 0x80) {
+                out[written++] = static_cast<wchar_t>(in[i++]);
+                continue;
+            }
+            char32_t code = 0;
+            const std::size_t length = decodeSequence(in, size, i, code);
+            if (length == 0) {
+                return kInvalidUtf8;
+            }
+            i += length;
+            if (sizeof(wchar_t) == 2 && code >= 0x10000) {
+                code -= 0x10000;
+                out[written++] = static_cast<wchar_t>(0xD800 + (code >> 10));
+                out[written++] = static_cast<wchar_t>(0xDC00 + (code & 0x3FF));
+            } else {
+                out[written++] = static_cast<wchar_t>(code);
+            }
+        }
+    }
+    return written;
+}
+
+wxString utf8ToWxString(std::string_view text) {
+#if wxUSE_UNICODE_UTF8
+    // wxString already holds UTF-8 in this build; checking the text is all that is left to do.
+    static thread_local std::wstring scratch;
+    scratch.resize(text.size());
+    if (decodeUtf8(text, scratch.data()) != kInvalidUtf8) {
+        return wxString::FromUTF8Unchecked(text.data(), text.size());
+    }
+#else
+    static thread_local std::wstring buffer;
+    if (buffer.size() < text.size()) {
+        buffer.resize(text.size());
+    }
+    const std::size_t length = decodeUtf8(text, buffer.data());
+    if (length != kInvalidUtf8) {
+        return wxString(buffer.data(), length);
+    }
+#endif
+    return wxString::FromUTF8(text.data(), text.size());
+}
+
+const wxString& Utf8Cache::convert(std::string_view text) {
+    const std::size_t hash = std::hash<std::string_view>{}(text);
+    Slot& slot = slots_[hash % slots_.size()];
+    if (slot.hash != hash || slot.text != text) {
+        slot.hash = hash;
+        slot.text.assign(text.data(), text.size());
+        slot.converted = utf8ToWxString(text);
+    }
+    return slot.converted;
+}
+
+void Utf8Cache::clear() {
+    for (Slot& slot : slots_) {
+        slot = Slot{};
+    }
+}
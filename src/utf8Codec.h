@@ -0,0 +1,40 @@
+#ifndef UTF8_CODEC_H
+#define UTF8_CODEC_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <wx/string.h>
+
+// Decodes UTF-8 into wchar_t (UTF-16 on Windows, UTF-32 elsewhere) and returns the number of units written, or
+// kInvalidUtf8 if the text is not well-formed UTF-8. `out` must have room for text.size() units, which is always
+// enough. Runs of ASCII are widened 16 or 32 bytes at a time with SSE2 or AVX2, whichever the CPU has; blocks with
+// two-, three- and four-byte characters are validated and decoded 16 bytes at a time with SSE4.1, and only the tail
+// shorter than a block, or everything on a CPU without SSE4.1, is decoded one character at a time.
+inline constexpr std::size_t kInvalidUtf8 = static_cast<std::size_t>(-1);
+std::size_t decodeUtf8(std::string_view text, wchar_t* out);
+
+// Same result as wxString::FromUTF8, which goes through the generic wxMBConv machinery one character at a time.
+// Malformed text is handed to wxString::FromUTF8 so that it is treated the way wx treats it.
+wxString utf8ToWxString(std::string_view text);
+
+// Remembers the wxString of recently converted texts, for views that ask for the same rows over and over while
+// scrolling and repainting. Direct-mapped by hash: a collision just replaces the slot.
+// One instance per thread.
+class Utf8Cache {
+  public:
+    const wxString& convert(std::string_view text);
+    void clear();
+
+  private:
+    struct Slot {
+        std::size_t hash{0};
+        std::string text;
+        wxString converted;
+    };
+
+    std::array<Slot, 1024> slots_{};
+};
+
+#endif